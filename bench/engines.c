@@ -0,0 +1,381 @@
+/**
+ * Benchmark suite for the convolution engines: convolves synthetic inputs
+ * with synthetic impulse responses over a matrix of lengths, and reports
+ * each engine's throughput, the wall time of each stage & the peak
+ * resident set size. File I/O is left out, so that only the engines and
+ * the fused normalize & 16-bit encode pass that follows them are measured.
+ *
+ * Each case is run reps times and the fastest run is reported. The direct
+ * form is skipped once a case would take more than DIRECT_MAX_MACS
+ * multiply-adds.
+ *
+ * With -o, one JSON object per case is written to results (JSON Lines);
+ * with -c, every case is compared against the same case in a results file
+ * saved earlier, and any whose throughput has dropped by more than the
+ * tolerance (-T, in percent) is reported as a regression, making the exit
+ * status non-zero.
+ *
+ * Compile with:
+ *     gcc -O2 engines.c -lsndfile -lpthread -lm -o engines
+ *
+ * Run with:
+ *     ./engines [-e engine,...] [-i irSeconds,...] [-n inputSeconds,...]
+ *               [-t threads] [-r reps] [-o results] [-c baseline [-T tolerance]]
+ *
+ * e.g. ./engines -i 0.1,1,10 -n 1,60,3600 -e ola,ola-float,upols
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "../src/convolve.h"
+
+#define SAMPLE_RATE 44100
+#define DIRECT_MAX_MACS 2e10
+#define MAX_SIZES 16
+
+#define USAGE "Usage: engines [-e engine,...] [-i irSeconds,...] [-n inputSeconds,...]\n" \
+			  "               [-t threads] [-r reps] [-o results] [-c baseline [-T tolerance]]\n"
+
+typedef struct BenchEngine {
+	char *name;
+	int engine, precision;
+} BenchEngine;
+
+BenchEngine engines[] = {
+	{"direct", ENGINE_INPUT_SIDE, PRECISION_DOUBLE},
+	{"ola", ENGINE_OVERLAP_ADD, PRECISION_DOUBLE},
+	{"ola-float", ENGINE_OVERLAP_ADD, PRECISION_FLOAT},
+	{"upols", ENGINE_UNIFORM_PARTITIONED, PRECISION_DOUBLE},
+	{"nupols", ENGINE_NONUNIFORM_PARTITIONED, PRECISION_DOUBLE},
+};
+#define NUM_ENGINES (int)(sizeof(engines) / sizeof(BenchEngine))
+
+typedef struct BenchResult {
+	char engine[32];
+	int ir_len, input_len, threads;
+	double convolve_s, encode_s, total_s;
+	double samples_per_s;
+	long peak_rss_kb;
+} BenchResult;
+
+/**
+ * Return a monotonic timestamp in seconds.
+ */
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Fill a mono WaveData struct with length samples of white noise in
+ * [-0.5, 0.5], decaying by decay per sample (1.0 for none). A xorshift
+ * generator keeps hour-long inputs quick to make.
+ */
+WaveData synthetic_wave(int length, unsigned int seed, double decay) {
+	WaveData wave_data;
+	wave_data.length = length;
+	wave_data.channels = 1;
+	wave_data.sampleData = (double *)malloc(sizeof(double) * length);
+	if (wave_data.sampleData == NULL) {
+		wave_data.length = -1;
+		return wave_data;
+	}
+	unsigned int s = seed;
+	double gain = 1.0;
+	for (int j = 0; j < length; j++) {
+		s ^= s << 13;
+		s ^= s >> 17;
+		s ^= s << 5;
+		wave_data.sampleData[j] = ((double)s / 4294967295.0 - 0.5) * gain;
+		gain *= decay;
+	}
+	return wave_data;
+}
+
+/**
+ * Reset the peak resident set size, where the kernel allows it (Linux).
+ */
+void reset_peak_rss() {
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if (fp != NULL) {
+		fputs("5", fp);
+		fclose(fp);
+	}
+}
+
+/**
+ * Return the peak resident set size in KiB: since the last
+ * reset_peak_rss() on Linux, since the process started elsewhere.
+ */
+long peak_rss_kb() {
+	char line[256];
+	long kb = -1;
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+				break;
+		fclose(fp);
+	}
+	if (kb == -1) {
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		kb = ru.ru_maxrss;
+#ifdef __APPLE__
+		kb /= 1024;
+#endif
+	}
+	return kb;
+}
+
+/**
+ * Parse a comma-separated list of durations in seconds into sample counts.
+ * Returns the number of durations, or -1 if any is invalid.
+ */
+int parse_lengths(char *list, int *lengths) {
+	int count = 0;
+	for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		double secs = atof(tok);
+		if (count == MAX_SIZES || secs <= 0.0 || secs * SAMPLE_RATE > 1e9)
+			return -1;
+		lengths[count++] = (int)(secs * SAMPLE_RATE + 0.5);
+	}
+	return count;
+}
+
+/**
+ * Parse a comma-separated list of engine names into flags in selected[].
+ * Returns FALSE if any name is unknown.
+ */
+int parse_engines(char *list, int *selected) {
+	memset(selected, 0, sizeof(int) * NUM_ENGINES);
+	for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		int e;
+		for (e = 0; e < NUM_ENGINES; e++)
+			if (strcmp(tok, engines[e].name) == 0)
+				break;
+		if (e == NUM_ENGINES)
+			return FALSE;
+		selected[e] = TRUE;
+	}
+	return TRUE;
+}
+
+/**
+ * Convolve an input of input_len samples with an impulse response of
+ * ir_len samples through engine be, timing each stage as convolve() would
+ * run it. Returns FALSE if the engine couldn't run.
+ */
+int bench_run(BenchEngine *be, int input_len, int ir_len, BenchResult *res) {
+	engine = be->engine;
+	precision = be->precision;
+	max = DBL_MIN;
+
+	// An exponentially decaying impulse response, down 60 dB at its end:
+	H = synthetic_wave(ir_len, 2, pow(0.001, 1.0 / ir_len));
+	X = synthetic_wave(input_len, 1, 1.0);
+	N = X.length;
+	M = H.length;
+	P = N + M - 1;
+	Y = (double *)aligned_malloc(sizeof(double) * P);
+	short *PCM = (short *)malloc(sizeof(short) * P);
+	if (X.length == -1 || H.length == -1 || Y == NULL || PCM == NULL) {
+		printf("malloc failed while initializing arrays!\n");
+		free(X.sampleData);
+		free(H.sampleData);
+		free(Y);
+		free(PCM);
+		return FALSE;
+	}
+
+	double start = now();
+	run_engine();
+	double t1 = now();
+	scale_pcm16(Y, PCM, P, 1.0 / max, NULL);
+	double t2 = now();
+
+	res->convolve_s = t1 - start;
+	res->encode_s = t2 - t1;
+	res->total_s = t2 - start;
+	res->samples_per_s = input_len / res->total_s;
+
+	free(X.sampleData);
+	free(H.sampleData);
+	free(Y);
+	free(PCM);
+	return TRUE;
+}
+
+/**
+ * Write a result as one line of JSON.
+ */
+void write_result(FILE *fp, BenchResult *res) {
+	fprintf(fp, "{\"engine\": \"%s\", \"ir_len\": %d, \"input_len\": %d, "
+				"\"threads\": %d, \"simd\": \"%s\", \"convolve_s\": %.6f, "
+				"\"encode_s\": %.6f, \"total_s\": %.6f, "
+				"\"samples_per_s\": %.1f, \"peak_rss_kb\": %ld}\n",
+			res->engine, res->ir_len, res->input_len, res->threads,
+			simd_name(simd_level()), res->convolve_s, res->encode_s, res->total_s, res->samples_per_s, res->peak_rss_kb);
+}
+
+/**
+ * Look up the baseline throughput of the case matching res in the results
+ * file baseline. Returns -1 if there is none.
+ */
+double baseline_samples_per_s(char *baseline, BenchResult *res) {
+	char line[1024], name[32];
+	int ir_len, input_len, threads;
+	double samples_per_s = -1.0, sps;
+	FILE *fp = fopen(baseline, "r");
+	if (fp == NULL)
+		return -1.0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *field = strstr(line, "\"samples_per_s\": ");
+		if (sscanf(line, "{\"engine\": \"%31[^\"]\", \"ir_len\": %d, \"input_len\": %d, "
+						 "\"threads\": %d,", name, &ir_len, &input_len, &threads) == 4 &&
+			field != NULL && sscanf(field, "\"samples_per_s\": %lf", &sps) == 1 &&
+			strcmp(name, res->engine) == 0 && ir_len == res->ir_len &&
+			input_len == res->input_len && threads == res->threads)
+			samples_per_s = sps;
+	}
+	fclose(fp);
+	return samples_per_s;
+}
+
+int main(int argc, char **argv) {
+	int ir_lens[MAX_SIZES], input_lens[MAX_SIZES], selected[NUM_ENGINES];
+	int num_irs, num_inputs, reps = 3, engines_ok = TRUE, opt, e, k, n, r;
+	double tolerance = 10.0;
+	char *results = NULL, *baseline = NULL;
+	char default_irs[] = "0.1,1,10", default_inputs[] = "1,10,60";
+
+	for (e = 0; e < NUM_ENGINES; e++)
+		selected[e] = TRUE;
+	num_irs = parse_lengths(default_irs, ir_lens);
+	num_inputs = parse_lengths(default_inputs, input_lens);
+	while ((opt = getopt(argc, argv, "e:i:n:t:r:o:c:T:")) != -1) {
+		switch (opt) {
+			case 'e':
+				engines_ok = parse_engines(optarg, selected);
+				break;
+			case 'i':
+				num_irs = parse_lengths(optarg, ir_lens);
+				break;
+			case 'n':
+				num_inputs = parse_lengths(optarg, input_lens);
+				break;
+			case 't':
+				num_threads = atoi(optarg);
+				if (num_threads == 0)
+					num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'o':
+				results = optarg;
+				break;
+			case 'c':
+				baseline = optarg;
+				break;
+			case 'T':
+				tolerance = atof(optarg);
+				break;
+			default:
+				printf(USAGE);
+				return -1;
+		}
+	}
+	if (optind != argc || engines_ok == FALSE || num_irs < 1 || num_inputs < 1 ||
+		reps < 1 || num_threads < 1 || tolerance < 0.0) {
+		printf(USAGE);
+		return -1;
+	}
+
+	if (baseline != NULL && access(baseline, R_OK) != 0) {
+		printf("Failed to open %s.\n", baseline);
+		return -1;
+	}
+	FILE *out = NULL;
+	if (results != NULL && (out = fopen(results, "w")) == NULL) {
+		printf("Failed to create %s.\n", results);
+		return -1;
+	}
+
+	printf("%s, %d thread(s), best of %d\n\n", simd_name(simd_level()),
+		   num_threads, reps);
+	printf("%-10s %9s %11s %10s %10s %13s %9s %10s\n", "engine", "ir",
+		   "input", "convolve", "encode", "samples/s", "realtime", "peak RSS");
+
+	int regressions = 0;
+	for (k = 0; k < num_irs; k++) {
+		for (n = 0; n < num_inputs; n++) {
+			for (e = 0; e < NUM_ENGINES; e++) {
+				if (selected[e] == FALSE)
+					continue;
+				BenchResult best, res;
+				memset(&best, 0, sizeof(BenchResult));
+				snprintf(best.engine, sizeof(best.engine), "%s", engines[e].name);
+				best.ir_len = ir_lens[k];
+				best.input_len = input_lens[n];
+				best.threads = num_threads;
+				printf("%-10s %8.2fs %10.2fs ", best.engine,
+					   (double)ir_lens[k] / SAMPLE_RATE, (double)input_lens[n] / SAMPLE_RATE);
+
+				if (engines[e].engine == ENGINE_INPUT_SIDE &&
+					(double)ir_lens[k] * input_lens[n] > DIRECT_MAX_MACS) {
+					printf("%10s\n", "skipped");
+					continue;
+				}
+
+				reset_peak_rss();
+				for (r = 0; r < reps; r++) {
+					if (bench_run(&engines[e], input_lens[n], ir_lens[k], &res) == FALSE)
+						break;
+					if (r == 0 || res.total_s < best.total_s) {
+						best.convolve_s = res.convolve_s;
+						best.encode_s = res.encode_s;
+						best.total_s = res.total_s;
+						best.samples_per_s = res.samples_per_s;
+					}
+				}
+				if (r < reps) {
+					printf("%10s\n", "FAILED");
+					regressions++;
+					continue;
+				}
+				best.peak_rss_kb = peak_rss_kb();
+
+				printf("%9.3fs %9.3fs %13.0f %8.1fx %8.1fMB", best.convolve_s,
+					   best.encode_s, best.samples_per_s,
+					   best.samples_per_s / SAMPLE_RATE, best.peak_rss_kb / 1024.0);
+				if (baseline != NULL) {
+					double base = baseline_samples_per_s(baseline, &best);
+					double change = (base > 0.0) ? 100.0 * (best.samples_per_s / base - 1.0) : 0.0;
+					if (base > 0.0 && change < -tolerance) {
+						printf("  REGRESSION %+.1f%%", change);
+						regressions++;
+					}
+					else if (base > 0.0)
+						printf("  %+.1f%%", change);
+				}
+				printf("\n");
+				if (out != NULL)
+					write_result(out, &best);
+			}
+		}
+	}
+
+	if (out != NULL)
+		fclose(out);
+	if (baseline != NULL)
+		printf("\n%d regression(s) beyond %.1f%%\n", regressions, tolerance);
+	precision = PRECISION_DOUBLE;
+	return (regressions == 0) ? 0 : 1;
+}
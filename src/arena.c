@@ -0,0 +1,172 @@
+/**
+ * Aligned allocation & scratch arenas.
+ *
+ * Every buffer the FFT & spectrum kernels stream through is aligned to
+ * ARENA_ALIGN bytes, a cache line & the width of an AVX-512 register, so
+ * no vector load straddles a cache line. aligned_malloc() & aligned_calloc()
+ * return such buffers for long-lived arrays; they are released with free().
+ *
+ * An Arena hands out the short-lived scratch arrays of a convolution from
+ * one aligned block that is kept between convolutions, so that repeated
+ * convolutions (and every file of a batch) make no allocator calls at all.
+ * Allocations are bump-allocated & released together by rolling the arena
+ * back to a mark, like a stack. When the block is too small, the request is
+ * served by a separate allocation instead (still at its place in the stack),
+ * and once the arena is rolled back to empty, the block is regrown to fit
+ * the most that was ever allocated from it at once, so a run only
+ * allocates the first time it sees a larger convolution. An Arena is not
+ * thread-safe: threads either carve their arrays out before they start,
+ * or own an arena each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Alignment of every aligned_malloc() & arena allocation, in bytes:
+#define ARENA_ALIGN 64
+
+typedef struct ArenaOverflow {
+	void *p;
+	size_t at;				// Arena.used when p was allocated
+} ArenaOverflow;
+
+typedef struct Arena {
+	char *base;				// ARENA_ALIGN-aligned block of size bytes
+	size_t size;
+	size_t used;			// Bytes allocated, in or out of the block
+	size_t peak;			// Most bytes ever allocated at once
+	ArenaOverflow *overflow;	// Allocations that didn't fit in the block
+	int num_overflow, overflow_size;
+} Arena;
+
+/**
+ * Round bytes up to a multiple of ARENA_ALIGN, or to 0 (which no
+ * allocation asks for) if that overflows.
+ */
+size_t arena_round(size_t bytes) {
+	if (bytes > (size_t)-1 - ARENA_ALIGN)
+		return 0;
+	return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/**
+ * malloc() bytes aligned to ARENA_ALIGN. Release with free().
+ */
+void * aligned_malloc(size_t bytes) {
+	void *p;
+	size_t size = arena_round(bytes ? bytes : 1);
+	if (size == 0 || posix_memalign(&p, ARENA_ALIGN, size) != 0)
+		return NULL;
+	return p;
+}
+
+/**
+ * calloc() count zeroed elements of size bytes aligned to ARENA_ALIGN.
+ * Release with free().
+ */
+void * aligned_calloc(size_t count, size_t size) {
+	void *p = aligned_malloc(count * size);
+	if (p != NULL)
+		memset(p, 0, count * size);
+	return p;
+}
+
+/**
+ * Release all memory owned by an Arena, leaving it empty.
+ */
+void arena_destroy(Arena *a) {
+	for (int k = 0; k < a->num_overflow; k++)
+		free(a->overflow[k].p);
+	free(a->overflow);
+	free(a->base);
+	memset(a, 0, sizeof(Arena));
+}
+
+/**
+ * Ensure an empty arena's block holds at least bytes; an arena that is in
+ * use is left as it is. Returns FALSE if the block couldn't be grown.
+ */
+int arena_reserve(Arena *a, size_t bytes) {
+	bytes = arena_round(bytes);
+	if (bytes <= a->size || a->used != 0)
+		return TRUE;
+	free(a->base);
+	a->base = (char *)aligned_malloc(bytes);
+	a->size = (a->base != NULL) ? bytes : 0;
+	return (a->base != NULL);
+}
+
+/**
+ * Return the arena's current position, to roll back to with arena_release().
+ */
+size_t arena_mark(Arena *a) {
+	return a->used;
+}
+
+/**
+ * Release everything allocated since mark. Rolling back to an empty arena
+ * also regrows the block to hold the most that was allocated from it.
+ */
+void arena_release(Arena *a, size_t mark) {
+	while (a->num_overflow > 0 && a->overflow[a->num_overflow - 1].at >= mark)
+		free(a->overflow[--a->num_overflow].p);
+	a->used = mark;
+	if (mark == 0 && a->peak > a->size)
+		arena_reserve(a, a->peak);
+}
+
+/**
+ * Allocate bytes, aligned to ARENA_ALIGN, until the arena is rolled back
+ * past them. Returns NULL if the allocation fails.
+ */
+void * arena_alloc(Arena *a, size_t bytes) {
+	bytes = arena_round(bytes ? bytes : 1);
+	if (bytes == 0)
+		return NULL;
+	void *p;
+	if (a->used + bytes <= a->size)
+		p = a->base + a->used;
+	else {
+		// Didn't fit; allocate it separately until it is released:
+		if (a->num_overflow == a->overflow_size) {
+			int size = (a->overflow_size == 0) ? 8 : a->overflow_size * 2;
+			ArenaOverflow *tmp = (ArenaOverflow *)realloc(a->overflow,
+														  sizeof(ArenaOverflow) * size);
+			if (tmp == NULL)
+				return NULL;
+			a->overflow = tmp;
+			a->overflow_size = size;
+		}
+		if ((p = aligned_malloc(bytes)) == NULL)
+			return NULL;
+		a->overflow[a->num_overflow].p = p;
+		a->overflow[a->num_overflow++].at = a->used;
+	}
+	a->used += bytes;
+	if (a->used > a->peak)
+		a->peak = a->used;
+	return p;
+}
+
+/**
+ * arena_alloc() count zeroed elements of size bytes.
+ */
+void * arena_calloc(Arena *a, size_t count, size_t size) {
+	void *p = arena_alloc(a, count * size);
+	if (p != NULL)
+		memset(p, 0, count * size);
+	return p;
+}
+
+/**
+ * Allocate num_channels arrays of length samples each from the arena, like
+ * alloc_channels(). Returns NULL if any allocation fails.
+ */
+double ** arena_channels(Arena *a, int num_channels, int length) {
+	double **channels = (double **)arena_alloc(a, sizeof(double *) * num_channels);
+	for (int ch = 0; channels != NULL && ch < num_channels; ch++)
+		if ((channels[ch] = (double *)arena_alloc(a, sizeof(double) * length)) == NULL)
+			return NULL;
+	return channels;
+}
@@ -0,0 +1,327 @@
+/**
+ * Batch mode: convolve many input files in one process.
+ *
+ * Jobs come from a manifest, one "inputFile outputFile [irFile]" line per
+ * job (blank lines & lines starting with '#' are skipped), or from every
+ * .wav file in a directory. Each distinct impulse response is read and
+ * transformed once, up front; its OLAConvolver then serves as the
+ * prototype that every worker thread clones, so the frequency responses
+ * are shared and each worker keeps its FFT plan & buffers hot from one
+ * file to the next. Workers pull jobs off a shared counter and stream each
+ * file through stream_file().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+typedef struct BatchIR {
+	char *path;
+	double **h;				// Deinterleaved impulse response channels
+	int h_len, channels;
+	OLAConvolver *proto;	// Holds the frequency responses
+} BatchIR;
+
+typedef struct BatchJob {
+	char *input, *output;
+	int ir;					// Index into Batch.irs
+	sf_count_t frames;		// Frames written, or -1 on failure
+	double peak;
+} BatchJob;
+
+typedef struct Batch {
+	BatchJob *jobs;
+	int num_jobs, jobs_size;
+	BatchIR *irs;
+	int num_irs, irs_size;
+	int normalize;
+	int next_job;			// Next job to hand out, guarded by lock
+	pthread_mutex_t lock;
+} Batch;
+
+/**
+ * Release everything a Batch owns, except the Batch itself.
+ */
+void batch_destroy(Batch *b) {
+	for (int j = 0; j < b->num_jobs; j++) {
+		free(b->jobs[j].input);
+		free(b->jobs[j].output);
+	}
+	for (int k = 0; k < b->num_irs; k++) {
+		free(b->irs[k].path);
+		free_channels(b->irs[k].h, b->irs[k].channels);
+		ola_destroy(b->irs[k].proto);
+	}
+	free(b->jobs);
+	free(b->irs);
+}
+
+/**
+ * Return the index of the impulse response at path, reading & transforming
+ * it the first time it is seen. Returns -1 on failure.
+ */
+int batch_ir(Batch *b, char *path) {
+	int k;
+	for (k = 0; k < b->num_irs; k++)
+		if (strcmp(b->irs[k].path, path) == 0)
+			return k;
+
+	if (b->num_irs == b->irs_size) {
+		int size = (b->irs_size == 0) ? 4 : b->irs_size * 2;
+		BatchIR *tmp = realloc(b->irs, sizeof(BatchIR) * size);
+		if (tmp == NULL) {
+			printf("realloc failed while adding an impulse response!\n");
+			return -1;
+		}
+		b->irs = tmp;
+		b->irs_size = size;
+	}
+
+	WaveData wave = read_wav(path, FALSE);
+	if (wave.length == -1)
+		return -1;
+
+	// The prototype is routed one-to-one; workers re-route their clones to
+	// suit each input:
+	ChannelRouting r;
+	BatchIR *ir = &b->irs[b->num_irs];
+	ir->channels = wave.channels;
+	ir->h_len = wave.length;
+	ir->h = deinterleave(wave);
+	ir->path = strdup(path);
+	ir->proto = NULL;
+	free(wave.sampleData);
+	if (ir->h != NULL && channel_routing(ir->channels, ir->channels, &r) == TRUE)
+		ir->proto = ola_create(ir->h, ir->h_len, &r);
+	b->num_irs++;
+	if (ir->proto == NULL || ir->path == NULL) {
+		printf("Failed to prepare impulse response %s.\n", path);
+		return -1;
+	}
+	return b->num_irs - 1;
+}
+
+/**
+ * Add a job convolving input with impulse response ir into output.
+ * Returns FALSE on failure.
+ */
+int batch_add(Batch *b, char *input, char *output, int ir) {
+	if (b->num_jobs == b->jobs_size) {
+		int size = (b->jobs_size == 0) ? 64 : b->jobs_size * 2;
+		BatchJob *tmp = realloc(b->jobs, sizeof(BatchJob) * size);
+		if (tmp == NULL) {
+			printf("realloc failed while adding a job!\n");
+			return FALSE;
+		}
+		b->jobs = tmp;
+		b->jobs_size = size;
+	}
+	BatchJob *job = &b->jobs[b->num_jobs++];
+	job->input = strdup(input);
+	job->output = strdup(output);
+	job->ir = ir;
+	job->frames = -1;
+	job->peak = 0.0;
+	return job->input != NULL && job->output != NULL;
+}
+
+/**
+ * Add a job per line of a manifest. Lines without an irFile use irFile,
+ * which may be NULL if every line names one. Returns FALSE on failure.
+ */
+int batch_read_manifest(Batch *b, char *manifest, char *irFile) {
+	char line[4096];
+	int line_num = 0;
+	FILE *fp = fopen(manifest, "r");
+	if (fp == NULL) {
+		printf("Failed to open the manifest %s.\n", manifest);
+		return FALSE;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line_num++;
+		char *input = strtok(line, " \t\r\n");
+		if (input == NULL || input[0] == '#')
+			continue;
+		char *output = strtok(NULL, " \t\r\n");
+		char *ir_path = strtok(NULL, " \t\r\n");
+		if (ir_path == NULL)
+			ir_path = irFile;
+		if (output == NULL || ir_path == NULL) {
+			printf("%s:%d: expected \"inputFile outputFile [irFile]\".\n",
+				   manifest, line_num);
+			fclose(fp);
+			return FALSE;
+		}
+
+		int ir = batch_ir(b, ir_path);
+		if (ir == -1 || batch_add(b, input, output, ir) == FALSE) {
+			fclose(fp);
+			return FALSE;
+		}
+	}
+	fclose(fp);
+	return TRUE;
+}
+
+/**
+ * Order jobs by input path.
+ */
+int batch_job_cmp(const void *a, const void *b) {
+	return strcmp(((BatchJob *)a)->input, ((BatchJob *)b)->input);
+}
+
+/**
+ * Add a job for every .wav file in inputDir, writing a file of the same
+ * name to outputDir. Returns FALSE on failure.
+ */
+int batch_read_dir(Batch *b, char *inputDir, char *irFile, char *outputDir) {
+	char input[2048], output[2048];
+	struct dirent *entry;
+	DIR *dir = opendir(inputDir);
+	if (dir == NULL) {
+		printf("Failed to open the directory %s.\n", inputDir);
+		return FALSE;
+	}
+	int ir = batch_ir(b, irFile);
+	if (ir == -1) {
+		closedir(dir);
+		return FALSE;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		if (entry->d_name[0] == '.' || len < 4 ||
+			strcasecmp(entry->d_name + len - 4, ".wav") != 0)
+			continue;
+		snprintf(input, sizeof(input), "%s/%s", inputDir, entry->d_name);
+		snprintf(output, sizeof(output), "%s/%s", outputDir, entry->d_name);
+		if (batch_add(b, input, output, ir) == FALSE) {
+			closedir(dir);
+			return FALSE;
+		}
+	}
+	closedir(dir);
+
+	// Directory order is arbitrary; process & report in name order:
+	qsort(b->jobs, b->num_jobs, sizeof(BatchJob), batch_job_cmp);
+	return TRUE;
+}
+
+/**
+ * Run one job, re-routing (or creating) the worker's clone of its impulse
+ * response's convolver when the input's channel count changes, with its
+ * block buffers carved out of the worker's arena.
+ */
+void batch_run_job(Batch *b, BatchJob *job, OLAConvolver **ocs, Arena *arena) {
+	ChannelRouting r;
+	BatchIR *ir = &b->irs[job->ir];
+
+	WaveReader *in_wr = open_wav(job->input, FALSE);
+	if (in_wr == NULL)
+		return;
+	if (channel_routing(in_wr->info.channels, ir->channels, &r) == FALSE) {
+		close_wav(in_wr);
+		return;
+	}
+
+	OLAConvolver *oc = ocs[job->ir];
+	if (oc == NULL || oc->routing.in_channels != r.in_channels) {
+		ola_destroy(oc);
+		oc = ocs[job->ir] = ola_clone(ir->proto, &r);
+	}
+	if (oc != NULL)
+		job->frames = stream_file(oc, arena, peak_bound(ir->h, ir->h_len, &r), in_wr,
+								  job->output, b->normalize, &job->peak);
+	close_wav(in_wr);
+}
+
+/**
+ * Batch worker thread: run jobs until there are none left. Each worker
+ * keeps one clone per impulse response, and one scratch arena that every
+ * job after the first reuses without allocating.
+ */
+void * batch_worker(void *arg) {
+	Batch *b = (Batch *)arg;
+	Arena arena = {0};
+	OLAConvolver **ocs = (OLAConvolver **)calloc(b->num_irs, sizeof(OLAConvolver *));
+	if (ocs == NULL)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		int j = b->next_job++;
+		pthread_mutex_unlock(&b->lock);
+		if (j >= b->num_jobs)
+			break;
+		batch_run_job(b, &b->jobs[j], ocs, &arena);
+	}
+
+	for (int k = 0; k < b->num_irs; k++)
+		ola_destroy(ocs[k]);
+	free(ocs);
+	arena_destroy(&arena);
+	return NULL;
+}
+
+/**
+ * Convolve every job listed in source, a manifest file or a directory of
+ * .wav files, on a pool of threads workers. irFile is the default impulse
+ * response (required for a directory), and outputDir receives a
+ * directory's outputs. normalize applies to every output, as in
+ * convolve_stream(). Returns the number of jobs that failed, or -1 if the
+ * batch couldn't be set up.
+ */
+int convolve_batch(char *source, char *irFile, char *outputDir,
+				   int normalize, int threads, int verbose) {
+	Batch b;
+	struct stat st;
+	memset(&b, 0, sizeof(Batch));
+	b.normalize = normalize;
+
+	int ok;
+	if (stat(source, &st) == 0 && S_ISDIR(st.st_mode))
+		ok = (irFile != NULL && outputDir != NULL) &&
+			 batch_read_dir(&b, source, irFile, outputDir);
+	else
+		ok = batch_read_manifest(&b, source, irFile);
+	if (ok == FALSE) {
+		batch_destroy(&b);
+		return -1;
+	}
+	if (verbose == TRUE)
+		printf("Convolving %d file(s) with %d impulse response(s) on %d thread(s) ...\n",
+			   b.num_jobs, b.num_irs, threads);
+
+	// Start the pool; the main thread works too:
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_t *tids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+	int t, started = 0;
+	for (t = 1; tids != NULL && t < threads && t < b.num_jobs; t++)
+		if (pthread_create(&tids[started], NULL, batch_worker, &b) == 0)
+			started++;
+	batch_worker(&b);
+	for (t = 0; t < started; t++)
+		pthread_join(tids[t], NULL);
+	free(tids);
+	pthread_mutex_destroy(&b.lock);
+
+	// Report in job order:
+	int failed = 0;
+	for (int j = 0; j < b.num_jobs; j++) {
+		BatchJob *job = &b.jobs[j];
+		if (job->frames < 0) {
+			failed++;
+			printf("%s: FAILED\n", job->input);
+		}
+		else if (verbose == TRUE)
+			printf("%s -> %s: %lld frames, peak %f\n", job->input, job->output,
+				   (long long)job->frames, job->peak);
+	}
+	batch_destroy(&b);
+	return failed;
+}
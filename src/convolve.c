@@ -1,50 +1,262 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <unistd.h>
 #include "convolve.h"
 
+#define USAGE "Usage: convolve [-e direct|ola|upols|nupols|auto] [-b blockLen] " \
+			  "[-t threads] [-p double|float]\n" \
+			  "                [-s [-n two|bound|none]] [-c cacheDir] [-w wisdomFile]\n" \
+			  "                [-f pcm16|pcm24|pcm32|float] [-d]\n" \
+			  "                [inputFile] [irFile] [outputFile]\n" \
+			  "       convolve -m manifest [-t threads] [-n mode] [-c cacheDir] " \
+			  "[-f format] [-d] [irFile]\n" \
+			  "       convolve -m inputDir [-t threads] [-n mode] [-c cacheDir] " \
+			  "[-f format] [-d]\n" \
+			  "                irFile outputDir\n"
+
+/**
+ * Map an engine name given on the command line to its ENGINE_* constant.
+ * Returns -1 for unrecognized names.
+ */
+int parse_engine(char * name) {
+	for (int e = ENGINE_INPUT_SIDE; e <= ENGINE_AUTO; e++)
+		if (strcmp(name, engine_names[e]) == 0)
+			return e;
+	return -1;
+}
+
+/**
+ * Map a normalization mode given on the command line to its NORMALIZE_*
+ * constant. Returns -1 for unrecognized names.
+ */
+int parse_normalize(char * name) {
+	if (strcmp(name, "two") == 0)
+		return NORMALIZE_TWO_PASS;
+	if (strcmp(name, "bound") == 0)
+		return NORMALIZE_BOUND;
+	if (strcmp(name, "none") == 0)
+		return NORMALIZE_NONE;
+	return -1;
+}
+
+/**
+ * Map an output format given on the command line to its SF_FORMAT_*
+ * subtype. Returns -1 for unrecognized names.
+ */
+int parse_format(char * name) {
+	if (strcmp(name, "pcm16") == 0)
+		return SF_FORMAT_PCM_16;
+	if (strcmp(name, "pcm24") == 0)
+		return SF_FORMAT_PCM_24;
+	if (strcmp(name, "pcm32") == 0)
+		return SF_FORMAT_PCM_32;
+	if (strcmp(name, "float") == 0)
+		return SF_FORMAT_FLOAT;
+	return -1;
+}
+
 /**
  * Given filepaths to a dry audio recording, an impulse response file,
  * and an output location, convolve the dry audio with the impulse response
  * and write the convolved audio data to disk at the specified location.
  * 
  * Compile with:
- *     gcc convolve.c -lsndfile -o convolve
+ *     gcc convolve.c -lsndfile -lpthread -o convolve
  * 
  * Run with:
- *     ./convolve [inputFile] [irFile] [outputFile]
+ *     ./convolve [-e engine] [-b blockLen] [-t threads] [-p precision]
+ *                [-s [-n mode]] [-c cacheDir] [-w wisdomFile]
+ *                [-f format] [-d] [inputFile] [irFile] [outputFile]
+ *     ./convolve -m manifest [-t threads] [-n mode] [-c cacheDir]
+ *                [-f format] [-d] [irFile]
+ *     ./convolve -m inputDir [-t threads] [-n mode] [-c cacheDir]
+ *                [-f format] [-d] irFile outputDir
+ * 
+ * Engines:
+ *     direct - time domain convolution, vectorized; the fastest for
+ *              impulse responses of up to a few hundred samples
+ *     ola    - single-partition overlap-add FFT convolution (default)
+ *     upols  - uniformly-partitioned overlap-save FFT convolution with
+ *              partitions of blockLen samples (a power of 2, default 2048)
+ *     nupols - non-uniformly partitioned, low-latency convolution whose
+ *              smallest partition (and latency) is blockLen samples
+ *              (a power of 2, default 64)
+ *     auto   - time direct, ola & upols (at several partition lengths) on
+ *              the start of the input, and use the fastest (see planner.c)
+ * 
+ * Multichannel files are supported: a mono impulse response is applied to
+ * every input channel, a mono input feeds every impulse response channel,
+ * matching channel counts are paired up, and a stereo input with a
+ * 4-channel (LL, LR, RL, RR) impulse response is convolved in true stereo.
+ * 
+ * With -t, the ola engine spreads its segments, and the direct engine its
+ * output samples, over that many threads (0 for one per CPU); the output
+ * is identical to the single-threaded run.
+ * 
+ * With -p float, the ola engine runs its FFTs, spectrum multiplies &
+ * overlap-add in single precision, which is faster & well below 16-bit
+ * quantization noise (it is single-threaded, and doesn't apply to -s or -m).
+ * 
+ * With -s, the input is streamed through the ola engine one segment at a
+ * time, so memory use is bounded by the impulse response rather than the
+ * input. -n then picks how the output is normalized:
+ *     two   - spool the output to a temporary file, then rescale it to
+ *             its peak in a second pass (default)
+ *     bound - single pass, scaled by an upper bound on the peak computed
+ *             from the impulse response; never clips, but may be quieter
+ *     none  - single pass, unnormalized 32-bit float output
+ * 
+ * With -m, many files are streamed in one process, against impulse
+ * responses that are read & transformed only once. The manifest lists one
+ * "inputFile outputFile [irFile]" job per line, irFile defaulting to the
+ * one on the command line; given a directory instead, every .wav file in
+ * it is convolved into a file of the same name in outputDir. -t then sets
+ * how many files are convolved at once.
+ * 
+ * With -c, impulse response spectra are cached in cacheDir, keyed by the
+ * impulse response's contents and the FFT & partition sizes, so later runs
+ * with the same impulse response & engine settings skip its transform.
+ * 
+ * With -w, -e auto records the engine it picks in wisdomFile, keyed by the
+ * input & impulse response sizes, channels, threads, precision & SIMD
+ * level, and later runs with the same kind of workload use it untimed.
+ * -s & -m always use the ola engine, so auto has nothing to pick there.
+ * 
+ * With -f, normalized output is written as 16-bit (pcm16, the default),
+ * 24-bit (pcm24) or 32-bit (pcm32) PCM, or as 32-bit float, at the input's
+ * sample rate; with -d, PCM output is TPDF-dithered (see encode.c).
+ * 
+ * 16, 24 & 32-bit PCM and 32-bit float .wav files, including RF64 ones
+ * over 4 GB, are memory-mapped & decoded a block at a time (see
+ * wave_map.c); other formats are read through libsndfile. Inputs too long
+ * to hold in memory as doubles can still be convolved with -s.
+ * 
+ * The FFT kernels use the widest of SSE2, AVX2/FMA & AVX-512 the CPU
+ * supports. Set CONVOLVE_SIMD=scalar|sse2|avx2|avx512 to cap the choice.
+ * 
+ * Compiled with -DCONVOLVE_PROFILE, convolve also reports how long each
+ * stage of the pipeline took (see profile.c), and writes the same figures
+ * as JSON to $CONVOLVE_PROFILE_JSON if it is set.
  * 
  */
 int main(int argc, char **argv) {
 	// Start timer:
 	before = clock();
+	PROFILE_START();
+	
+	// Extract command line options:
+	int opt, block_len = 0, stream = FALSE, normalize = NORMALIZE_TWO_PASS;
+	char * manifest = NULL;
+	while ((opt = getopt(argc, argv, "e:b:t:p:sn:c:m:w:f:d")) != -1) {
+		switch (opt) {
+			case 'e':
+				engine = parse_engine(optarg);
+				break;
+			case 'b':
+				block_len = atoi(optarg);
+				break;
+			case 't':
+				num_threads = atoi(optarg);
+				if (num_threads == 0)
+					num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+				break;
+			case 'p':
+				if (strcmp(optarg, "float") == 0)
+					precision = PRECISION_FLOAT;
+				else if (strcmp(optarg, "double") != 0)
+					precision = -1;
+				break;
+			case 's':
+				stream = TRUE;
+				break;
+			case 'n':
+				normalize = parse_normalize(optarg);
+				break;
+			case 'c':
+				spectrum_cache_dir = optarg;
+				break;
+			case 'm':
+				manifest = optarg;
+				break;
+			case 'w':
+				wisdom_file = optarg;
+				break;
+			case 'f':
+				output_format = parse_format(optarg);
+				break;
+			case 'd':
+				output_dither = TRUE;
+				break;
+			default:
+				printf(USAGE);
+				return -1;
+		}
+	}
+	
+	// Batch mode streams every file, so it only supports the ola engine:
+	if (manifest != NULL) {
+		if (argc - optind > 2 ||
+			(engine != ENGINE_OVERLAP_ADD && engine != ENGINE_AUTO) ||
+			num_threads < 1 || normalize == -1 || output_format == -1) {
+			printf(USAGE);
+			return -1;
+		}
+		char * irFile = (argc - optind > 0) ? argv[optind] : NULL;
+		char * outputDir = (argc - optind > 1) ? argv[optind + 1] : NULL;
+		int failed = convolve_batch(manifest, irFile, outputDir, normalize,
+									num_threads, 1);
+		PROFILE_FINISH();
+		return (failed == 0) ? 0 : -1;
+	}
 	
 	// Ensure proper usage:
-	if (argc < 3) {
-		printf("Usage: convolve [inputFile] [irFile] [outputFile]");
+	if (argc - optind < 3 || engine == -1 || block_len < 0 || num_threads < 1 ||
+		normalize == -1 || precision == -1 || output_format == -1 ||
+		(block_len & (block_len - 1)) != 0 ||
+		(engine == ENGINE_NONUNIFORM_PARTITIONED && block_len > NUPOLS_MAX_BLOCK_LEN) ||
+		(stream == TRUE && engine != ENGINE_OVERLAP_ADD && engine != ENGINE_AUTO)) {
+		printf(USAGE);
 		return -1;
 	}
+	if (block_len != 0) {
+		partition_len = block_len;
+		nupols_block_len = block_len;
+	}
 	
 	// Extract command line args:
-	char * inputFile = argv[1];
-	char * irFile = argv[2];
-	char * outputFile = argv[3];
-	
-	// Extract .wav data from input and impulse response files:
-	initialize(inputFile, irFile, 1);
+	char * inputFile = argv[optind];
+	char * irFile = argv[optind + 1];
+	char * outputFile = argv[optind + 2];
 	
-	// Perform convolution and write convolved data to disk:
-	convolve(outputFile, 1);
+	if (stream == TRUE) {
+		// Convolve block by block, straight from disk to disk:
+		convolve_stream(inputFile, irFile, outputFile, normalize, 1);
+	}
+	else {
+		// Extract .wav data from input and impulse response files:
+		initialize(inputFile, irFile, 1);
+		
+		// Pick the engine, if left to the planner:
+		if (engine == ENGINE_AUTO)
+			plan_engine(1);
+		
+		// Perform convolution and write convolved data to disk:
+		convolve(outputFile, 1);
+	}
 	
 	// Stop timer and report:
 	elapsed = clock() - before;
 	float seconds = elapsed / CLOCKS_PER_SEC;
 	int minutes = seconds / 60;
     printf("\nElapsed [mm:ss]: %d:%.3f\n", minutes, seconds - (minutes * 60));
+	PROFILE_FINISH();
     
 	// Clean up and exit:
 	free(X.sampleData);
 	free(H.sampleData);
 	free(Y);
+	arena_destroy(&scratch);
 	return 0;
 }
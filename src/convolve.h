@@ -1,293 +1,879 @@
 #include "float.h"
+#include <string.h>
+#include <pthread.h>
+
+// Convolution engines selectable via convolve -e (defined ahead of the
+// includes, as planner.c checks wisdom against them):
+#define ENGINE_INPUT_SIDE 0
+#define ENGINE_OVERLAP_ADD 1
+#define ENGINE_UNIFORM_PARTITIONED 2
+#define ENGINE_NONUNIFORM_PARTITIONED 3
+#define ENGINE_AUTO 4	// Pick one of the above with plan_engine()
+
 #include "wave_utils.c"
-#include "fft.c"
+#include "libconvolve.c"
+#include "encode.c"
+#include "normalize.c"
+#include "stream.c"
+#include "batch.c"
+#include "planner.c"
 
 #define TRUE 1
 #define FALSE 0
 
+// Engine names, as given to convolve -e:
+const char *engine_names[] = {"direct", "ola", "upols", "nupols", "auto"};
+
+// Sample precision of the overlap-add engine, selectable via convolve -p:
+#define PRECISION_DOUBLE 0
+#define PRECISION_FLOAT 1
+
+// Segments convolved by each thread between merges in the parallel
+// overlap-add engine:
+#define OLA_BATCH_PER_THREAD 8
+
+// Scalar spectrum multiply from hand tuning #5, superseded by the
+// spectrum_mul kernels in simd.c & kept as a benchmark baseline:
 #define FREQUENCY_CONVOLVE(rex,refr,imx,imfr,j)\
 		temp=(rex[j]*refr[j])-(imx[j]*imfr[j]);\
 		imx[j]=(rex[j]*imfr[j])+(imx[j]*refr[j]);\
 		rex[j]=temp
 
 int N, M, P, i;
+int engine = ENGINE_OVERLAP_ADD, partition_len = DEFAULT_PARTITION_LEN;
+int nupols_block_len = DEFAULT_NUPOLS_BLOCK_LEN;
+int num_threads = 1, precision = PRECISION_DOUBLE;
 double elapsed, max = DBL_MIN;
 double *Y;
 clock_t before;
 WaveData X, H;
 
+// Scratch arrays of the engines below, kept from one convolution to the
+// next (see arena.c):
+Arena scratch;
+
 /**
  * Extract sample data from dry recording and impulse response audio files:
  */
 void initialize(char * inputFile, char * irFile, int verbose) {
 	if (verbose == TRUE)
 		printf("\nReading dry sound and impulse response files ...\n\n");
+	PROFILE_BEGIN(t);
 	X = read_wav(inputFile, verbose);	
 	H = read_wav(irFile, verbose);
+	PROFILE_END(PROFILE_READ, t, sizeof(double) *
+		((long long)X.length * X.channels + (long long)H.length * H.channels));
 	if (verbose == TRUE) printf("Done!\n\n");
 }
 
 /**
- * Input-side convolution algorithm.
+ * Per-thread state for the direct-form engine: each worker computes the
+ * outputs [first, last) and their peak.
+ */
+typedef struct DirectWorker {
+	pthread_t thread;
+	DirectKernel kernel;
+	double *xp, *hr;		// Shared, read-only padded input & reversed IR
+	int first, last;
+	double peak;
+} DirectWorker;
+
+/**
+ * Worker thread body for convolve_input_side().
+ */
+void * direct_worker(void *arg) {
+	DirectWorker *w = (DirectWorker *)arg;
+	w->peak = direct_range(w->kernel, Y, w->xp, w->hr, M, w->first, w->last);
+	return NULL;
+}
+
+/**
+ * Input-side convolution algorithm. Originally a scatter of each input
+ * sample into the output; it now gathers each output sample with the
+ * vectorized, cache-blocked kernels in direct.c, spread over num_threads
+ * threads by output range. Each output is summed in the same order
+ * whatever the thread count, so the result doesn't depend on it.
  */ 
 void convolve_input_side() {
-	// Zero the output array:
-	for (i = 0; i < P; i++)
-		Y[i] = 0.0;
+	size_t mark = arena_mark(&scratch);
+	double *xp = (double *)arena_calloc(&scratch, N + 2 * (M - 1), sizeof(double));
+	double *hr = (double *)arena_alloc(&scratch, sizeof(double) * M);
+	DirectWorker *workers = (DirectWorker *)arena_calloc(&scratch, num_threads,
+														 sizeof(DirectWorker));
+	if (xp == NULL || hr == NULL || workers == NULL) {
+		printf("malloc failed while initializing direct convolution!\n");
+		arena_release(&scratch, mark);
+		return;
+	}
 	
-	// Perform the convolution:
-	max = DBL_MIN;
-	for (i = 0; i < N; i++) {
-		for (int j = 0; j < M; j++) {
-			Y[i+j] += X.sampleData[i] * H.sampleData[j];
-			
-			// Determine the convolved audio's maximum absolute value:
-			double abs_val = fabs(Y[i+j]);
-			if (abs_val > max)
-				max = abs_val;
-		}
+	// Pad the input with M-1 zeros either side, and reverse the IR:
+	memcpy(xp + M - 1, X.sampleData, sizeof(double) * N);
+	for (int j = 0; j < M; j++)
+		hr[j] = H.sampleData[M - 1 - j];
+	
+	// Perform the convolution, with the peak found block by block:
+	int t, per_thread = (P + num_threads - 1) / num_threads;
+	for (t = 0; t < num_threads; t++) {
+		workers[t].kernel = direct_kernel(simd_level());
+		workers[t].xp = xp;
+		workers[t].hr = hr;
+		workers[t].first = (t * per_thread < P) ? t * per_thread : P;
+		workers[t].last = (workers[t].first + per_thread < P) ?
+						  workers[t].first + per_thread : P;
+	}
+	if (num_threads == 1)
+		direct_worker(&workers[0]);
+	else {
+		for (t = 0; t < num_threads; t++)
+			pthread_create(&workers[t].thread, NULL, direct_worker, &workers[t]);
+		for (t = 0; t < num_threads; t++)
+			pthread_join(workers[t].thread, NULL);
 	}
+	
+	// Determine the convolved audio's maximum absolute value:
+	max = DBL_MIN;
+	for (t = 0; t < num_threads; t++)
+		if (workers[t].peak > max)
+			max = workers[t].peak;
+	arena_release(&scratch, mark);
 }
 
 /**
- * Load the next segment of the input file's sample data
- * into XX, zero-padding all entries to the right of the
- * filter kernel, then shift the sliding window over.
+ * Used to determine the convolved audio's maximum absolute value.
+ * Method added for hand tuning #3; the engines now find each block's peak
+ * with the vectorized peak kernels (see simd.c) and merge it in here.
  */
-int slide_window(int xx_len, int segment_len, int window_idx, double *XX) {
-	// For-loop unrolled once for hand tuning #2
-	for (int i = 0; i < xx_len-1; i += 2) {
-		int in_range = (i + 1 < segment_len) ? TRUE : FALSE;
-		if (in_range) {
-			XX[i]   = X.sampleData[window_idx + i];
-			XX[i+1] = X.sampleData[window_idx + i + 1];
-		}
-		else {
-			XX[i]   = 0.0;
-			XX[i+1] = 0.0;
-		}	
-	}
-	if (i == xx_len-1)
-		XX[i] = 0.0;
-		
-	window_idx += segment_len;
-	return window_idx;
+void update_max(double val) {
+	double abs_val = fabs(val);
+	if (abs_val > max)
+		max = abs_val;
 }
 
 /**
- * Perform pre-processing for the IFFT: i.e., combine real and
- * imaginary components of frequency response into XX.
+ * Transform segment seg of the input sample data (segment_len samples, or
+ * as many as remain of the N, zero-padded to the plan's length), multiply
+ * it by the frequency response and inverse transform it into XX. XX then
+ * holds the segment's fft_len convolved samples, before any overlap is
+ * added.
  */
-void pre_process_fft(int spectra_len, double *XX, double *REX, double *IMX) {
-	// idx pre-calculated to minimize work inside loop for hand tuning #1
-	int idx;
-	for (int i = 0; i < spectra_len; i++) {
-		idx = i * 2;
-		XX[idx]   = REX[i];
-		XX[idx+1] = IMX[i];
-	}
+void ola_convolve_segment(FFTPlan *plan, int seg, int segment_len,
+						  double *REFR, double *IMFR,
+						  double *REX, double *IMX, double *XX) {
+	int spectra_len = plan->nn + 1;
+	int len = N - seg * segment_len;
+	if (len > segment_len)
+		len = segment_len;
+	
+	rfft_forward(plan, X.sampleData + seg * segment_len, len, REX, IMX);
+	PROFILE_BEGIN(t);
+	plan->spectrum_mul(REX, IMX, REX, IMX, REFR, IMFR, spectra_len);
+	PROFILE_END(PROFILE_SPECTRUM, t, sizeof(double) * 6 * spectra_len);
+	rfft_inverse(plan, REX, IMX, XX);
 }
 
 /**
- * Extract real & imaginary components from frequency response into REX & IMX.
+ * Per-thread state for the parallel overlap-add engine. Each worker owns
+ * an FFT plan & scratch arrays, and convolves the segments [first, last)
+ * of the current batch. It writes the leading segment_len samples of each
+ * segment straight to Y and the remaining olap_len samples to TAILS, at
+ * olap_len * (seg - batch_first).
+ */
+typedef struct OLAWorker {
+	pthread_t thread;
+	FFTPlan *plan;
+	double *XX, *REX, *IMX;
+	double *REFR, *IMFR;	// Shared, read-only frequency response
+	double *TAILS;			// Shared; each worker writes only its segments
+	int first, last, batch_first;
+	int segment_len, olap_len;
+} OLAWorker;
+
+/**
+ * Worker thread body for convolve_overlap_add_parallel().
  */
-void post_process_fft(int fft_len, double *XX, double *REX, double *IMX) {
-	int idx;
-	for (int i = 0; i < fft_len-1; i += 2) {
-		// idx pre-calculated to minimize work inside loop for hand tuning #1
-		idx = i / 2;
-		REX[idx] = XX[i];
-		IMX[idx] = XX[i+1];
-
-		// Zero-out XX as it is copied into REX & IMX:
-		XX[i]    = 0.0;
-		XX[i+1]  = 0.0;
+void * ola_worker(void *arg) {
+	OLAWorker *w = (OLAWorker *)arg;
+	int S = w->segment_len;
+	
+	for (int seg = w->first; seg < w->last; seg++) {
+		ola_convolve_segment(w->plan, seg, S, w->REFR, w->IMFR,
+							 w->REX, w->IMX, w->XX);
+		int len = (P - seg * S < S) ? P - seg * S : S;
+		memcpy(Y + seg * S, w->XX, sizeof(double) * len);
+		memcpy(w->TAILS + (seg - w->batch_first) * w->olap_len, w->XX + S,
+			   sizeof(double) * w->olap_len);
 	}
+	return NULL;
 }
 
-
 /**
- * Extract real & imaginary components from frequency response into
- * REX, IMX, REFR, and IMFR. Called once, prior to the main body of
- * the convolution algorithm.
+ * Release the FFT plans of convolve_overlap_add_parallel()'s workers; their
+ * arrays belong to the scratch arena.
  */
-void post_process_fft_one_off(int fft_len, double *XX,
-							  double *REX, double *IMX,
-							  double *REFR, double *IMFR) {
-	int idx;
-	for (int i = 0; i < fft_len-1; i += 2) {
-		idx = i / 2;
-		REX[idx] = XX[i];
-		IMX[idx] = XX[i+1];
-	
-		// Copy values to REFR & IMFR (hand tuning #4):
-		REFR[idx] = REX[idx];
-		IMFR[idx] = IMX[idx];
-		
-		// Zero-out XX as it is copied into REX & IMX:
-		XX[i]    = 0.0;
-		XX[i+1]  = 0.0;
-	}
+void ola_workers_destroy(OLAWorker *workers) {
+	for (int t = 0; workers != NULL && t < num_threads; t++)
+		fft_plan_destroy(workers[t].plan);
 }
 
+/**
+ * Return the bytes of scratch convolve_overlap_add_fft() carves out of the
+ * arena for an FFT of fft_len samples & a filter kernel of olap_len + 1,
+ * including the worker arrays & tails of the parallel engine.
+ */
+size_t ola_scratch_bytes(int fft_len, int olap_len) {
+	size_t spectrum = arena_round(sizeof(double) * (fft_len / 2 + 1));
+	size_t bytes = arena_round(sizeof(double) * fft_len) + 4 * spectrum +
+				   arena_round(sizeof(double) * olap_len);
+	if (num_threads > 1)
+		bytes += arena_round(sizeof(OLAWorker) * num_threads) +
+				 num_threads * (arena_round(sizeof(double) * fft_len) + 2 * spectrum) +
+				 arena_round(sizeof(double) * (num_threads * OLA_BATCH_PER_THREAD *
+											   olap_len + 1)) +
+				 arena_round(sizeof(double) * (olap_len + 1));
+	return bytes;
+}
 
 /**
- * Used to determine the convolved audio's maximum absolute value.
- * Method added for hand tuning #3.
+ * Segment-parallel body of convolve_overlap_add_fft(). Segments are
+ * convolved num_threads at a time, in batches of OLA_BATCH_PER_THREAD
+ * segments per thread. This bounds the memory held for their overlapping
+ * tails. After each batch, the main thread adds the overlaps into Y in
+ * segment order. It performs exactly the additions of the serial loop, in
+ * the same order, so the output is bit-identical to it.
  */
-void update_max(double val) {
-	double abs_val = fabs(val);
-	if (abs_val > max)
-		max = abs_val;
+void convolve_overlap_add_parallel(int fft_len, int segment_len, int num_segments,
+								   double *REFR, double *IMFR) {
+	int S = segment_len, olap_len = fft_len - segment_len;
+	int spectra_len = fft_len / 2 + 1;
+	int batch_len = num_threads * OLA_BATCH_PER_THREAD;
+	int t, j, seg;
+	
+	OLAWorker *workers = (OLAWorker *)arena_calloc(&scratch, num_threads, sizeof(OLAWorker));
+	double *TAILS = (double *)arena_alloc(&scratch, sizeof(double) * (batch_len * olap_len + 1));
+	double *CARRY = (double *)arena_calloc(&scratch, olap_len + 1, sizeof(double));
+	int ok = (workers != NULL && TAILS != NULL && CARRY != NULL);
+	for (t = 0; ok && t < num_threads; t++) {
+		workers[t].plan = fft_plan_create(fft_len);
+		workers[t].XX = (double *)arena_alloc(&scratch, sizeof(double) * fft_len);
+		workers[t].REX = (double *)arena_alloc(&scratch, sizeof(double) * spectra_len);
+		workers[t].IMX = (double *)arena_alloc(&scratch, sizeof(double) * spectra_len);
+		workers[t].REFR = REFR;
+		workers[t].IMFR = IMFR;
+		workers[t].TAILS = TAILS;
+		workers[t].segment_len = S;
+		workers[t].olap_len = olap_len;
+		ok = (workers[t].plan != NULL && workers[t].XX != NULL &&
+			  workers[t].REX != NULL && workers[t].IMX != NULL);
+	}
+	if (!ok) {
+		printf("malloc failed while initializing worker threads!\n");
+		ola_workers_destroy(workers);
+		return;
+	}
+	
+	// OLAP points at the overlap carried into the next segment: initially
+	// zeros, and afterwards the (merged) tail of the previous segment:
+	double *OLAP = CARRY;
+	for (int batch_first = 0; batch_first < num_segments; batch_first += batch_len) {
+		int batch_last = (batch_first + batch_len < num_segments) ?
+						 batch_first + batch_len : num_segments;
+		int per_thread = (batch_last - batch_first + num_threads - 1) / num_threads;
+		
+		// Convolve the batch's segments in parallel:
+		for (t = 0; t < num_threads; t++) {
+			workers[t].batch_first = batch_first;
+			workers[t].first = batch_first + t * per_thread;
+			workers[t].last = workers[t].first + per_thread;
+			if (workers[t].first > batch_last)
+				workers[t].first = batch_last;
+			if (workers[t].last > batch_last)
+				workers[t].last = batch_last;
+			pthread_create(&workers[t].thread, NULL, ola_worker, &workers[t]);
+		}
+		for (t = 0; t < num_threads; t++)
+			pthread_join(workers[t].thread, NULL);
+		
+		// Add the overlaps in segment order, as the serial loop does:
+		for (seg = batch_first; seg < batch_last; seg++) {
+			double *head = Y + seg * S;
+			double *tail = TAILS + (seg - batch_first) * olap_len;
+			PROFILE_BEGIN(u);
+			for (j = 0; j < olap_len; j++) {
+				if (j < S)
+					head[j] += OLAP[j];
+				else
+					tail[j-S] += OLAP[j];
+			}
+			PROFILE_LAP(PROFILE_OVERLAP_ADD, u, sizeof(double) * 3 * olap_len);
+			int len = (P - seg * S < S) ? P - seg * S : S;
+			update_max(peak_abs(head, len, 0.0));
+			PROFILE_END(PROFILE_PEAK, u, sizeof(double) * len);
+			OLAP = tail;
+		}
+		
+		// The next batch reuses TAILS, so keep the carried overlap aside:
+		memcpy(CARRY, OLAP, sizeof(double) * olap_len);
+		OLAP = CARRY;
+	}
+	
+	// Add the samples remaining in OLAP that fall within P to the output
+	// file's data array (none if the last segment reached P):
+	PROFILE_BEGIN(u);
+	int len = (P > num_segments * S) ? P - num_segments * S : 0;
+	update_max(peak_copy(Y + num_segments * S, OLAP, len, 0.0));
+	PROFILE_END(PROFILE_PEAK, u, sizeof(double) * 2 * len);
+	
+	// Clean up:
+	ola_workers_destroy(workers);
 }
 
 /**
- * Overlap-add FFT convolution algorithm.
+ * Overlap-add FFT convolution algorithm. The final segment of input is
+ * zero-padded as it is transformed, so X & Y are used as they are, and
+ * exactly P = N + M - 1 samples are output.
  */
 void convolve_overlap_add_fft() {
 	
 	// Rename variables for clarity:
-	int num_points = X.length;
-	int filter_kernel_len = H.length;
+	int num_points = N;
+	int filter_kernel_len = M;
 	
-	// Get smallest power of 2 larger than filter_kernel_len:
-	int fft_len = 2;
-	while (fft_len < filter_kernel_len)
-		fft_len *= 2;
+	// Pick the cheapest FFT length for this input & filter kernel:
+	int fft_len = ola_fft_len(filter_kernel_len, num_points);
 	
 	// Determine segment length:
 	int segment_len = (fft_len + 1) - filter_kernel_len;
 	
-	// Ensure that input sample data array is an even multiple of segment_len:
-	if (num_points % segment_len != 0) {
-		double *tmp;
-		int new_len = ((num_points / segment_len) + 1) * segment_len;
-		int points_diff = new_len - num_points;
-		num_points += points_diff;
-		P += points_diff;
-		
-		// Increase size of input sample data array:
-		tmp = realloc(X.sampleData, sizeof(double) * num_points);
-		if (tmp == NULL) { 
-			printf("realloc failed while increasing X.sampleData!\n");
-			return;
-		} else
-			X.sampleData = tmp;
-		
-		// Zero out added entries:
-		for (i = num_points-points_diff; i < num_points; i++)
-			X.sampleData[i] = 0.0;
-		
-		// Increase size of output array to match:
-		tmp = realloc(Y, sizeof(double) * P);
-		if (tmp == NULL) { 
-			printf("realloc failed while increasing output array Y[]!\n");
-			return;
-		} else
-			Y = tmp;
-	}
-	
-	// Determine number of segments:
-	int num_segments = num_points / segment_len;
+	// Determine number of segments, the last of which may be partial:
+	int num_segments = (num_points + segment_len - 1) / segment_len;
 	
-	// Determine array sizes:
-	int xx_len = fft_len * 2;
-	int spectra_len = fft_len / 2;
+	// Determine array sizes (the input is real-valued, so XX holds fft_len
+	// real output samples and the spectra hold fft_len/2 + 1 bins):
+	int xx_len = fft_len;
+	int spectra_len = fft_len / 2 + 1;
 	int olap_len = filter_kernel_len - 1;
 	
-	// Initialize arrays:
-	double *XX = (double *)malloc(sizeof(double) * xx_len);
-	double *REX = (double *)malloc(sizeof(double) * spectra_len);
-	double *IMX = (double *)malloc(sizeof(double) * spectra_len);
-	double *REFR = (double *)malloc(sizeof(double) * spectra_len);
-	double *IMFR = (double *)malloc(sizeof(double) * spectra_len);
-	double *OLAP = (double *)malloc(sizeof(double) * olap_len);
+	// Carve the arrays out of the scratch arena, sized up front so that
+	// even the first convolution allocates a single block:
+	size_t mark = arena_mark(&scratch);
+	arena_reserve(&scratch, ola_scratch_bytes(fft_len, olap_len));
+	double *XX = (double *)arena_alloc(&scratch, sizeof(double) * xx_len);
+	double *REX = (double *)arena_alloc(&scratch, sizeof(double) * spectra_len);
+	double *IMX = (double *)arena_alloc(&scratch, sizeof(double) * spectra_len);
+	double *REFR, *IMFR;
+	uint64_t hash = (spectrum_cache_dir == NULL) ? 0 :
+					spectra_hash(0, H.sampleData, filter_kernel_len);
+	CachedSpectra *cached = spectra_load(hash, fft_len, 0, 1, spectra_len);
+	if (cached != NULL) {
+		REFR = cached->REFR;
+		IMFR = cached->IMFR;
+	}
+	else {
+		REFR = (double *)arena_alloc(&scratch, sizeof(double) * spectra_len);
+		IMFR = (double *)arena_alloc(&scratch, sizeof(double) * spectra_len);
+	}
+	double *OLAP = (double *)arena_calloc(&scratch, olap_len, sizeof(double));
+	
+	FFTPlan *plan = fft_plan_create(fft_len);
 	
 	// Ensure initialization worked:
 	if (XX == NULL || REX == NULL || IMX == NULL || 
-		REFR == NULL || IMFR == NULL || OLAP == NULL) {
+		REFR == NULL || IMFR == NULL || OLAP == NULL || plan == NULL) {
 		printf("malloc failed while initializing arrays!\n");
+		spectra_release(cached);
+		fft_plan_destroy(plan);
+		arena_release(&scratch, mark);
 		return;
 	}
 	
-	// Zero the overlapping sample array:
-	for (i = 0; i < olap_len; i++)
-		OLAP[i] = 0.0;
+	// Transform the filter kernel (impulse response), zero-padded to
+	// fft_len, straight into REFR & IMFR, unless it was cached. The
+	// 2/fft_len normalization required by the inverse real FFT is folded
+	// into the frequency response here so the segment loop never has to
+	// rescale its output:
+	if (cached == NULL) {
+		rfft_forward(plan, H.sampleData, filter_kernel_len, REFR, IMFR);
+		for (i = 0; i < spectra_len; i++) {
+			REFR[i] *= 2.0 / fft_len;
+			IMFR[i] *= 2.0 / fft_len;
+		}
+		spectra_store(hash, fft_len, 0, 1, spectra_len, REFR, IMFR);
+	}
 	
-	// Load the filter kernel (impulse response) into XX,
-	// zero-padding all entries to the right of the filter kernel.
-	for (i = 0; i < xx_len; i++)
-		XX[i] = (i < filter_kernel_len) ? H.sampleData[i] : 0.0;
+	// Process each of the segments, spreading them over a pool of worker
+	// threads if more than one was requested:
+	if (num_threads > 1) {
+		convolve_overlap_add_parallel(fft_len, segment_len, num_segments,
+									  REFR, IMFR);
+	}
+	else {
+		int j, output_idx = 0;
+		double peak = 0.0;
+		for (i = 0; i < num_segments; i++) {
+			// Convolve the next segment of input sample data into XX:
+			ola_convolve_segment(plan, i, segment_len, REFR, IMFR, REX, IMX, XX);
+			
+			// Add the last segment's overlap to this segment:
+			PROFILE_BEGIN(t);
+			for (j = 0; j < olap_len; j++)
+				XX[j] += OLAP[j];
+			
+			// Save the samples that will overlap the next segment:
+			for (j = segment_len; j < fft_len; j++)
+				OLAP[j-segment_len] = XX[j];
+			PROFILE_LAP(PROFILE_OVERLAP_ADD, t, sizeof(double) * 5 * olap_len);
+			
+			// Output the segment samples stored in XX[0]-XX[segment_len-1]
+			// that fall within P to the output file's data array, tracking
+			// their peak:
+			j = (P - output_idx < segment_len) ? P - output_idx : segment_len;
+			peak = peak_copy(Y + output_idx, XX, j, peak);
+			PROFILE_END(PROFILE_PEAK, t, sizeof(double) * 2 * j);
+			output_idx += j;
+		}
+		
+		// Add the samples remaining in OLAP that fall within P to the
+		// output file's data array:
+		PROFILE_BEGIN(t);
+		j = P - output_idx;
+		update_max(peak_copy(Y + output_idx, OLAP, j, peak));
+		PROFILE_END(PROFILE_PEAK, t, sizeof(double) * 2 * j);
+	}
 	
-	// Perform the FFT on XX, then split the result
-	// into the spectra arrays:
-	four1(XX-1, fft_len, 1);
+	// Clean up:
+	if (cached != NULL)
+		spectra_release(cached);
+	fft_plan_destroy(plan);
+	arena_release(&scratch, mark);
+}
+
+/**
+ * Single-precision overlap-add FFT convolution: convolve_overlap_add_fft()
+ * with the FFTs, spectrum multiplies & overlap-add in float (see
+ * fft_float.c), which doubles the SIMD lane width & halves the working set.
+ * Each segment of input is converted to float as it is transformed, and
+ * each block of output back to double as it is stored in Y[]. The final
+ * segment is zero-padded as it is transformed, so X is never padded.
+ */
+void convolve_overlap_add_float() {
+	int fft_len = ola_fft_len(M, N);
+	int segment_len = (fft_len + 1) - M;
+	int num_segments = (N + segment_len - 1) / segment_len;
+	int spectra_len = fft_len / 2 + 1;
+	int olap_len = M - 1;
 	
-	// Save the frequency response into REFR & IMFR during post-processing:
-	post_process_fft_one_off(fft_len, XX, REX, IMX, REFR, IMFR);
+	// Initialize arrays (SEG also holds H as it is converted):
+	size_t mark = arena_mark(&scratch);
+	float *SEG = (float *)arena_alloc(&scratch, sizeof(float) * (M > segment_len ? M : segment_len));
+	float *XX = (float *)arena_alloc(&scratch, sizeof(float) * fft_len);
+	float *REX = (float *)arena_alloc(&scratch, sizeof(float) * spectra_len);
+	float *IMX = (float *)arena_alloc(&scratch, sizeof(float) * spectra_len);
+	float *REFR = (float *)arena_alloc(&scratch, sizeof(float) * spectra_len);
+	float *IMFR = (float *)arena_alloc(&scratch, sizeof(float) * spectra_len);
+	float *OLAP = (float *)arena_calloc(&scratch, olap_len + 1, sizeof(float));
+	FFTPlanF *plan = fft_plan_create_f(fft_len);
+	if (SEG == NULL || XX == NULL || REX == NULL || IMX == NULL ||
+		REFR == NULL || IMFR == NULL || OLAP == NULL || plan == NULL) {
+		printf("malloc failed while initializing arrays!\n");
+		fft_plan_destroy_f(plan);
+		arena_release(&scratch, mark);
+		return;
+	}
 	
-	// Process each of the segments:
-	int j;
-	int window_idx = 0, output_idx = 0;
-	double temp;
+	// Transform the filter kernel, folding in the 2/fft_len normalization:
+	for (i = 0; i < M; i++)
+		SEG[i] = (float)H.sampleData[i];
+	rfft_forward_f(plan, SEG, M, REFR, IMFR);
+	for (i = 0; i < spectra_len; i++) {
+		REFR[i] *= 2.0f / fft_len;
+		IMFR[i] *= 2.0f / fft_len;
+	}
 	
-	for (i = 0; i < num_segments; i++) {
-		// Load next segment of input sample data into XX:
-		window_idx = slide_window(xx_len, segment_len, window_idx, XX);
-		
-		// Perform FFT on XX, then split the result
-		// into the spectra arrays:
-		four1(XX-1, fft_len, 1);
-		post_process_fft(fft_len, XX, REX, IMX);
+	int j, len, output_idx = 0;
+	double peak = 0.0;
+	for (int seg = 0; seg < num_segments; seg++) {
+		// Convolve the next segment of input into XX:
+		len = N - seg * segment_len;
+		if (len > segment_len)
+			len = segment_len;
+		for (j = 0; j < len; j++)
+			SEG[j] = (float)X.sampleData[seg * segment_len + j];
+		rfft_forward_f(plan, SEG, len, REX, IMX);
+		PROFILE_BEGIN(t);
+		plan->spectrum_mul(REX, IMX, REX, IMX, REFR, IMFR, spectra_len);
+		PROFILE_END(PROFILE_SPECTRUM, t, sizeof(float) * 6 * spectra_len);
+		rfft_inverse_f(plan, REX, IMX, XX);
 		
-		// For-loop unrolled twice for hand tuning #5
-		// Multiply the frequency spectrum by the frequency response:
-		for (j = 0; j < spectra_len-2; j += 3) {
-			FREQUENCY_CONVOLVE(REX, REFR, IMX, IMFR, j);
-			FREQUENCY_CONVOLVE(REX, REFR, IMX, IMFR, j+1);
-			FREQUENCY_CONVOLVE(REX, REFR, IMX, IMFR, j+2);
-		}
-		if (j == spectra_len - 2) {
-			FREQUENCY_CONVOLVE(REX, REFR, IMX, IMFR, j);
-			FREQUENCY_CONVOLVE(REX, REFR, IMX, IMFR, j+1);
-		}
-		else if (j == spectra_len - 1)
-			FREQUENCY_CONVOLVE(REX, REFR, IMX, IMFR, j);
-		
-		// Put REX & IMX into XX, the perform the IFFT on XX:
-		pre_process_fft(spectra_len, XX, REX, IMX);
-		four1(XX-1, fft_len, -1);
-		
-		// Add the last segment's overlap to this segment:
+		// Overlap-add, then output the segment's samples that are complete:
+		PROFILE_BEGIN(u);
 		for (j = 0; j < olap_len; j++)
 			XX[j] += OLAP[j];
-		
-		// Save the samples that will overlap the next segment:
 		for (j = segment_len; j < fft_len; j++)
 			OLAP[j-segment_len] = XX[j];
+		PROFILE_LAP(PROFILE_OVERLAP_ADD, u, sizeof(float) * 5 * olap_len);
+		len = (P - output_idx < segment_len) ? P - output_idx : segment_len;
+		peak = peak_copy_f(Y + output_idx, XX, len, peak);
+		PROFILE_END(PROFILE_PEAK, u, (sizeof(float) + sizeof(double)) * len);
+		output_idx += len;
+	}
+	
+	// Output whatever remains of the overlap:
+	PROFILE_BEGIN(t);
+	len = P - output_idx;
+	peak = peak_copy_f(Y + output_idx, OLAP, len, peak);
+	PROFILE_END(PROFILE_PEAK, t, (sizeof(float) + sizeof(double)) * len);
+	update_max(peak);
+	
+	// Clean up:
+	fft_plan_destroy_f(plan);
+	arena_release(&scratch, mark);
+}
+
+/**
+ * Uniformly-partitioned overlap-save convolution algorithm. The input is
+ * streamed through a PartitionedConvolver in blocks of partition_len
+ * samples, so the FFT size is bounded regardless of the IR's length.
+ */
+void convolve_uniform_partitioned() {
+	int block_len = partition_len;
+	PartitionedConvolver *pc = partitioned_create(H.sampleData, H.length, block_len);
+	size_t mark = arena_mark(&scratch);
+	double *BLOCK = (double *)arena_alloc(&scratch, sizeof(double) * block_len);
+	if (pc == NULL || BLOCK == NULL) {
+		printf("malloc failed while initializing arrays!\n");
+		partitioned_destroy(pc);
+		arena_release(&scratch, mark);
+		return;
+	}
+	
+	// Keep feeding blocks (zero-padded past the end of the input) until
+	// all P output samples have been produced:
+	int j, output_idx;
+	for (output_idx = 0; output_idx < P; output_idx += block_len) {
+		for (j = 0; j < block_len; j++)
+			BLOCK[j] = (output_idx + j < N) ? X.sampleData[output_idx + j] : 0.0;
 		
-		// Output the segment samples stored in XX[0]-XX[segment_len-1]
-		// to the output file's data array:
-		for (j = 0; j < segment_len; j++) {
-			update_max(XX[j]);
-			Y[output_idx+j] = XX[j];
-		}
-		output_idx += segment_len;	
+		partitioned_process(pc, BLOCK, BLOCK);
+		
+		PROFILE_BEGIN(t);
+		j = (P - output_idx < block_len) ? P - output_idx : block_len;
+		update_max(peak_copy(Y + output_idx, BLOCK, j, 0.0));
+		PROFILE_END(PROFILE_PEAK, t, sizeof(double) * 2 * j);
+	}
+	
+	// Clean up:
+	partitioned_destroy(pc);
+	arena_release(&scratch, mark);
+}
+
+/**
+ * Non-uniformly partitioned convolution algorithm. The input is pushed
+ * through a NonUniformConvolver in chunks, exactly as an audio callback
+ * would, and its block_len samples of latency are trimmed from the output.
+ */
+void convolve_nonuniform_partitioned() {
+	int chunk_len = 4096;
+	NonUniformConvolver *nc = nonuniform_create(H.sampleData, H.length, nupols_block_len);
+	size_t mark = arena_mark(&scratch);
+	double *CHUNK = (double *)arena_alloc(&scratch, sizeof(double) * chunk_len);
+	if (nc == NULL || CHUNK == NULL) {
+		printf("malloc failed while initializing arrays!\n");
+		nonuniform_destroy(nc);
+		arena_release(&scratch, mark);
+		return;
+	}
+	
+	int latency = nonuniform_latency(nc);
+	int j, len, input_idx, output_idx;
+	for (input_idx = 0; input_idx < P + latency; input_idx += chunk_len) {
+		for (j = 0; j < chunk_len; j++)
+			CHUNK[j] = (input_idx + j < N) ? X.sampleData[input_idx + j] : 0.0;
+		
+		nonuniform_process(nc, CHUNK, CHUNK, chunk_len);
+		
+		// Output the chunk's samples that fall within Y, chunk sample j
+		// being output sample input_idx + j - latency:
+		PROFILE_BEGIN(t);
+		j = (input_idx < latency) ? latency - input_idx : 0;
+		output_idx = input_idx + j - latency;
+		len = (P - output_idx < chunk_len - j) ? P - output_idx : chunk_len - j;
+		if (len < 0)
+			len = 0;
+		if (len > 0)
+			update_max(peak_copy(Y + output_idx, CHUNK + j, len, 0.0));
+		PROFILE_END(PROFILE_PEAK, t, sizeof(double) * 2 * len);
 	}
 	
-	// Add all samples remaining in OLAP to the output file's data array:
-	for (j = 0; j < olap_len; j++) {
-		update_max(OLAP[j]);
-		Y[output_idx+j] = OLAP[j];
+	// Clean up:
+	nonuniform_destroy(nc);
+	arena_release(&scratch, mark);
+}
+
+/**
+ * Run the selected engine on the mono X & H, writing P samples to Y.
+ */
+void run_engine() {
+	switch (engine) {
+		case ENGINE_INPUT_SIDE:
+			convolve_input_side();
+			break;
+		case ENGINE_UNIFORM_PARTITIONED:
+			convolve_uniform_partitioned();
+			break;
+		case ENGINE_NONUNIFORM_PARTITIONED:
+			convolve_nonuniform_partitioned();
+			break;
+		default:
+			if (precision == PRECISION_FLOAT)
+				convolve_overlap_add_float();
+			else
+				convolve_overlap_add_fft();
+	}
+}
+
+/**
+ * Multichannel overlap-add FFT convolution of the input channels x[] (N
+ * samples each) with the impulse response channels h[] (M samples each)
+ * into the output channels y[] (P samples each), following the routing r.
+ * The final segment is zero-padded as it is transformed, so the input
+ * never has to be padded to a multiple of the segment length.
+ */
+void convolve_overlap_add_routed(double **x, double **h, double **y,
+								 ChannelRouting *r) {
+	OLAConvolver *oc = ola_create(h, M, r);
+	if (oc == NULL)
+		return;
+	
+	double *in[MAX_CHANNELS], *out[MAX_CHANNELS];
+	int S = oc->segment_len, window_idx, c, len;
+	
+	for (window_idx = 0; window_idx < N; window_idx += S) {
+		for (c = 0; c < r->in_channels; c++)
+			in[c] = x[c] + window_idx;
+		for (c = 0; c < r->out_channels; c++)
+			out[c] = y[c] + window_idx;
+		
+		len = (P - window_idx < S) ? P - window_idx : S;
+		ola_process(oc, in, (N - window_idx < S) ? N - window_idx : S, out, len);
+		PROFILE_BEGIN(t);
+		for (c = 0; c < r->out_channels; c++)
+			update_max(peak_abs(out[c], len, 0.0));
+		PROFILE_END(PROFILE_PEAK, t, sizeof(double) * len * r->out_channels);
 	}
 	
+	// Add all samples remaining in the overlap to the output channels:
+	for (c = 0; c < r->out_channels; c++)
+		out[c] = y[c] + window_idx;
+	len = (P - window_idx < oc->olap_len) ? P - window_idx : oc->olap_len;
+	if (len < 0)
+		len = 0;
+	ola_flush(oc, out, len);
+	PROFILE_BEGIN(t);
+	for (c = 0; c < r->out_channels; c++)
+		update_max(peak_abs(out[c], len, 0.0));
+	PROFILE_END(PROFILE_PEAK, t, sizeof(double) * len * r->out_channels);
+	
 	// Clean up:
-	free(XX);
-	free(REX);
-	free(IMX);
-	free(REFR);
-	free(IMFR);
-	free(OLAP);
+	ola_destroy(oc);
+}
+
+/**
+ * Multichannel convolution with any engine: the mono engine is run once
+ * per route, and its output summed into the route's output channel.
+ */
+void convolve_routed_mono(double **x, double **h, double **y, ChannelRouting *r) {
+	WaveData saved_X = X, saved_H = H;
+	double *saved_Y = Y;
+	int j;
+	
+	for (int o = 0; o < r->out_channels; o++)
+		for (j = 0; j < P; j++)
+			y[o][j] = 0.0;
+	
+	for (int t = 0; t < r->num_routes; t++) {
+		X.length = N;
+		X.channels = 1;
+		X.sampleData = x[r->route_in[t]];
+		H.length = M;
+		H.channels = 1;
+		H.sampleData = h[r->route_ir[t]];
+		size_t mark = arena_mark(&scratch);
+		Y = (double *)arena_alloc(&scratch, sizeof(double) * P);
+		if (Y == NULL) {
+			printf("malloc of size %d failed!\n", P);
+			break;
+		}
+		run_engine();
+		for (j = 0; j < P; j++)
+			y[r->route_out[t]][j] += Y[j];
+		arena_release(&scratch, mark);
+	}
+	X = saved_X;
+	H = saved_H;
+	Y = saved_Y;
+	
+	// The mono engines tracked the peak of each route on its own:
+	PROFILE_BEGIN(u);
+	max = DBL_MIN;
+	for (int o = 0; o < r->out_channels; o++)
+		update_max(peak_abs(y[o], P, 0.0));
+	PROFILE_END(PROFILE_PEAK, u, sizeof(double) * P * r->out_channels);
+}
+
+/**
+ * Convolve a multichannel input and/or impulse response, leaving the
+ * interleaved output in Y. Returns the number of output channels, or 0
+ * on failure.
+ */
+int convolve_multichannel() {
+	ChannelRouting r;
+	if (channel_routing(X.channels, H.channels, &r) == FALSE) {
+		printf("Unsupported channel layout: %d input & %d impulse response channels!\n",
+			   X.channels, H.channels);
+		return 0;
+	}
+	
+	size_t mark = arena_mark(&scratch);
+	double **x = arena_channels(&scratch, X.channels, N);
+	double **h = arena_channels(&scratch, H.channels, M);
+	double **y = arena_channels(&scratch, r.out_channels, P);
+	Y = (double *)aligned_malloc(sizeof(double) * P * r.out_channels);
+	if (x == NULL || h == NULL || y == NULL || Y == NULL) {
+		printf("malloc failed while splitting channels!\n");
+		r.out_channels = 0;
+	}
+	else {
+		deinterleave_into(X, x);
+		deinterleave_into(H, h);
+		if (engine == ENGINE_OVERLAP_ADD && precision == PRECISION_DOUBLE)
+			convolve_overlap_add_routed(x, h, y, &r);
+		else
+			convolve_routed_mono(x, h, y, &r);
+		interleave(y, r.out_channels, P, Y);
+	}
+	
+	arena_release(&scratch, mark);
+	return r.out_channels;
+}
+
+/**
+ * Return the wisdom key of convolving X with H in the current settings.
+ */
+PlanKey plan_key() {
+	PlanKey key;
+	memset(&key, 0, sizeof(key));
+	key.n_class = planner_class(X.length);
+	key.m_class = planner_class(H.length);
+	key.in_channels = X.channels;
+	key.ir_channels = H.channels;
+	key.threads = num_threads;
+	key.precision = precision;
+	key.simd = simd_level();
+	return key;
+}
+
+/**
+ * Convolve the first len frames of X with H using the current engine
+ * settings, discard the output, and return how long it took in seconds.
+ */
+double plan_trial(int len) {
+	int saved_N = N, saved_length = X.length;
+	X.length = N = len;
+	P = N + M - 1;
+	
+	double start = planner_wall();
+	if (X.channels > 1 || H.channels > 1)
+		convolve_multichannel();
+	else if ((Y = (double *)aligned_malloc(sizeof(double) * P)) != NULL)
+		run_engine();
+	double seconds = planner_wall() - start;
+	
+	free(Y);
+	Y = NULL;
+	N = saved_N;
+	X.length = saved_length;
+	P = N + M - 1;
+	return seconds;
+}
+
+/**
+ * Replace ENGINE_AUTO by the fastest engine & block length for convolving
+ * X with H, as recorded in the wisdom file or else measured (see
+ * planner.c). Each candidate is timed on longer & longer prefixes of the
+ * input until a trial takes PLANNER_MIN_TRIAL seconds, or covers the whole
+ * input, and its time for all N samples extrapolated from that; candidates
+ * that fall PLANNER_PRUNE times behind are dropped early. The
+ * non-uniformly partitioned engine isn't a candidate: it trades
+ * throughput for a latency that files don't need.
+ */
+void plan_engine(int verbose) {
+	Wisdom best;
+	memset(&best, 0, sizeof(best));
+	best.key = plan_key();
+	N = X.length;
+	M = H.length;
+	P = N + M - 1;
+	
+	if (N < 1 || M < 1) {
+		engine = ENGINE_OVERLAP_ADD;
+		return;
+	}
+	if (wisdom_load(&best.key, &best) == FALSE) {
+		// Trials don't pollute the spectrum cache with the losers' spectra:
+		char *saved_dir = spectrum_cache_dir;
+		spectrum_cache_dir = NULL;
+		
+		// Overlap-add first, as the usual winner gives the tightest pruning;
+		// then partitions up to the first that covers the whole IR; and the
+		// direct form last, as it is hopeless for all but short IRs:
+		int engines[16], block_lens[16], num = 0, c, len;
+		engines[num] = ENGINE_OVERLAP_ADD;
+		block_lens[num++] = 0;
+		for (len = 512; len <= NUPOLS_MAX_BLOCK_LEN; len *= 2) {
+			engines[num] = ENGINE_UNIFORM_PARTITIONED;
+			block_lens[num++] = len;
+			if (len >= M)
+				break;
+		}
+		engines[num] = ENGINE_INPUT_SIDE;
+		block_lens[num++] = 0;
+		
+		best.engine = -1;
+		for (c = 0; c < num; c++) {
+			engine = engines[c];
+			partition_len = (block_lens[c] != 0) ? block_lens[c] : DEFAULT_PARTITION_LEN;
+			double estimate = 0.0;
+			for (len = (N < 1024) ? N : 1024; ; len = (2 * len < N) ? 2 * len : N) {
+				double seconds = plan_trial(len);
+				estimate = seconds * N / len;
+				if (seconds >= PLANNER_MIN_TRIAL || len == N ||
+					(best.engine != -1 && estimate > PLANNER_PRUNE * best.seconds))
+					break;
+			}
+			if (best.engine == -1 || estimate < best.seconds) {
+				best.engine = engines[c];
+				best.block_len = block_lens[c];
+				best.seconds = estimate;
+			}
+		}
+		spectrum_cache_dir = saved_dir;
+		wisdom_store(&best);
+	}
+	else if (verbose == TRUE)
+		printf("Using wisdom from %s.\n", wisdom_file);
+	
+	engine = best.engine;
+	if (best.block_len != 0) {
+		partition_len = best.block_len;
+		nupols_block_len = best.block_len;
+	}
+	max = DBL_MIN;
+	if (verbose == TRUE) {
+		printf("Planned engine: %s", engine_names[engine]);
+		if (best.block_len != 0)
+			printf(" with %d sample blocks", best.block_len);
+		printf(" (estimated %.3f s).\n\n", best.seconds);
+	}
 }
 
 /**
@@ -296,32 +882,90 @@ void convolve_overlap_add_fft() {
  * a new WAVE file at the specified filepath.
  */
 void convolve(char * outputFile, int verbose) {
-	// Determine size of Y[]:
+	int out_channels = 1;
+	
+	// Determine size of Y[] (per channel):
 	N = X.length;
 	M = H.length;
 	P = N + M - 1;
 	
-	// Allocate space for the convolution data:
-	Y = (double *)malloc(sizeof(double)*P);
-	if (Y == NULL) {
-		printf("malloc of size %d failed!\n", P);
-		return;
-	}
-	
 	// Convolve the input and impulse response sample data:
 	if (verbose == TRUE) printf("Beginning convolution ...\n");
-	//convolve_input_side();
-	convolve_overlap_add_fft();
+	if (X.channels > 1 || H.channels > 1) {
+		out_channels = convolve_multichannel();
+		if (out_channels == 0)
+			return;
+	}
+	else {
+		// Allocate space for the convolution data:
+		Y = (double *)aligned_malloc(sizeof(double)*P);
+		if (Y == NULL) {
+			printf("malloc of size %d failed!\n", P);
+			return;
+		}
+		run_engine();
+	}
 	if (verbose == TRUE) printf("Successfully performed convolution.\n\n");
 	
-	// Normalize convolved audio data:
-	if (verbose == TRUE) printf("Normalizing convolved audio ...\n");
-	for (i = 0; i < P; i++)
-		Y[i] /= max;
-	if (verbose == TRUE) printf("Done!\n\n");
-	
-	// Write convolved data to a new .wav file:
-	if (verbose == TRUE) printf("Creating output file ...\n");
-	write_wav(outputFile, Y, P, 1, verbose);
+	// Normalize the convolved audio data as it is written to a new .wav
+	// file, in a single pass:
+	if (verbose == TRUE) printf("Normalizing convolved audio & creating output file ...\n");
+	write_wav_normalized(outputFile, Y, P * out_channels, out_channels, X.samplerate,
+						 1.0 / max, verbose);
 	if (verbose == TRUE) printf("Done!\n");
 }
+
+/**
+ * Streaming convolution: convolve the input file with the impulse response
+ * one segment at a time (see stream.c), so inputs of any length can be
+ * convolved in memory bounded by the impulse response.
+ * 
+ * normalize selects how the output is normalized (see normalize.c):
+ * NORMALIZE_TWO_PASS & NORMALIZE_BOUND write 16-bit PCM like convolve(),
+ * NORMALIZE_NONE writes unnormalized 32-bit float samples. The output's
+ * peak is left in max.
+ */
+void convolve_stream(char * inputFile, char * irFile, char * outputFile,
+					 int normalize, int verbose) {
+	ChannelRouting r;
+	
+	if (verbose == TRUE) printf("\nReading impulse response file ...\n\n");
+	PROFILE_BEGIN(t);
+	H = read_wav(irFile, verbose);
+	if (H.length == -1)
+		return;
+	PROFILE_END(PROFILE_READ, t, sizeof(double) * (long long)H.length * H.channels);
+	WaveReader *in_wr = open_wav(inputFile, verbose);
+	if (in_wr == NULL)
+		return;
+	if (channel_routing(in_wr->info.channels, H.channels, &r) == FALSE) {
+		printf("Unsupported channel layout: %d input & %d impulse response channels!\n",
+			   in_wr->info.channels, H.channels);
+		close_wav(in_wr);
+		return;
+	}
+	
+	double **h = deinterleave(H);
+	OLAConvolver *oc = (h == NULL) ? NULL : ola_create(h, H.length, &r);
+	double bound = (h == NULL) ? 0.0 : peak_bound(h, H.length, &r);
+	free_channels(h, H.channels);
+	if (oc == NULL) {
+		close_wav(in_wr);
+		return;
+	}
+	
+	if (verbose == TRUE) printf("Beginning streaming convolution ...\n");
+	sf_count_t frames_written = stream_file(oc, &scratch, bound, in_wr, outputFile,
+											normalize, &max);
+	if (verbose == TRUE && frames_written >= 0) {
+		printf("Wrote %lld frames of %d channel(s).\n",
+			   (long long)frames_written, r.out_channels);
+		printf("Peak amplitude: %f\n", max);
+		if (normalize == NORMALIZE_BOUND)
+			printf("Peak bound: %f\n", bound);
+	}
+	
+	// Clean up:
+	close_wav(in_wr);
+	ola_destroy(oc);
+}
@@ -0,0 +1,110 @@
+/**
+ * Direct-form (time domain) convolution kernels.
+ *
+ * Rather than scattering each input sample into M outputs, the kernels
+ * gather: with xp the input preceded & followed by M-1 zeros and hr the
+ * impulse response reversed, output sample n is
+ *     y[n] = xp[n] * hr[0] + xp[n+1] * hr[1] + ... + xp[n+M-1] * hr[M-1]
+ * so the only stores are of finished outputs and no bounds are checked.
+ * The vector kernels keep DIRECT_REGS vectors of consecutive outputs in
+ * registers, broadcasting each tap against unaligned loads of xp. Long
+ * impulse responses are applied DIRECT_TAP_BLOCK taps at a time to
+ * DIRECT_OUT_BLOCK outputs, so the slices of xp & hr in use stay in L1.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+// Vector registers of outputs accumulated at once by the vector kernels:
+#define DIRECT_REGS 4
+
+// Taps & outputs per cache block:
+#define DIRECT_TAP_BLOCK 512
+#define DIRECT_OUT_BLOCK 1024
+
+/**
+ * Compute y[i] = sum(xp[i+k] * hr[k], k = 0 .. len_h - 1) for i in
+ * [0, len), adding to y if accumulate is TRUE and overwriting it otherwise.
+ */
+void direct_rows_scalar(double *y, double *xp, double *hr, int len_h,
+						int len, int accumulate) {
+	for (int i = 0; i < len; i++) {
+		double acc = accumulate ? y[i] : 0.0;
+		for (int k = 0; k < len_h; k++)
+			acc += xp[i+k] * hr[k];
+		y[i] = acc;
+	}
+}
+
+#if SIMD_X86
+
+/**
+ * Define direct_rows_<isa>(), processing DIRECT_REGS * W outputs per
+ * iteration. FMA(a, b, c) is a * b + c.
+ */
+#define DEFINE_DIRECT_KERNEL(isa,features,VEC,W,LOAD,STORE,SET1,FMA)\
+__attribute__((target(features)))\
+void direct_rows_##isa(double *y, double *xp, double *hr, int len_h,\
+					   int len, int accumulate) {\
+	VEC acc[DIRECT_REGS], h;\
+	int i, k, r;\
+	for (i = 0; i + DIRECT_REGS * W <= len; i += DIRECT_REGS * W) {\
+		for (r = 0; r < DIRECT_REGS; r++)\
+			acc[r] = accumulate ? LOAD(y + i + r * W) : SET1(0.0);\
+		for (k = 0; k < len_h; k++) {\
+			h = SET1(hr[k]);\
+			for (r = 0; r < DIRECT_REGS; r++)\
+				acc[r] = FMA(LOAD(xp + i + k + r * W), h, acc[r]);\
+		}\
+		for (r = 0; r < DIRECT_REGS; r++)\
+			STORE(y + i + r * W, acc[r]);\
+	}\
+	direct_rows_scalar(y + i, xp + i, hr, len_h, len - i, accumulate);\
+}
+
+#define FMA_SSE2(a,b,c) _mm_add_pd(_mm_mul_pd(a, b), c)
+
+DEFINE_DIRECT_KERNEL(sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+					 _mm_set1_pd, FMA_SSE2)
+DEFINE_DIRECT_KERNEL(avx2, "avx2,fma", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+					 _mm256_set1_pd, _mm256_fmadd_pd)
+DEFINE_DIRECT_KERNEL(avx512, "avx512f", __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd,
+					 _mm512_set1_pd, _mm512_fmadd_pd)
+
+#endif
+
+typedef void (*DirectKernel)(double *, double *, double *, int, int, int);
+
+/**
+ * Return the direct_rows kernel for a SIMD_* level.
+ */
+DirectKernel direct_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return direct_rows_avx512;
+	if (level == SIMD_AVX2)
+		return direct_rows_avx2;
+	if (level == SIMD_SSE2)
+		return direct_rows_sse2;
+#endif
+	return direct_rows_scalar;
+}
+
+/**
+ * Compute outputs [first, last) of the convolution of the padded input xp
+ * with the reversed impulse response hr (len_h taps) into y, one cache
+ * block at a time, and return their largest absolute value.
+ */
+double direct_range(DirectKernel kernel, double *y, double *xp, double *hr,
+					int len_h, int first, int last) {
+	double peak = 0.0;
+	for (int i = first; i < last; i += DIRECT_OUT_BLOCK) {
+		int len = (last - i < DIRECT_OUT_BLOCK) ? last - i : DIRECT_OUT_BLOCK;
+		for (int k = 0; k < len_h; k += DIRECT_TAP_BLOCK) {
+			int taps = (len_h - k < DIRECT_TAP_BLOCK) ? len_h - k : DIRECT_TAP_BLOCK;
+			kernel(y + i, xp + i + k, hr + k, taps, len, k > 0);
+		}
+		peak = peak_abs(y + i, len, peak);
+	}
+	return peak;
+}
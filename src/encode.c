@@ -0,0 +1,142 @@
+/**
+ * Output encoding.
+ *
+ * A WavEncoder scales, dithers & converts output samples in one vectorized
+ * pass per block (the scale_* kernels in simd.c), into a large aligned
+ * buffer that is handed to libsndfile already in the file's sample format
+ * once it fills. libsndfile then only copies it out, so encoding keeps
+ * pace with the convolution instead of trailing it sample by sample.
+ *
+ * The format of normalized output is set with convolve -f (16, 24 or
+ * 32-bit PCM, or 32-bit float), and convolve -d adds TPDF dither to PCM
+ * output. The dither is seeded the same way every time, so renders are
+ * reproducible.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Frames encoded into the buffer before it is written out:
+#define ENCODER_BLOCK_FRAMES 65536
+
+#define DITHER_SEED 0x636F6E766F6C7665ULL
+
+// Sample format of normalized output (an SF_FORMAT_* subtype), and
+// whether PCM output is dithered:
+int output_format = SF_FORMAT_PCM_16;
+int output_dither = FALSE;
+
+typedef struct WavEncoder {
+	SNDFILE *sf;
+	int format;				// SF_FORMAT_PCM_16, _PCM_24, _PCM_32 or _FLOAT
+	int channels;
+	Dither dither;
+	int use_dither;
+	void *buf;				// ENCODER_BLOCK_FRAMES encoded frames
+	sf_count_t buffered;	// Frames in buf
+	sf_count_t written;		// Frames written to sf, or -1 after a failure
+} WavEncoder;
+
+/**
+ * Return the bytes per encoded sample of format.
+ */
+int encoder_sample_bytes(int format) {
+	return (format == SF_FORMAT_PCM_16) ? sizeof(short) :
+		   (format == SF_FORMAT_FLOAT) ? sizeof(float) : sizeof(int);
+}
+
+/**
+ * Create a .wav file of num_channels channels at samplerate Hz, in format
+ * (SF_FORMAT_PCM_16, _PCM_24, _PCM_32 or _FLOAT) and TPDF-dithered if
+ * dither is TRUE & format is PCM. Returns NULL on failure.
+ */
+WavEncoder * encoder_create(char * filepath, int num_channels, int samplerate,
+							int format, int dither) {
+	WavEncoder *e = (WavEncoder *)calloc(1, sizeof(WavEncoder));
+	if (e != NULL)
+		e->buf = aligned_malloc((size_t)encoder_sample_bytes(format) *
+								ENCODER_BLOCK_FRAMES * num_channels);
+	if (e == NULL || e->buf == NULL) {
+		printf("malloc failed while initializing the encoder!\n");
+		free(e);
+		return NULL;
+	}
+	if ((e->sf = create_wav(filepath, num_channels, samplerate, format)) == NULL) {
+		free(e->buf);
+		free(e);
+		return NULL;
+	}
+	e->format = format;
+	e->channels = num_channels;
+	e->use_dither = (dither == TRUE && format != SF_FORMAT_FLOAT);
+	dither_init(&e->dither, DITHER_SEED);
+	return e;
+}
+
+/**
+ * Write the buffered frames out to the file.
+ */
+void encoder_flush(WavEncoder *e) {
+	sf_count_t n = 0;
+	if (e->buffered == 0)
+		return;
+	PROFILE_BEGIN(t);
+	if (e->format == SF_FORMAT_PCM_16)
+		n = sf_writef_short(e->sf, (short *)e->buf, e->buffered);
+	else if (e->format == SF_FORMAT_FLOAT)
+		n = sf_writef_float(e->sf, (float *)e->buf, e->buffered);
+	else
+		n = sf_writef_int(e->sf, (int *)e->buf, e->buffered);
+	PROFILE_END(PROFILE_WRITE, t, (size_t)encoder_sample_bytes(e->format) *
+				e->buffered * e->channels);
+	if (n != e->buffered)
+		e->written = -1;
+	else if (e->written != -1)
+		e->written += n;
+	e->buffered = 0;
+}
+
+/**
+ * Multiply frames interleaved frames of y by scale in place & encode them,
+ * writing the buffer out whenever it fills. Returns frames.
+ */
+sf_count_t encoder_write(WavEncoder *e, double *y, sf_count_t frames, double scale) {
+	Dither *d = (e->use_dither == TRUE) ? &e->dither : NULL;
+	int bytes = encoder_sample_bytes(e->format);
+	for (sf_count_t done = 0, n; done < frames; done += n) {
+		n = frames - done;
+		if (n > ENCODER_BLOCK_FRAMES - e->buffered)
+			n = ENCODER_BLOCK_FRAMES - e->buffered;
+		double *src = y + done * e->channels;
+		void *dst = (char *)e->buf + (size_t)bytes * e->buffered * e->channels;
+		int len = n * e->channels;
+		PROFILE_BEGIN(t);
+		if (e->format == SF_FORMAT_PCM_16)
+			scale_pcm16(src, (short *)dst, len, scale, d);
+		else if (e->format == SF_FORMAT_PCM_24)
+			scale_pcm32(src, (int *)dst, len, scale, 24, d);
+		else if (e->format == SF_FORMAT_PCM_32)
+			scale_pcm32(src, (int *)dst, len, scale, 32, d);
+		else
+			scale_float(src, (float *)dst, len, scale);
+		PROFILE_END(PROFILE_NORMALIZE, t, (2 * sizeof(double) + bytes) * len);
+		if ((e->buffered += n) == ENCODER_BLOCK_FRAMES)
+			encoder_flush(e);
+	}
+	return frames;
+}
+
+/**
+ * Write out what is left in the buffer, close the file & free e. Returns
+ * the number of frames written, or -1 if any write failed.
+ */
+sf_count_t encoder_close(WavEncoder *e) {
+	if (e == NULL)
+		return -1;
+	encoder_flush(e);
+	sf_count_t written = e->written;
+	sf_close(e->sf);
+	free(e->buf);
+	free(e);
+	return written;
+}
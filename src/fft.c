@@ -14,8 +14,11 @@
 //  isign for an FFT, and -1 for the Inverse FFT.
 //  The data is complex, so the array size must be
 //  nn*2. This code assumes the array starts
-//  at index 1, not 0, so subtract 1 when
-//  calling the routine (see main() below).
+//  at index 1, not 0: pass a buffer of nn*2+1
+//  elements holding the data from buf[1] on
+//  (forming data-1 from a 0-based array is
+//  undefined behaviour). The engines use the
+//  0-based FFTPlan entry points below instead.
 void four1(double data[], int nn, int isign)
 {
     unsigned long n, mmax, m, j, istep, i;
@@ -63,3 +66,846 @@ void four1(double data[], int nn, int isign)
 		mmax = istep;
     }
 }
+
+//  The realft FFT from Numerical Recipes in C,
+//  p. 513.
+//  Note:  changed float data types to double.
+//  Calculates the Fourier transform of a set of n
+//  real-valued data points using a single complex
+//  four1() of length n/2 (i.e. half the work of
+//  transforming the real data as complex data).
+//  n must be a power of 2. On output the positive
+//  frequency half of the (Hermitian-symmetric)
+//  spectrum is packed into data[]: data[1] holds
+//  the DC term, data[2] holds the Nyquist term, and
+//  data[2k+1], data[2k+2] hold the real & imaginary
+//  parts of bin k. Use -1 for isign to perform the
+//  inverse transform; the result must then be
+//  multiplied by 2/n. Like four1, this code assumes
+//  the array starts at index 1, not 0, so data[]
+//  needs n+1 elements with a leading pad slot.
+void realft(double data[], int n, int isign)
+{
+    unsigned long i, i1, i2, i3, i4, np3;
+    double c1 = 0.5, c2, h1r, h1i, h2r, h2i;
+    double wr, wi, wpr, wpi, wtemp, theta;
+
+    theta = PI / (double) (n >> 1);
+    if (isign == 1) {
+		c2 = -0.5;
+		four1(data, n >> 1, 1);
+    }
+    else {
+		c2 = 0.5;
+		theta = -theta;
+    }
+    wtemp = sin(0.5 * theta);
+    wpr = -2.0 * wtemp * wtemp;
+    wpi = sin(theta);
+    wr = 1.0 + wpr;
+    wi = wpi;
+    np3 = n + 3;
+
+    for (i = 2; i <= (n >> 2); i++) {
+		i4 = 1 + (i3 = np3 - (i2 = 1 + (i1 = i + i - 1)));
+		h1r = c1 * (data[i1] + data[i3]);
+		h1i = c1 * (data[i2] - data[i4]);
+		h2r = -c2 * (data[i2] + data[i4]);
+		h2i = c2 * (data[i1] - data[i3]);
+		data[i1] = h1r + wr * h2r - wi * h2i;
+		data[i2] = h1i + wr * h2i + wi * h2r;
+		data[i3] = h1r - wr * h2r + wi * h2i;
+		data[i4] = -h1i + wr * h2i + wi * h2r;
+		wr = (wtemp = wr) * wpr - wi * wpi + wr;
+		wi = wi * wpr + wtemp * wpi + wi;
+    }
+
+    if (isign == 1) {
+		data[1] = (h1r = data[1]) + data[2];
+		data[2] = h1r - data[2];
+    }
+    else {
+		data[1] = c1 * ((h1r = data[1]) + data[2]);
+		data[2] = c1 * (h1r - data[2]);
+		four1(data, n >> 1, -1);
+    }
+}
+
+// Most radix 3, 5 & 7 stages in a transform (3^20 exceeds any int length):
+#define FFT_MAX_ODD_STAGES 20
+
+/**
+ * A reusable plan for real-valued FFTs of length n, where n/2 is a product
+ * of powers of 2, 3, 5 & 7 (see fft_length_ok()). Everything four1() &
+ * realft() recompute on each call -- the bit-reversal permutation & the
+ * sin()-based twiddle factor recurrences -- is tabulated once here, so
+ * transforming thousands of segments of the same length only pays for the
+ * butterflies themselves.
+ *
+ * The complex half-length transform runs on split real & imaginary arrays.
+ * Its power-of-2 factor is transformed first, two radix-2 stages at a time
+ * (i.e. radix-4 passes), followed by one radix 3, 5 or 7 pass per odd
+ * factor; the input permutation is the matching digit reversal, which for a
+ * power of 2 is the bit reversal. The butterflies are vectorized for the
+ * widest instruction set simd_level() reports when the plan is created.
+ * The plan also carries the matching spectrum multiply kernels for the
+ * spectra it produces.
+ */
+typedef struct FFTPlan {
+	int n;				// Real transform length
+	int nn;				// Complex transform length (n / 2)
+	int *rev;			// Digit-reversed index of each of the nn complex values
+	int *irev;			// Inverse of rev (rev itself for a power of 2)
+	double *twr, *twi;	// cos & sin of 2*PI*k/n, for k < n/2
+	double *STR, *STI;	// Per-stage twiddles: entry h+m is cos & sin of PI*m/h
+	double *OTR, *OTI;	// Odd stage roots of unity & twiddles (see odd_pass_scalar())
+	double *RE, *IM;	// nn point split-format scratch for fft_execute()
+	int pow2;			// Power-of-2 factor of nn
+	int num_odd;		// Radix 3, 5 & 7 stages, in the order they run
+	int odd_radix[FFT_MAX_ODD_STAGES];
+	int simd;			// SIMD_* level of radix4_pass & odd_pass
+	int width;			// Doubles per vector for radix4_pass & odd_pass
+	void (*radix4_pass)(double *, double *, double *, double *, int, int);
+	void (*odd_pass)(double *, double *, double *, double *, int, int, int);
+	SpectrumKernel spectrum_mul;	// Y = X * H over this plan's spectra
+	SpectrumKernel spectrum_mac;	// Y += X * H over this plan's spectra
+} FFTPlan;
+
+/**
+ * Multiply-add helpers for one radix-4 butterfly, i.e. two radix-2 stages
+ * spanning h and 2h points: x0-x3 are the values at offsets 0, h, 2h & 3h,
+ * w1 is the twiddle for the first stage and w2 & w3 those for the second.
+ */
+#define RADIX4_BUTTERFLY(x0r,x0i,x1r,x1i,x2r,x2i,x3r,x3i,w1r,w1i,w2r,w2i,w3r,w3i,ADD,SUB,MUL)\
+		tr = SUB(MUL(w1r, x1r), MUL(w1i, x1i));\
+		ti = ADD(MUL(w1r, x1i), MUL(w1i, x1r));\
+		a1r = SUB(x0r, tr); a1i = SUB(x0i, ti);\
+		a0r = ADD(x0r, tr); a0i = ADD(x0i, ti);\
+		tr = SUB(MUL(w1r, x3r), MUL(w1i, x3i));\
+		ti = ADD(MUL(w1r, x3i), MUL(w1i, x3r));\
+		a3r = SUB(x2r, tr); a3i = SUB(x2i, ti);\
+		a2r = ADD(x2r, tr); a2i = ADD(x2i, ti);\
+		tr = SUB(MUL(w2r, a2r), MUL(w2i, a2i));\
+		ti = ADD(MUL(w2r, a2i), MUL(w2i, a2r));\
+		x0r = ADD(a0r, tr); x0i = ADD(a0i, ti);\
+		x2r = SUB(a0r, tr); x2i = SUB(a0i, ti);\
+		tr = SUB(MUL(w3r, a3r), MUL(w3i, a3i));\
+		ti = ADD(MUL(w3r, a3i), MUL(w3i, a3r));\
+		x1r = ADD(a1r, tr); x1i = ADD(a1i, ti);\
+		x3r = SUB(a1r, tr); x3i = SUB(a1i, ti)
+
+#define SCALAR_ADD(a,b) ((a) + (b))
+#define SCALAR_SUB(a,b) ((a) - (b))
+#define SCALAR_MUL(a,b) ((a) * (b))
+
+/**
+ * One radix-4 pass of the forward transform over the nn point split-format
+ * arrays re[] & im[], combining the stages that span h and 2h points.
+ * STR & STI are the plan's per-stage twiddle tables.
+ */
+void radix4_pass_scalar(double *re, double *im, double *STR, double *STI,
+						int nn, int h) {
+	double x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+	double a0r, a0i, a1r, a1i, a2r, a2i, a3r, a3i, tr, ti;
+
+	for (int g = 0; g < nn; g += h * 4) {
+		for (int m = 0; m < h; m++) {
+			int i0 = g + m, i1 = i0 + h, i2 = i1 + h, i3 = i2 + h;
+			x0r = re[i0]; x0i = im[i0]; x1r = re[i1]; x1i = im[i1];
+			x2r = re[i2]; x2i = im[i2]; x3r = re[i3]; x3i = im[i3];
+			RADIX4_BUTTERFLY(x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i,
+							 STR[h+m], STI[h+m], STR[2*h+m], STI[2*h+m],
+							 STR[3*h+m], STI[3*h+m],
+							 SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+			re[i0] = x0r; im[i0] = x0i; re[i1] = x1r; im[i1] = x1i;
+			re[i2] = x2r; im[i2] = x2i; re[i3] = x3r; im[i3] = x3i;
+		}
+	}
+}
+
+/**
+ * One radix-R pass over groups of R*h points, combining R transforms of h
+ * points each, W butterflies at a time. Each group's inputs are multiplied
+ * by their twiddles TR & TI, then the R-point DFT is computed from the
+ * sums & differences of its symmetric pairs of inputs, with the roots of
+ * unity CR & CI, so each pair of outputs k & R-k shares its products.
+ */
+#define ODD_PASS_BODY(R,VEC,W,LOAD,STORE,SET1,ADD,SUB,MUL) do {\
+	VEC xr[R], xi[R], sr[R], si[R], dr[R], di[R];\
+	VEC ar, ai, br, bi, tr, ti, wr, wi, c, sn;\
+	T *TR = OTR + R, *TI = OTI + R, *CR = OTR, *CI = OTI;\
+	for (int g = 0; g < nn; g += h * R) {\
+		for (int m = 0; m < h; m += W) {\
+			int i0 = g + m;\
+			xr[0] = LOAD(re + i0); xi[0] = LOAD(im + i0);\
+			for (int q = 1; q < R; q++) {\
+				wr = LOAD(TR + (q-1)*h + m); wi = LOAD(TI + (q-1)*h + m);\
+				tr = LOAD(re + i0 + q*h); ti = LOAD(im + i0 + q*h);\
+				xr[q] = SUB(MUL(wr, tr), MUL(wi, ti));\
+				xi[q] = ADD(MUL(wr, ti), MUL(wi, tr));\
+			}\
+			ar = xr[0]; ai = xi[0];\
+			for (int q = 1; q <= R/2; q++) {\
+				sr[q] = ADD(xr[q], xr[R-q]); si[q] = ADD(xi[q], xi[R-q]);\
+				dr[q] = SUB(xr[q], xr[R-q]); di[q] = SUB(xi[q], xi[R-q]);\
+				ar = ADD(ar, sr[q]); ai = ADD(ai, si[q]);\
+			}\
+			STORE(re + i0, ar); STORE(im + i0, ai);\
+			for (int k = 1; k <= R/2; k++) {\
+				c = SET1(CR[k]); sn = SET1(CI[k]);\
+				ar = ADD(xr[0], MUL(c, sr[1])); ai = ADD(xi[0], MUL(c, si[1]));\
+				br = MUL(sn, dr[1]); bi = MUL(sn, di[1]);\
+				for (int q = 2; q <= R/2; q++) {\
+					c = SET1(CR[q*k % R]); sn = SET1(CI[q*k % R]);\
+					ar = ADD(ar, MUL(c, sr[q])); ai = ADD(ai, MUL(c, si[q]));\
+					br = ADD(br, MUL(sn, dr[q])); bi = ADD(bi, MUL(sn, di[q]));\
+				}\
+				STORE(re + i0 + k*h, SUB(ar, bi)); STORE(im + i0 + k*h, ADD(ai, br));\
+				STORE(re + i0 + (R-k)*h, ADD(ar, bi)); STORE(im + i0 + (R-k)*h, SUB(ai, br));\
+			}\
+		}\
+	}\
+} while (0)
+
+#define SCALAR_LOAD(p) (*(p))
+#define SCALAR_STORE(p,v) (*(p) = (v))
+#define SCALAR_SET1(x) (x)
+
+/**
+ * One radix-r (3, 5 or 7) pass of the forward transform over the nn point
+ * split-format arrays re[] & im[], combining r transforms of h points
+ * each. OTR & OTI hold this stage's r roots of unity, cos & sin of
+ * 2*PI*k/r, followed by its twiddles: entry (q-1)*h + m is cos & sin of
+ * 2*PI*q*m/(r*h), for 1 <= q < r & m < h.
+ */
+void odd_pass_scalar(double *re, double *im, double *OTR, double *OTI,
+					 int nn, int h, int r) {
+	typedef double T;
+	if (r == 3)
+		ODD_PASS_BODY(3, double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1,
+					  SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+	else if (r == 5)
+		ODD_PASS_BODY(5, double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1,
+					  SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+	else
+		ODD_PASS_BODY(7, double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1,
+					  SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+}
+
+#if SIMD_X86
+
+/**
+ * Define radix4_pass_<isa><SFX>(), which vectorizes radix4_pass_scalar()
+ * across the m loop for arrays of type T, W butterflies at a time. Only
+ * used when h is a multiple of W. SFX is empty for double & _f for float.
+ */
+#define DEFINE_RADIX4_PASS(isa,SFX,T,features,VEC,W,LOAD,STORE,ADD,SUB,MUL)\
+__attribute__((target(features)))\
+void radix4_pass_##isa##SFX(T *re, T *im, T *STR, T *STI, int nn, int h) {\
+	VEC x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;\
+	VEC a0r, a0i, a1r, a1i, a2r, a2i, a3r, a3i, tr, ti;\
+	VEC w1r, w1i, w2r, w2i, w3r, w3i;\
+	for (int g = 0; g < nn; g += h * 4) {\
+		for (int m = 0; m < h; m += W) {\
+			int i0 = g + m, i1 = i0 + h, i2 = i1 + h, i3 = i2 + h;\
+			w1r = LOAD(STR + h + m); w1i = LOAD(STI + h + m);\
+			w2r = LOAD(STR + 2*h + m); w2i = LOAD(STI + 2*h + m);\
+			w3r = LOAD(STR + 3*h + m); w3i = LOAD(STI + 3*h + m);\
+			x0r = LOAD(re + i0); x0i = LOAD(im + i0);\
+			x1r = LOAD(re + i1); x1i = LOAD(im + i1);\
+			x2r = LOAD(re + i2); x2i = LOAD(im + i2);\
+			x3r = LOAD(re + i3); x3i = LOAD(im + i3);\
+			RADIX4_BUTTERFLY(x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i,\
+							 w1r, w1i, w2r, w2i, w3r, w3i, ADD, SUB, MUL);\
+			STORE(re + i0, x0r); STORE(im + i0, x0i);\
+			STORE(re + i1, x1r); STORE(im + i1, x1i);\
+			STORE(re + i2, x2r); STORE(im + i2, x2i);\
+			STORE(re + i3, x3r); STORE(im + i3, x3i);\
+		}\
+	}\
+}
+
+/**
+ * Define odd_pass_<isa><SFX>(), which vectorizes odd_pass_scalar() across
+ * the m loop, like DEFINE_RADIX4_PASS. Only used when h is a multiple of W.
+ */
+#define DEFINE_ODD_PASS(isa,SFX,T_,features,VEC,W,LOAD,STORE,SET1,ADD,SUB,MUL)\
+__attribute__((target(features)))\
+void odd_pass_##isa##SFX(T_ *re, T_ *im, T_ *OTR, T_ *OTI, int nn, int h, int r) {\
+	typedef T_ T;\
+	if (r == 3)\
+		ODD_PASS_BODY(3, VEC, W, LOAD, STORE, SET1, ADD, SUB, MUL);\
+	else if (r == 5)\
+		ODD_PASS_BODY(5, VEC, W, LOAD, STORE, SET1, ADD, SUB, MUL);\
+	else\
+		ODD_PASS_BODY(7, VEC, W, LOAD, STORE, SET1, ADD, SUB, MUL);\
+}
+
+DEFINE_RADIX4_PASS(sse2, , double, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+				   _mm_add_pd, _mm_sub_pd, _mm_mul_pd)
+DEFINE_RADIX4_PASS(avx2, , double, "avx2,fma", __m256d, 4, _mm256_loadu_pd,
+				   _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+DEFINE_RADIX4_PASS(avx512, , double, "avx512f", __m512d, 8, _mm512_loadu_pd,
+				   _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+DEFINE_ODD_PASS(sse2, , double, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+				_mm_set1_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd)
+DEFINE_ODD_PASS(avx2, , double, "avx2,fma", __m256d, 4, _mm256_loadu_pd,
+				_mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd,
+				_mm256_mul_pd)
+DEFINE_ODD_PASS(avx512, , double, "avx512f", __m512d, 8, _mm512_loadu_pd,
+				_mm512_storeu_pd, _mm512_set1_pd, _mm512_add_pd, _mm512_sub_pd,
+				_mm512_mul_pd)
+
+#endif
+
+/**
+ * Return TRUE if n is a length fft_plan_create() supports: even, with n/2
+ * a product of powers of 2, 3, 5 & 7.
+ */
+int fft_length_ok(int n) {
+	if (n < 2 || n % 2 != 0)
+		return FALSE;
+	int m = n / 2;
+	for (int r = 2; r <= 7; r++)
+		while (m % r == 0)
+			m /= r;
+	return (m == 1);
+}
+
+/**
+ * Split nn (see fft_length_ok()) into its power-of-2 factor, which is
+ * returned, and its odd factors, stored in radix[] in the order their
+ * stages run. Returns their number in *num_odd.
+ */
+int fft_factor(int nn, int *radix, int *num_odd) {
+	int pow2 = 1;
+	while (nn % 2 == 0) {
+		pow2 *= 2;
+		nn /= 2;
+	}
+	*num_odd = 0;
+	for (int r = 3; r <= 7; r += 2)
+		for (; nn % r == 0; nn /= r)
+			radix[(*num_odd)++] = r;
+	return pow2;
+}
+
+/**
+ * Tabulate in rev[] the permutation the butterflies expect their nn input
+ * values in: position i holds input value rev[i]. The stages run radix 2
+ * (pow2 of them in all) then radix[0] ... radix[num_odd-1], each combining
+ * sub-transforms of h points into transforms of radix * h. Position i of
+ * the last stage's input lies in sub-transform i / h, which transforms the
+ * input values at that offset modulo radix; and so on down the stages, so
+ * rev[i] is i with its mixed-radix digits reversed. For a power of 2, it is
+ * the bit reversal of four1().
+ */
+void fft_digit_reverse(int nn, int pow2, int *radix, int num_odd, int *rev) {
+	int radices[32 + FFT_MAX_ODD_STAGES], num = 0, k;
+	for (k = 1; k < pow2; k <<= 1)
+		radices[num++] = 2;
+	for (k = 0; k < num_odd; k++)
+		radices[num++] = radix[k];
+
+	for (int i = 0; i < nn; i++) {
+		int pos = i, h = nn, stride = 1;
+		rev[i] = 0;
+		for (int s = num - 1; s >= 0; s--) {
+			h /= radices[s];
+			rev[i] += (pos / h) * stride;
+			pos %= h;
+			stride *= radices[s];
+		}
+	}
+}
+
+/**
+ * Return the number of values in the odd stage tables of an nn-point
+ * transform (see odd_pass_scalar()).
+ */
+int fft_odd_table_len(int pow2, int *radix, int num_odd) {
+	int len = 0, h = pow2;
+	for (int s = 0; s < num_odd; h *= radix[s++])
+		len += radix[s] + (radix[s] - 1) * h;
+	return len;
+}
+
+/**
+ * Estimate the relative time of a real FFT of length n (see
+ * fft_length_ok()) at the current SIMD level, in units of one vectorized
+ * radix-2 stage over n points. From timings of the kernels: a radix-3 or
+ * radix-5 stage costs about as much as the radix-2 stages it replaces
+ * (log2 of its radix) and a radix-7 stage a quarter more; a stage too
+ * narrow for the vector kernels costs twice as much; the permutation &
+ * real pre/post-processing cost about two stages; and once the arrays
+ * outgrow the cache every stage slows down in proportion.
+ */
+double fft_cost(int n) {
+	int radix[FFT_MAX_ODD_STAGES], num_odd, nn = n / 2, h = 1;
+	int pow2 = fft_factor(nn, radix, &num_odd);
+	int level = simd_level();
+	int width = (level == SIMD_AVX512) ? 8 : (level == SIMD_AVX2) ? 4 :
+				(level == SIMD_SSE2) ? 2 : 1;
+	double stages = 2.0;
+
+	// As fft_butterflies() runs them:
+	if ((pow2 & 0x55555555) == 0) {
+		stages += 2.0;
+		h = 2;
+	}
+	for (; h < pow2; h <<= 2)
+		stages += (h >= width) ? 2.0 : 4.0;
+	for (int s = 0; s < num_odd; h *= radix[s++]) {
+		double w = log2(radix[s]) * ((radix[s] == 7) ? 1.25 : 1.0);
+		stages += (h % width == 0) ? w : 2.0 * w;
+	}
+	return n * stages * (1.0 + nn / 262144.0);
+}
+
+/**
+ * Release all memory owned by an FFTPlan.
+ */
+void fft_plan_destroy(FFTPlan *plan) {
+	if (plan == NULL)
+		return;
+	if (plan->irev != plan->rev)
+		free(plan->irev);
+	free(plan->rev);
+	free(plan->twr);
+	free(plan->twi);
+	free(plan->STR);
+	free(plan->STI);
+	free(plan->OTR);
+	free(plan->OTI);
+	free(plan->RE);
+	free(plan->IM);
+	free(plan);
+}
+
+/**
+ * Create a plan for real-valued FFTs of length n (see fft_length_ok()).
+ * Returns NULL if n isn't supported or any allocation fails.
+ */
+FFTPlan * fft_plan_create(int n) {
+	if (fft_length_ok(n) == FALSE) {
+		printf("Unsupported FFT length %d!\n", n);
+		return NULL;
+	}
+	FFTPlan *plan = calloc(1, sizeof(FFTPlan));
+	if (plan == NULL) {
+		printf("malloc failed while creating FFT plan!\n");
+		return NULL;
+	}
+	plan->n = n;
+	plan->nn = n / 2;
+	plan->pow2 = fft_factor(plan->nn, plan->odd_radix, &plan->num_odd);
+	int odd_len = fft_odd_table_len(plan->pow2, plan->odd_radix, plan->num_odd);
+
+	plan->rev = (int *)malloc(sizeof(int) * plan->nn);
+	plan->twr = (double *)aligned_malloc(sizeof(double) * (n / 2 + 1));
+	plan->twi = (double *)aligned_malloc(sizeof(double) * (n / 2 + 1));
+	plan->STR = (double *)aligned_malloc(sizeof(double) * plan->nn);
+	plan->STI = (double *)aligned_malloc(sizeof(double) * plan->nn);
+	plan->OTR = (double *)aligned_malloc(sizeof(double) * odd_len);
+	plan->OTI = (double *)aligned_malloc(sizeof(double) * odd_len);
+	plan->RE = (double *)aligned_malloc(sizeof(double) * plan->nn);
+	plan->IM = (double *)aligned_malloc(sizeof(double) * plan->nn);
+	if (plan->rev == NULL || plan->twr == NULL || plan->twi == NULL ||
+		plan->STR == NULL || plan->STI == NULL || plan->OTR == NULL ||
+		plan->OTI == NULL || plan->RE == NULL || plan->IM == NULL) {
+		printf("malloc failed while creating FFT plan!\n");
+		fft_plan_destroy(plan);
+		return NULL;
+	}
+
+	fft_digit_reverse(plan->nn, plan->pow2, plan->odd_radix, plan->num_odd,
+					  plan->rev);
+	if (plan->num_odd == 0)
+		plan->irev = plan->rev;
+	else if ((plan->irev = (int *)malloc(sizeof(int) * plan->nn)) == NULL) {
+		printf("malloc failed while creating FFT plan!\n");
+		fft_plan_destroy(plan);
+		return NULL;
+	}
+	for (int i = 0; i < plan->nn; i++)
+		plan->irev[plan->rev[i]] = i;
+
+	// Twiddle factors, computed directly rather than by recurrence so
+	// that they carry no accumulated rounding error:
+	for (int k = 0; k < n / 2; k++) {
+		plan->twr[k] = cos(TWO_PI * k / n);
+		plan->twi[k] = sin(TWO_PI * k / n);
+	}
+
+	// The butterflies of the stage spanning 2h points use every n/(2h)-th
+	// entry of that table; lay each stage's twiddles out contiguously so
+	// that they can be loaded a vector at a time:
+	for (int h = 1; h < plan->pow2; h <<= 1) {
+		for (int k = 0; k < h; k++) {
+			plan->STR[h+k] = plan->twr[k * (n / (h * 2))];
+			plan->STI[h+k] = plan->twi[k * (n / (h * 2))];
+		}
+	}
+
+	// Likewise for the odd stages, each preceded by its roots of unity:
+	double *otr = plan->OTR, *oti = plan->OTI;
+	for (int s = 0, h = plan->pow2; s < plan->num_odd; h *= plan->odd_radix[s++]) {
+		int r = plan->odd_radix[s];
+		for (int k = 0; k < r; k++) {
+			*otr++ = cos(TWO_PI * k / r);
+			*oti++ = sin(TWO_PI * k / r);
+		}
+		for (int q = 1; q < r; q++) {
+			for (int k = 0; k < h; k++) {
+				*otr++ = cos(TWO_PI * q * k / ((double)r * h));
+				*oti++ = sin(TWO_PI * q * k / ((double)r * h));
+			}
+		}
+	}
+
+	// Pick the butterfly kernels:
+	plan->simd = simd_level();
+	plan->width = 1;
+	plan->radix4_pass = radix4_pass_scalar;
+	plan->odd_pass = odd_pass_scalar;
+#if SIMD_X86
+	if (plan->simd == SIMD_AVX512) {
+		plan->width = 8;
+		plan->radix4_pass = radix4_pass_avx512;
+		plan->odd_pass = odd_pass_avx512;
+	}
+	else if (plan->simd == SIMD_AVX2) {
+		plan->width = 4;
+		plan->radix4_pass = radix4_pass_avx2;
+		plan->odd_pass = odd_pass_avx2;
+	}
+	else if (plan->simd == SIMD_SSE2) {
+		plan->width = 2;
+		plan->radix4_pass = radix4_pass_sse2;
+		plan->odd_pass = odd_pass_sse2;
+	}
+#endif
+	plan->spectrum_mul = spectrum_kernel(plan->simd, FALSE);
+	plan->spectrum_mac = spectrum_kernel(plan->simd, TRUE);
+
+	return plan;
+}
+
+/**
+ * Return the number of passes fft_butterflies() makes over the data: one
+ * per radix-4 (or leading radix-2) stage & one per odd factor.
+ */
+int fft_num_passes(FFTPlan *plan) {
+	int passes = 0, h = 1;
+	if ((plan->pow2 & 0x55555555) == 0) {
+		passes++;
+		h = 2;
+	}
+	for (; h < plan->pow2; h <<= 2)
+		passes++;
+	return passes + plan->num_odd;
+}
+
+/**
+ * Run passes [first, last) of fft_butterflies(), so that a long transform
+ * can be spread over several calls. Each pass is O(nn).
+ */
+void fft_passes(FFTPlan *plan, double *re, double *im, int first, int last) {
+	int nn = plan->nn, h = 1, p = 0;
+	double tempr, tempi;
+
+	// With an odd number of radix-2 stages, do the first one on its own;
+	// its only twiddle factor is 1:
+	if ((plan->pow2 & 0x55555555) == 0) {
+		if (first <= p && p < last) {
+			for (int i = 0; i < nn; i += 2) {
+				tempr = re[i+1];
+				tempi = im[i+1];
+				re[i+1] = re[i] - tempr;
+				im[i+1] = im[i] - tempi;
+				re[i] += tempr;
+				im[i] += tempi;
+			}
+		}
+		h = 2;
+		p++;
+	}
+
+	// Then the remaining stages in pairs. The vector kernels need at least
+	// a vector's worth of consecutive butterflies:
+	for (; h < plan->pow2 && p < last; h <<= 2, p++) {
+		if (p < first)
+			continue;
+		if (h >= plan->width)
+			plan->radix4_pass(re, im, plan->STR, plan->STI, nn, h);
+		else
+			radix4_pass_scalar(re, im, plan->STR, plan->STI, nn, h);
+	}
+
+	// And finally one pass per odd factor:
+	double *otr = plan->OTR, *oti = plan->OTI;
+	for (int s = 0; s < plan->num_odd && p < last; s++, p++) {
+		int r = plan->odd_radix[s];
+		if (p >= first) {
+			if (h % plan->width == 0)
+				plan->odd_pass(re, im, otr, oti, nn, h, r);
+			else
+				odd_pass_scalar(re, im, otr, oti, nn, h, r);
+		}
+		otr += r + (r - 1) * h;
+		oti += r + (r - 1) * h;
+		h *= r;
+	}
+}
+
+/**
+ * Forward transform of plan->nn complex values held in split format,
+ * already in digit-reversed order, in place.
+ */
+void fft_butterflies(FFTPlan *plan, double *re, double *im) {
+	fft_passes(plan, re, im, 0, fft_num_passes(plan));
+}
+
+/**
+ * Transform plan->nn complex values held in split format in place, with
+ * the same sign convention as four1(). The inverse transform is the
+ * forward one with the real & imaginary parts exchanged on the way in
+ * and out, which the split format gives us for free.
+ */
+void fft_execute_split(FFTPlan *plan, double *re, double *im, int isign) {
+	double tempr;
+	int i;
+
+	// Digit-reversal permutation. A bit reversal is its own inverse, so it
+	// can swap pairs in place; a mixed-radix one goes through the scratch:
+	if (plan->num_odd == 0) {
+		for (i = 0; i < plan->nn; i++) {
+			int j = plan->rev[i];
+			if (j > i) {
+				SWAP(re[i], re[j]);
+				SWAP(im[i], im[j]);
+			}
+		}
+	}
+	else {
+		for (i = 0; i < plan->nn; i++) {
+			plan->RE[i] = re[plan->rev[i]];
+			plan->IM[i] = im[plan->rev[i]];
+		}
+		for (i = 0; i < plan->nn; i++) {
+			re[i] = plan->RE[i];
+			im[i] = plan->IM[i];
+		}
+	}
+
+	if (isign == 1)
+		fft_butterflies(plan, re, im);
+	else
+		fft_butterflies(plan, im, re);
+}
+
+/**
+ * Equivalent of four1(data-1, plan->nn, isign), but zero-indexed and driven
+ * by the plan's precomputed tables. data[] holds plan->nn interleaved
+ * complex values, which are deinterleaved (in digit-reversed order) into the
+ * plan's split-format scratch for the butterflies, then interleaved again.
+ */
+void fft_execute(FFTPlan *plan, double data[], int isign) {
+	double *re = plan->RE, *im = plan->IM;
+	int i, j;
+
+	for (i = 0; i < plan->nn; i++) {
+		j = plan->rev[i] * 2;
+		re[i] = data[j];
+		im[i] = data[j+1];
+	}
+
+	if (isign == 1)
+		fft_butterflies(plan, re, im);
+	else
+		fft_butterflies(plan, im, re);
+
+	for (i = 0; i < plan->nn; i++) {
+		data[i*2] = re[i];
+		data[i*2+1] = im[i];
+	}
+}
+
+/**
+ * Equivalent of realft(data-1, plan->n, isign), but zero-indexed and driven
+ * by the plan's precomputed tables. data[] holds plan->n real values, and
+ * the spectrum is packed exactly as described for realft().
+ */
+void rfft_execute(FFTPlan *plan, double data[], int isign) {
+	int n = plan->n, i1, i2, i3, i4;
+	double c1 = 0.5, c2, h1r, h1i, h2r, h2i, wr, wi;
+	
+	if (isign == 1) {
+		c2 = -0.5;
+		fft_execute(plan, data, 1);
+	}
+	else
+		c2 = 0.5;
+	
+	for (int k = 1; 2 * k < plan->nn; k++) {
+		i1 = k * 2;
+		i2 = i1 + 1;
+		i3 = n - i1;
+		i4 = i3 + 1;
+		wr = plan->twr[k];
+		wi = isign * plan->twi[k];
+		h1r = c1 * (data[i1] + data[i3]);
+		h1i = c1 * (data[i2] - data[i4]);
+		h2r = -c2 * (data[i2] + data[i4]);
+		h2i = c2 * (data[i1] - data[i3]);
+		data[i1] = h1r + wr * h2r - wi * h2i;
+		data[i2] = h1i + wr * h2i + wi * h2r;
+		data[i3] = h1r - wr * h2r + wi * h2i;
+		data[i4] = -h1i + wr * h2i + wi * h2r;
+	}
+	
+	if (isign == 1) {
+		data[0] = (h1r = data[0]) + data[1];
+		data[1] = h1r - data[1];
+	}
+	else {
+		data[0] = c1 * ((h1r = data[0]) + data[1]);
+		data[1] = c1 * (h1r - data[1]);
+		fft_execute(plan, data, -1);
+	}
+}
+
+/**
+ * First phase of rfft_forward(): gather x[0]-x[x_len-1], zero-padded to
+ * plan->n samples, into the plan's scratch as nn complex values in
+ * digit-reversed order.
+ */
+void rfft_gather(FFTPlan *plan, double *x, int x_len) {
+	int nn = plan->nn, i, j;
+	double *RE = plan->RE, *IM = plan->IM;
+	PROFILE_BEGIN(t);
+	
+	// Treat the pairs x[2k], x[2k+1] as nn complex values:
+	if (x_len >= plan->n) {
+		for (i = 0; i < nn; i++) {
+			j = plan->rev[i] * 2;
+			RE[i] = x[j];
+			IM[i] = x[j+1];
+		}
+	}
+	else {
+		for (i = 0; i < nn; i++) {
+			j = plan->rev[i] * 2;
+			RE[i] = (j < x_len) ? x[j] : 0.0;
+			IM[i] = (j + 1 < x_len) ? x[j+1] : 0.0;
+		}
+	}
+	PROFILE_END(PROFILE_PERMUTE, t, sizeof(double) * 2 * nn);
+}
+
+/**
+ * Last phase of rfft_forward(): untangle the transformed scratch into the
+ * split-format spectrum re[] & im[] of plan->nn + 1 bins.
+ */
+void rfft_untangle(FFTPlan *plan, double *re, double *im) {
+	int nn = plan->nn, j, k;
+	double *RE = plan->RE, *IM = plan->IM;
+	double h1r, h1i, h2r, h2i, wr, wi;
+	PROFILE_BEGIN(t);
+	
+	// Separate the spectra of the even & odd samples and recombine them
+	// into bins k & nn-k:
+	re[0] = RE[0] + IM[0];
+	im[0] = 0.0;
+	re[nn] = RE[0] - IM[0];
+	im[nn] = 0.0;
+	for (k = 1; k <= nn / 2; k++) {
+		j = nn - k;
+		wr = plan->twr[k];
+		wi = plan->twi[k];
+		h1r = 0.5 * (RE[k] + RE[j]);
+		h1i = 0.5 * (IM[k] - IM[j]);
+		h2r = 0.5 * (IM[k] + IM[j]);
+		h2i = -0.5 * (RE[k] - RE[j]);
+		re[k] = h1r + wr * h2r - wi * h2i;
+		im[k] = h1i + wr * h2i + wi * h2r;
+		re[j] = h1r - wr * h2r + wi * h2i;
+		im[j] = -h1i + wr * h2i + wi * h2r;
+	}
+	PROFILE_END(PROFILE_RFFT_POST, t, sizeof(double) * 4 * nn);
+}
+
+/**
+ * Real FFT of x[0]-x[x_len-1], zero-padded to plan->n samples, written
+ * straight into the split-format spectrum re[] & im[] of plan->nn + 1
+ * bins (DC through Nyquist). This is rfft_execute(plan, data, 1) without
+ * the copy into data[], the interleaved intermediate, or the unpacking of
+ * its result: the input is gathered in digit-reversed order as it is read,
+ * and the realft() untangling step writes each bin to its final place.
+ */
+void rfft_forward(FFTPlan *plan, double *x, int x_len, double *re, double *im) {
+	rfft_gather(plan, x, x_len);
+	PROFILE_BEGIN(t);
+	fft_butterflies(plan, plan->RE, plan->IM);
+	PROFILE_END(PROFILE_FFT, t, sizeof(double) * 4 * plan->nn);
+	rfft_untangle(plan, re, im);
+}
+
+/**
+ * First phase of rfft_inverse(): fold the split-format spectrum re[] &
+ * im[] of plan->nn + 1 bins into the plan's scratch, ready for
+ * fft_butterflies(plan, plan->IM, plan->RE). re[] & im[] are left
+ * untouched.
+ */
+void rfft_fold(FFTPlan *plan, double *re, double *im) {
+	int nn = plan->nn, j, k;
+	double *RE = plan->RE, *IM = plan->IM;
+	double h1r, h1i, h2r, h2i, wr, wi;
+	PROFILE_BEGIN(t);
+	
+	// Fold bins k & nn-k back into the half-length complex spectrum,
+	// writing each value straight to its digit-reversed position:
+	RE[0] = 0.5 * (re[0] + re[nn]);
+	IM[0] = 0.5 * (re[0] - re[nn]);
+	for (k = 1; k <= nn / 2; k++) {
+		j = nn - k;
+		wr = plan->twr[k];
+		wi = -plan->twi[k];
+		h1r = 0.5 * (re[k] + re[j]);
+		h1i = 0.5 * (im[k] - im[j]);
+		h2r = -0.5 * (im[k] + im[j]);
+		h2i = 0.5 * (re[k] - re[j]);
+		RE[plan->irev[k]] = h1r + wr * h2r - wi * h2i;
+		IM[plan->irev[k]] = h1i + wr * h2i + wi * h2r;
+		RE[plan->irev[j]] = h1r - wr * h2r + wi * h2i;
+		IM[plan->irev[j]] = -h1i + wr * h2i + wi * h2r;
+	}
+	PROFILE_END(PROFILE_RFFT_PRE, t, sizeof(double) * 4 * nn);
+}
+
+/**
+ * Last phase of rfft_inverse(): interleave the transformed scratch into
+ * plan->n real samples in y[].
+ */
+void rfft_scatter(FFTPlan *plan, double *y) {
+	PROFILE_BEGIN(t);
+	for (int i = 0; i < plan->nn; i++) {
+		y[i*2] = plan->RE[i];
+		y[i*2+1] = plan->IM[i];
+	}
+	PROFILE_END(PROFILE_PERMUTE, t, sizeof(double) * 2 * plan->nn);
+}
+
+/**
+ * Inverse of rfft_forward(): transform the split-format spectrum re[] &
+ * im[] of plan->nn + 1 bins back into plan->n real samples in y[]. As with
+ * realft(), the result must be multiplied by 2/n. re[] & im[] are left
+ * untouched.
+ */
+void rfft_inverse(FFTPlan *plan, double *re, double *im, double *y) {
+	rfft_fold(plan, re, im);
+	PROFILE_BEGIN(t);
+	fft_butterflies(plan, plan->IM, plan->RE);
+	PROFILE_END(PROFILE_FFT, t, sizeof(double) * 4 * plan->nn);
+	rfft_scatter(plan, y);
+}
@@ -0,0 +1,337 @@
+/**
+ * Single-precision real FFTs for the float32 engine.
+ *
+ * FFTPlanF mirrors FFTPlan, with float tables, scratch & kernels: twice as
+ * many butterflies & bins fit in each vector, and the working set is half
+ * the size. The twiddle factors are computed in double precision and only
+ * then rounded, so that the float transforms carry no more than float
+ * rounding error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef struct FFTPlanF {
+	int n;				// Real transform length
+	int nn;				// Complex transform length (n / 2)
+	int *rev;			// Digit-reversed index of each of the nn complex values
+	int *irev;			// Inverse of rev (rev itself for a power of 2)
+	float *twr, *twi;	// cos & sin of 2*PI*k/n, for k < n/2
+	float *STR, *STI;	// Per-stage twiddles: entry h+m is cos & sin of PI*m/h
+	float *OTR, *OTI;	// Odd stage roots of unity & twiddles (see odd_pass_scalar())
+	float *RE, *IM;		// nn point split-format scratch
+	int pow2;			// Power-of-2 factor of nn
+	int num_odd;		// Radix 3, 5 & 7 stages, in the order they run
+	int odd_radix[FFT_MAX_ODD_STAGES];
+	int simd;			// SIMD_* level of radix4_pass & odd_pass
+	int width;			// Floats per vector for radix4_pass & odd_pass
+	void (*radix4_pass)(float *, float *, float *, float *, int, int);
+	void (*odd_pass)(float *, float *, float *, float *, int, int, int);
+	SpectrumKernelF spectrum_mul;	// Y = X * H over this plan's spectra
+	SpectrumKernelF spectrum_mac;	// Y += X * H over this plan's spectra
+} FFTPlanF;
+
+/**
+ * Single-precision radix4_pass_scalar().
+ */
+void radix4_pass_scalar_f(float *re, float *im, float *STR, float *STI,
+						  int nn, int h) {
+	float x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+	float a0r, a0i, a1r, a1i, a2r, a2i, a3r, a3i, tr, ti;
+
+	for (int g = 0; g < nn; g += h * 4) {
+		for (int m = 0; m < h; m++) {
+			int i0 = g + m, i1 = i0 + h, i2 = i1 + h, i3 = i2 + h;
+			x0r = re[i0]; x0i = im[i0]; x1r = re[i1]; x1i = im[i1];
+			x2r = re[i2]; x2i = im[i2]; x3r = re[i3]; x3i = im[i3];
+			RADIX4_BUTTERFLY(x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i,
+							 STR[h+m], STI[h+m], STR[2*h+m], STI[2*h+m],
+							 STR[3*h+m], STI[3*h+m],
+							 SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+			re[i0] = x0r; im[i0] = x0i; re[i1] = x1r; im[i1] = x1i;
+			re[i2] = x2r; im[i2] = x2i; re[i3] = x3r; im[i3] = x3i;
+		}
+	}
+}
+
+/**
+ * Single-precision odd_pass_scalar().
+ */
+void odd_pass_scalar_f(float *re, float *im, float *OTR, float *OTI,
+					   int nn, int h, int r) {
+	typedef float T;
+	if (r == 3)
+		ODD_PASS_BODY(3, float, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1,
+					  SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+	else if (r == 5)
+		ODD_PASS_BODY(5, float, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1,
+					  SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+	else
+		ODD_PASS_BODY(7, float, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1,
+					  SCALAR_ADD, SCALAR_SUB, SCALAR_MUL);
+}
+
+#if SIMD_X86
+
+DEFINE_RADIX4_PASS(sse2, _f, float, "sse2", __m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+				   _mm_add_ps, _mm_sub_ps, _mm_mul_ps)
+DEFINE_RADIX4_PASS(avx2, _f, float, "avx2,fma", __m256, 8, _mm256_loadu_ps,
+				   _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+DEFINE_RADIX4_PASS(avx512, _f, float, "avx512f", __m512, 16, _mm512_loadu_ps,
+				   _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+DEFINE_ODD_PASS(sse2, _f, float, "sse2", __m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+				_mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps)
+DEFINE_ODD_PASS(avx2, _f, float, "avx2,fma", __m256, 8, _mm256_loadu_ps,
+				_mm256_storeu_ps, _mm256_set1_ps, _mm256_add_ps, _mm256_sub_ps,
+				_mm256_mul_ps)
+DEFINE_ODD_PASS(avx512, _f, float, "avx512f", __m512, 16, _mm512_loadu_ps,
+				_mm512_storeu_ps, _mm512_set1_ps, _mm512_add_ps, _mm512_sub_ps,
+				_mm512_mul_ps)
+
+#endif
+
+/**
+ * Release all memory owned by an FFTPlanF.
+ */
+void fft_plan_destroy_f(FFTPlanF *plan) {
+	if (plan == NULL)
+		return;
+	if (plan->irev != plan->rev)
+		free(plan->irev);
+	free(plan->rev);
+	free(plan->twr);
+	free(plan->twi);
+	free(plan->STR);
+	free(plan->STI);
+	free(plan->OTR);
+	free(plan->OTI);
+	free(plan->RE);
+	free(plan->IM);
+	free(plan);
+}
+
+/**
+ * Create a plan for single-precision real FFTs of length n (see
+ * fft_length_ok()). Returns NULL if n isn't supported or any allocation
+ * fails.
+ */
+FFTPlanF * fft_plan_create_f(int n) {
+	if (fft_length_ok(n) == FALSE) {
+		printf("Unsupported FFT length %d!\n", n);
+		return NULL;
+	}
+	FFTPlanF *plan = calloc(1, sizeof(FFTPlanF));
+	if (plan == NULL) {
+		printf("malloc failed while creating FFT plan!\n");
+		return NULL;
+	}
+	plan->n = n;
+	plan->nn = n / 2;
+	plan->pow2 = fft_factor(plan->nn, plan->odd_radix, &plan->num_odd);
+	int odd_len = fft_odd_table_len(plan->pow2, plan->odd_radix, plan->num_odd);
+
+	plan->rev = (int *)malloc(sizeof(int) * plan->nn);
+	plan->twr = (float *)aligned_malloc(sizeof(float) * (n / 2 + 1));
+	plan->twi = (float *)aligned_malloc(sizeof(float) * (n / 2 + 1));
+	plan->STR = (float *)aligned_malloc(sizeof(float) * plan->nn);
+	plan->STI = (float *)aligned_malloc(sizeof(float) * plan->nn);
+	plan->OTR = (float *)aligned_malloc(sizeof(float) * odd_len);
+	plan->OTI = (float *)aligned_malloc(sizeof(float) * odd_len);
+	plan->RE = (float *)aligned_malloc(sizeof(float) * plan->nn);
+	plan->IM = (float *)aligned_malloc(sizeof(float) * plan->nn);
+	if (plan->rev == NULL || plan->twr == NULL || plan->twi == NULL ||
+		plan->STR == NULL || plan->STI == NULL || plan->OTR == NULL ||
+		plan->OTI == NULL || plan->RE == NULL || plan->IM == NULL) {
+		printf("malloc failed while creating FFT plan!\n");
+		fft_plan_destroy_f(plan);
+		return NULL;
+	}
+
+	// Same tables as fft_plan_create():
+	fft_digit_reverse(plan->nn, plan->pow2, plan->odd_radix, plan->num_odd,
+					  plan->rev);
+	if (plan->num_odd == 0)
+		plan->irev = plan->rev;
+	else if ((plan->irev = (int *)malloc(sizeof(int) * plan->nn)) == NULL) {
+		printf("malloc failed while creating FFT plan!\n");
+		fft_plan_destroy_f(plan);
+		return NULL;
+	}
+	for (int i = 0; i < plan->nn; i++)
+		plan->irev[plan->rev[i]] = i;
+	for (int k = 0; k < n / 2; k++) {
+		plan->twr[k] = (float)cos(TWO_PI * k / n);
+		plan->twi[k] = (float)sin(TWO_PI * k / n);
+	}
+	for (int h = 1; h < plan->pow2; h <<= 1) {
+		for (int k = 0; k < h; k++) {
+			plan->STR[h+k] = plan->twr[k * (n / (h * 2))];
+			plan->STI[h+k] = plan->twi[k * (n / (h * 2))];
+		}
+	}
+	float *otr = plan->OTR, *oti = plan->OTI;
+	for (int s = 0, h = plan->pow2; s < plan->num_odd; h *= plan->odd_radix[s++]) {
+		int r = plan->odd_radix[s];
+		for (int k = 0; k < r; k++) {
+			*otr++ = (float)cos(TWO_PI * k / r);
+			*oti++ = (float)sin(TWO_PI * k / r);
+		}
+		for (int q = 1; q < r; q++) {
+			for (int k = 0; k < h; k++) {
+				*otr++ = (float)cos(TWO_PI * q * k / ((double)r * h));
+				*oti++ = (float)sin(TWO_PI * q * k / ((double)r * h));
+			}
+		}
+	}
+
+	// Pick the butterfly kernel:
+	plan->simd = simd_level();
+	plan->width = 1;
+	plan->radix4_pass = radix4_pass_scalar_f;
+	plan->odd_pass = odd_pass_scalar_f;
+#if SIMD_X86
+	if (plan->simd == SIMD_AVX512) {
+		plan->width = 16;
+		plan->radix4_pass = radix4_pass_avx512_f;
+		plan->odd_pass = odd_pass_avx512_f;
+	}
+	else if (plan->simd == SIMD_AVX2) {
+		plan->width = 8;
+		plan->radix4_pass = radix4_pass_avx2_f;
+		plan->odd_pass = odd_pass_avx2_f;
+	}
+	else if (plan->simd == SIMD_SSE2) {
+		plan->width = 4;
+		plan->radix4_pass = radix4_pass_sse2_f;
+		plan->odd_pass = odd_pass_sse2_f;
+	}
+#endif
+	plan->spectrum_mul = spectrum_kernel_f(plan->simd, FALSE);
+	plan->spectrum_mac = spectrum_kernel_f(plan->simd, TRUE);
+
+	return plan;
+}
+
+/**
+ * Single-precision fft_butterflies().
+ */
+void fft_butterflies_f(FFTPlanF *plan, float *re, float *im) {
+	int nn = plan->nn, h = 1;
+	float tempr, tempi;
+
+	if ((plan->pow2 & 0x55555555) == 0) {
+		for (int i = 0; i < nn; i += 2) {
+			tempr = re[i+1];
+			tempi = im[i+1];
+			re[i+1] = re[i] - tempr;
+			im[i+1] = im[i] - tempi;
+			re[i] += tempr;
+			im[i] += tempi;
+		}
+		h = 2;
+	}
+
+	for (; h < plan->pow2; h <<= 2) {
+		if (h >= plan->width)
+			plan->radix4_pass(re, im, plan->STR, plan->STI, nn, h);
+		else
+			radix4_pass_scalar_f(re, im, plan->STR, plan->STI, nn, h);
+	}
+
+	float *otr = plan->OTR, *oti = plan->OTI;
+	for (int s = 0; s < plan->num_odd; s++) {
+		int r = plan->odd_radix[s];
+		if (h % plan->width == 0)
+			plan->odd_pass(re, im, otr, oti, nn, h, r);
+		else
+			odd_pass_scalar_f(re, im, otr, oti, nn, h, r);
+		otr += r + (r - 1) * h;
+		oti += r + (r - 1) * h;
+		h *= r;
+	}
+}
+
+/**
+ * Single-precision rfft_forward(): real FFT of x[0]-x[x_len-1], zero-padded
+ * to plan->n samples, into the split-format spectrum re[] & im[] of
+ * plan->nn + 1 bins.
+ */
+void rfft_forward_f(FFTPlanF *plan, float *x, int x_len, float *re, float *im) {
+	int nn = plan->nn, i, j, k;
+	float *RE = plan->RE, *IM = plan->IM;
+	float h1r, h1i, h2r, h2i, wr, wi;
+	PROFILE_BEGIN(t);
+
+	if (x_len >= plan->n) {
+		for (i = 0; i < nn; i++) {
+			j = plan->rev[i] * 2;
+			RE[i] = x[j];
+			IM[i] = x[j+1];
+		}
+	}
+	else {
+		for (i = 0; i < nn; i++) {
+			j = plan->rev[i] * 2;
+			RE[i] = (j < x_len) ? x[j] : 0.0f;
+			IM[i] = (j + 1 < x_len) ? x[j+1] : 0.0f;
+		}
+	}
+	PROFILE_LAP(PROFILE_PERMUTE, t, sizeof(float) * 2 * nn);
+	fft_butterflies_f(plan, RE, IM);
+	PROFILE_LAP(PROFILE_FFT, t, sizeof(float) * 4 * nn);
+
+	re[0] = RE[0] + IM[0];
+	im[0] = 0.0f;
+	re[nn] = RE[0] - IM[0];
+	im[nn] = 0.0f;
+	for (k = 1; k <= nn / 2; k++) {
+		j = nn - k;
+		wr = plan->twr[k];
+		wi = plan->twi[k];
+		h1r = 0.5f * (RE[k] + RE[j]);
+		h1i = 0.5f * (IM[k] - IM[j]);
+		h2r = 0.5f * (IM[k] + IM[j]);
+		h2i = -0.5f * (RE[k] - RE[j]);
+		re[k] = h1r + wr * h2r - wi * h2i;
+		im[k] = h1i + wr * h2i + wi * h2r;
+		re[j] = h1r - wr * h2r + wi * h2i;
+		im[j] = -h1i + wr * h2i + wi * h2r;
+	}
+	PROFILE_END(PROFILE_RFFT_POST, t, sizeof(float) * 4 * nn);
+}
+
+/**
+ * Single-precision rfft_inverse(). The result must be multiplied by 2/n.
+ */
+void rfft_inverse_f(FFTPlanF *plan, float *re, float *im, float *y) {
+	int nn = plan->nn, i, j, k;
+	float *RE = plan->RE, *IM = plan->IM;
+	float h1r, h1i, h2r, h2i, wr, wi;
+	PROFILE_BEGIN(t);
+
+	RE[0] = 0.5f * (re[0] + re[nn]);
+	IM[0] = 0.5f * (re[0] - re[nn]);
+	for (k = 1; k <= nn / 2; k++) {
+		j = nn - k;
+		wr = plan->twr[k];
+		wi = -plan->twi[k];
+		h1r = 0.5f * (re[k] + re[j]);
+		h1i = 0.5f * (im[k] - im[j]);
+		h2r = -0.5f * (im[k] + im[j]);
+		h2i = 0.5f * (re[k] - re[j]);
+		RE[plan->irev[k]] = h1r + wr * h2r - wi * h2i;
+		IM[plan->irev[k]] = h1i + wr * h2i + wi * h2r;
+		RE[plan->irev[j]] = h1r - wr * h2r + wi * h2i;
+		IM[plan->irev[j]] = -h1i + wr * h2i + wi * h2r;
+	}
+	PROFILE_LAP(PROFILE_RFFT_PRE, t, sizeof(float) * 4 * nn);
+	fft_butterflies_f(plan, IM, RE);
+	PROFILE_LAP(PROFILE_FFT, t, sizeof(float) * 4 * nn);
+
+	for (i = 0; i < nn; i++) {
+		y[i*2] = RE[i];
+		y[i*2+1] = IM[i];
+	}
+	PROFILE_END(PROFILE_PERMUTE, t, sizeof(float) * 2 * nn);
+}
@@ -0,0 +1,235 @@
+/**
+ * libconvolve: the engines of the convolve command behind the Convolver
+ * context declared in libconvolve.h.
+ *
+ * This file is the library's single translation unit: it pulls in the FFT,
+ * spectrum kernel, spectrum cache & engine sources, none of which keep any
+ * per-convolution state in globals. convolve.h includes it too, so the
+ * command line tool & the library share one implementation.
+ *
+ * Every engine is driven in blocks. The overlap-add & uniformly-partitioned
+ * engines consume a fixed block of input at a time, so their input is
+ * buffered until a block is full, and its output is played out over the
+ * next block; their latency is one block. The non-uniform engine accepts
+ * any number of frames itself, with a latency of its smallest partition.
+ * A Convolver's block buffers are carved from one aligned arena.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libconvolve.h"
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#include "profile.c"
+#include "arena.c"
+#include "simd.c"
+#include "direct.c"
+#include "fft.c"
+#include "fft_float.c"
+#include "spectrum_cache.c"
+#include "partitioned.c"
+#include "overlap_add.c"
+
+struct Convolver {
+	ChannelRouting routing;
+	int engine;
+	int h_len;
+	int block_len;			// Frames per engine block
+	int latency;
+	int fill;				// Frames buffered towards the next block
+	double *IN[MAX_CHANNELS];	// block_len frames buffered per input channel
+	double *OUT[MAX_CHANNELS];	// block_len frames pending per output channel
+	double *TMP;			// block_len route output
+	double *ZEROS;			// block_len zeros, fed in by convolver_flush()
+	Arena arena;			// Holds IN, OUT, TMP & ZEROS
+	OLAConvolver *ola;
+	PartitionedConvolver *upols[MAX_CHANNELS];	// One per route
+	NonUniformConvolver *nupols[MAX_CHANNELS];	// One per route
+};
+
+void convolver_destroy(Convolver *cv) {
+	if (cv == NULL)
+		return;
+	for (int t = 0; t < cv->routing.num_routes; t++) {
+		partitioned_destroy(cv->upols[t]);
+		nonuniform_destroy(cv->nupols[t]);
+	}
+	ola_destroy(cv->ola);
+	arena_destroy(&cv->arena);
+	free(cv);
+}
+
+Convolver * convolver_create(double **h, int h_len, int ir_channels,
+							 int in_channels, int engine, int block_len) {
+	ChannelRouting r;
+	if (h_len < 1 || block_len < 0 || (block_len & (block_len - 1)) != 0 ||
+		(engine == CONVOLVER_NUPOLS && block_len > NUPOLS_MAX_BLOCK_LEN) ||
+		engine < CONVOLVER_OLA || engine > CONVOLVER_NUPOLS ||
+		channel_routing(in_channels, ir_channels, &r) == FALSE)
+		return NULL;
+
+	Convolver *cv = calloc(1, sizeof(Convolver));
+	if (cv == NULL) {
+		printf("malloc failed while creating convolver!\n");
+		return NULL;
+	}
+	cv->routing = r;
+	cv->engine = engine;
+	cv->h_len = h_len;
+
+	int t, c, ok = TRUE;
+	if (engine == CONVOLVER_OLA) {
+		cv->ola = ola_create(h, h_len, &r);
+		ok = (cv->ola != NULL);
+		if (ok)
+			cv->block_len = cv->ola->segment_len;
+	}
+	else if (engine == CONVOLVER_UPOLS) {
+		cv->block_len = (block_len != 0) ? block_len : DEFAULT_PARTITION_LEN;
+		for (t = 0; ok && t < r.num_routes; t++) {
+			cv->upols[t] = partitioned_create(h[r.route_ir[t]], h_len, cv->block_len);
+			ok = (cv->upols[t] != NULL);
+		}
+	}
+	else {
+		cv->block_len = (block_len != 0) ? block_len : DEFAULT_NUPOLS_BLOCK_LEN;
+		for (t = 0; ok && t < r.num_routes; t++) {
+			cv->nupols[t] = nonuniform_create(h[r.route_ir[t]], h_len, cv->block_len);
+			ok = (cv->nupols[t] != NULL);
+		}
+	}
+	cv->latency = cv->block_len;
+
+	int B = cv->block_len;
+	if (ok)
+		ok = arena_reserve(&cv->arena, (r.in_channels + r.out_channels + 2) *
+								   arena_round(sizeof(double) * B));
+	for (c = 0; ok && c < r.in_channels; c++)
+		ok = (cv->IN[c] = (double *)arena_calloc(&cv->arena, B, sizeof(double))) != NULL;
+	for (c = 0; ok && c < r.out_channels; c++)
+		ok = (cv->OUT[c] = (double *)arena_calloc(&cv->arena, B, sizeof(double))) != NULL;
+	if (ok) {
+		cv->TMP = (double *)arena_alloc(&cv->arena, sizeof(double) * B);
+		cv->ZEROS = (double *)arena_calloc(&cv->arena, B, sizeof(double));
+		ok = (cv->TMP != NULL && cv->ZEROS != NULL);
+	}
+	if (!ok) {
+		printf("malloc failed while creating convolver!\n");
+		convolver_destroy(cv);
+		return NULL;
+	}
+	return cv;
+}
+
+/**
+ * Convolve the full block of input in IN, leaving the matching block of
+ * output in OUT (overlap-add & uniformly-partitioned engines).
+ */
+void convolver_run_block(Convolver *cv) {
+	ChannelRouting *r = &cv->routing;
+	int B = cv->block_len, j;
+
+	if (cv->engine == CONVOLVER_OLA) {
+		ola_process(cv->ola, cv->IN, B, cv->OUT, B);
+		return;
+	}
+	for (int o = 0; o < r->out_channels; o++)
+		memset(cv->OUT[o], 0, sizeof(double) * B);
+	for (int t = 0; t < r->num_routes; t++) {
+		double *out = cv->OUT[r->route_out[t]];
+		partitioned_process(cv->upols[t], cv->IN[r->route_in[t]], cv->TMP);
+		for (j = 0; j < B; j++)
+			out[j] += cv->TMP[j];
+	}
+}
+
+void convolver_process(Convolver *cv, double **in, double **out, int frames) {
+	ChannelRouting *r = &cv->routing;
+	int c, o, j, n;
+
+	for (int done = 0; done < frames; done += n) {
+		n = cv->block_len - cv->fill;
+		if (n > frames - done)
+			n = frames - done;
+
+		// The non-uniform engine buffers internally; sum its routes:
+		if (cv->engine == CONVOLVER_NUPOLS) {
+			for (o = 0; o < r->out_channels; o++)
+				memset(cv->OUT[o], 0, sizeof(double) * n);
+			for (int t = 0; t < r->num_routes; t++) {
+				double *acc = cv->OUT[r->route_out[t]];
+				nonuniform_process(cv->nupols[t], in[r->route_in[t]] + done,
+								   cv->TMP, n);
+				for (j = 0; j < n; j++)
+					acc[j] += cv->TMP[j];
+			}
+			for (o = 0; o < r->out_channels; o++)
+				memcpy(out[o] + done, cv->OUT[o], sizeof(double) * n);
+			continue;
+		}
+
+		// Take in the next input & play out the last block's output. All
+		// input is copied first, in case in & out alias:
+		for (c = 0; c < r->in_channels; c++)
+			memcpy(cv->IN[c] + cv->fill, in[c] + done, sizeof(double) * n);
+		for (o = 0; o < r->out_channels; o++)
+			memcpy(out[o] + done, cv->OUT[o] + cv->fill, sizeof(double) * n);
+		cv->fill += n;
+		if (cv->fill == cv->block_len) {
+			convolver_run_block(cv);
+			cv->fill = 0;
+		}
+	}
+}
+
+void convolver_flush(Convolver *cv, double **out) {
+	ChannelRouting *r = &cv->routing;
+	double *zeros[MAX_CHANNELS], *dst[MAX_CHANNELS];
+	int c, o, n, tail = convolver_tail_len(cv);
+
+	// Feed in silence until the tail has been played out:
+	for (c = 0; c < r->in_channels; c++)
+		zeros[c] = cv->ZEROS;
+	for (int done = 0; done < tail; done += n) {
+		n = (tail - done < cv->block_len) ? tail - done : cv->block_len;
+		for (o = 0; o < r->out_channels; o++)
+			dst[o] = out[o] + done;
+		convolver_process(cv, zeros, dst, n);
+	}
+
+	// Reset:
+	for (c = 0; c < r->in_channels; c++)
+		memset(cv->IN[c], 0, sizeof(double) * cv->block_len);
+	for (o = 0; o < r->out_channels; o++)
+		memset(cv->OUT[o], 0, sizeof(double) * cv->block_len);
+	cv->fill = 0;
+	if (cv->ola != NULL)
+		ola_reset(cv->ola);
+	for (int t = 0; t < r->num_routes; t++) {
+		if (cv->upols[t] != NULL)
+			partitioned_reset(cv->upols[t]);
+		if (cv->nupols[t] != NULL)
+			nonuniform_reset(cv->nupols[t]);
+	}
+}
+
+int convolver_out_channels(Convolver *cv) {
+	return cv->routing.out_channels;
+}
+
+int convolver_latency(Convolver *cv) {
+	return cv->latency;
+}
+
+int convolver_tail_len(Convolver *cv) {
+	return cv->latency + cv->h_len - 1;
+}
+
+void convolver_set_cache_dir(char *dir) {
+	spectrum_cache_dir = dir;
+}
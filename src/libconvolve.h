@@ -0,0 +1,87 @@
+/**
+ * libconvolve: FFT convolution with an explicit convolver context.
+ *
+ * A Convolver owns an impulse response's spectra, its FFT plans and all of
+ * its scratch buffers; nothing is shared between convolvers, so any number
+ * of them may run concurrently on different threads. Samples are passed
+ * as one array per channel.
+ *
+ * Build the static & shared libraries with:
+ *     gcc -O2 -c -fPIC libconvolve.c -o libconvolve.o
+ *     ar rcs libconvolve.a libconvolve.o
+ *     gcc -O2 -shared -fPIC -fvisibility=hidden libconvolve.c \
+ *         -lpthread -lm -o libconvolve.so
+ *
+ * and link against them with -lconvolve -lpthread -lm.
+ */
+
+#ifndef LIBCONVOLVE_H
+#define LIBCONVOLVE_H
+
+#define CONVOLVE_API __attribute__((visibility("default")))
+
+// Engines (see convolve.c):
+#define CONVOLVER_OLA 0		// Single-partition overlap-add
+#define CONVOLVER_UPOLS 1	// Uniformly-partitioned overlap-save
+#define CONVOLVER_NUPOLS 2	// Non-uniformly partitioned, low latency
+
+typedef struct Convolver Convolver;
+
+/**
+ * Create a convolver for the impulse response channels h[0]-h[ir_channels-1]
+ * of h_len samples each, fed by in_channels input channels. Channels are
+ * routed as by the convolve command: a mono impulse response is applied to
+ * every input channel, a mono input feeds every impulse response channel,
+ * matching counts are paired up, and a stereo input with a 4-channel
+ * impulse response is convolved in true stereo.
+ *
+ * block_len is the partition length for CONVOLVER_UPOLS & CONVOLVER_NUPOLS
+ * (a power of 2, or 0 for the default), and is ignored by CONVOLVER_OLA.
+ * Returns NULL for unsupported arguments or if any allocation fails.
+ */
+CONVOLVE_API Convolver * convolver_create(double **h, int h_len, int ir_channels,
+										  int in_channels, int engine, int block_len);
+
+/**
+ * Convolve frames frames from each input channel in[] and write frames
+ * frames to each output channel out[]. Output lags input by
+ * convolver_latency() frames. Never allocates.
+ */
+CONVOLVE_API void convolver_process(Convolver *cv, double **in, double **out, int frames);
+
+/**
+ * Write the convolver_tail_len() frames still pending after the last input
+ * to each output channel out[], and reset the convolver for a new input.
+ */
+CONVOLVE_API void convolver_flush(Convolver *cv, double **out);
+
+/**
+ * Free a convolver and everything it owns.
+ */
+CONVOLVE_API void convolver_destroy(Convolver *cv);
+
+/**
+ * Return the number of output channels.
+ */
+CONVOLVE_API int convolver_out_channels(Convolver *cv);
+
+/**
+ * Return the number of frames by which output lags input.
+ */
+CONVOLVE_API int convolver_latency(Convolver *cv);
+
+/**
+ * Return the number of frames convolver_flush() writes: the latency plus
+ * the impulse response's length, less one.
+ */
+CONVOLVE_API int convolver_tail_len(Convolver *cv);
+
+/**
+ * Cache impulse response spectra in dir (NULL to disable), so that
+ * convolvers created later for the same impulse response & settings, in
+ * this or any other process, skip its transform. Not thread-safe; call it
+ * before creating convolvers.
+ */
+CONVOLVE_API void convolver_set_cache_dir(char *dir);
+
+#endif
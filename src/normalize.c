@@ -0,0 +1,189 @@
+/**
+ * Peak normalization for streamed output.
+ *
+ * The in-memory path normalizes Y[] once the whole convolution is done,
+ * scaling it as it is encoded (write_wav_normalized()), but a streamed
+ * render never holds its whole output. Two ways around that:
+ *
+ *   - NORMALIZE_TWO_PASS: the first pass spools unnormalized float samples
+ *     to a memory-mapped temporary file while tracking the peak; the second
+ *     pass rescales the spool in large blocks and encodes it. The spool
+ *     lives in the page cache, not the heap, so the kernel can write it back
+ *     & evict it under memory pressure.
+ *   - NORMALIZE_BOUND: a single pass, scaled by an analytic bound on the
+ *     peak. Input samples lie in [-1.0, 1.0], so no output sample can
+ *     exceed the sum of the absolute impulse response samples feeding its
+ *     channel. The bound is never below the true peak, so the output is
+ *     never clipped, but it is usually quieter than a two-pass render.
+ *
+ * NORMALIZE_NONE writes unnormalized float samples, as before; the others
+ * are encoded in output_format (see encode.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define NORMALIZE_NONE 0
+#define NORMALIZE_TWO_PASS 1
+#define NORMALIZE_BOUND 2
+
+// Frames rescaled & encoded at a time by the second pass:
+#define NORMALIZE_BLOCK_FRAMES 65536
+
+/**
+ * A memory-mapped temporary file of interleaved float samples. The file is
+ * unlinked as soon as it is created, so it disappears with the process.
+ */
+typedef struct SampleSpool {
+	float *data;
+	int channels;
+	sf_count_t frames;		// Capacity
+	sf_count_t written;
+} SampleSpool;
+
+/**
+ * Free a SampleSpool & its temporary file.
+ */
+void spool_destroy(SampleSpool *sp) {
+	if (sp == NULL)
+		return;
+	if (sp->data != NULL)
+		munmap(sp->data, sizeof(float) * sp->frames * sp->channels);
+	free(sp);
+}
+
+/**
+ * Create a spool for frames frames of num_channels channels, in $TMPDIR
+ * (or /tmp). Returns NULL on failure.
+ */
+SampleSpool * spool_create(sf_count_t frames, int num_channels) {
+	char path[1024];
+	char *dir = getenv("TMPDIR");
+	snprintf(path, sizeof(path), "%s/convolve.XXXXXX",
+			 (dir != NULL && dir[0] != '\0') ? dir : "/tmp");
+
+	SampleSpool *sp = (SampleSpool *)calloc(1, sizeof(SampleSpool));
+	if (sp == NULL)
+		return NULL;
+	sp->channels = num_channels;
+	sp->frames = frames;
+	if (frames <= 0)
+		return sp;
+
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		printf("Failed to create a temporary file in %s!\n", path);
+		free(sp);
+		return NULL;
+	}
+	unlink(path);
+
+	size_t bytes = sizeof(float) * frames * num_channels;
+	if (ftruncate(fd, bytes) == 0) {
+		sp->data = (float *)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+								 MAP_SHARED, fd, 0);
+		if (sp->data == MAP_FAILED)
+			sp->data = NULL;
+	}
+	close(fd);
+	if (sp->data == NULL) {
+		printf("Failed to map a temporary file of %zu bytes!\n", bytes);
+		free(sp);
+		return NULL;
+	}
+
+	// Both passes run front to back:
+	madvise(sp->data, bytes, MADV_SEQUENTIAL);
+	return sp;
+}
+
+/**
+ * Append frames frames of interleaved samples to the spool. Returns the
+ * number of frames written, which is short only if the spool is full.
+ */
+sf_count_t spool_write(SampleSpool *sp, double *data, sf_count_t frames) {
+	if (frames > sp->frames - sp->written)
+		frames = sp->frames - sp->written;
+
+	float *dst = sp->data + sp->written * sp->channels;
+	sf_count_t len = frames * sp->channels;
+	for (sf_count_t j = 0; j < len; j++)
+		dst[j] = (float)data[j];
+	sp->written += frames;
+	return frames;
+}
+
+/**
+ * Second pass: multiply every spooled sample by scale & encode it with e,
+ * NORMALIZE_BLOCK_FRAMES frames at a time, through a block carved out of
+ * arena. Returns the number of frames encoded, or -1 on failure.
+ */
+sf_count_t spool_drain(SampleSpool *sp, Arena *arena, WavEncoder *e, double scale) {
+	size_t mark = arena_mark(arena);
+	double *block = (double *)arena_alloc(arena, sizeof(double) * NORMALIZE_BLOCK_FRAMES * sp->channels);
+	if (block == NULL) {
+		printf("malloc failed while initializing arrays!\n");
+		return -1;
+	}
+
+	sf_count_t frames, done = 0;
+	for (sf_count_t f = 0; f < sp->written; f += frames) {
+		frames = sp->written - f;
+		if (frames > NORMALIZE_BLOCK_FRAMES)
+			frames = NORMALIZE_BLOCK_FRAMES;
+
+		float *src = sp->data + f * sp->channels;
+		sf_count_t len = frames * sp->channels;
+		PROFILE_BEGIN(t);
+		for (sf_count_t j = 0; j < len; j++)
+			block[j] = src[j];
+		PROFILE_END(PROFILE_NORMALIZE, t, (sizeof(float) + sizeof(double)) * len);
+		done += encoder_write(e, block, frames, scale);
+	}
+	arena_release(arena, mark);
+	return done;
+}
+
+/**
+ * Scale the num_samples interleaved samples in sample_data by scale in
+ * place, encoding them in output_format (see encode.c) & writing them to a
+ * new .wav file at samplerate Hz as it goes. Fusing the two keeps each
+ * block in cache between them, so Y[] is only swept once. Returns the
+ * number of samples written, or -1 on failure.
+ */
+sf_count_t write_wav_normalized(char * filename, double * sample_data, int num_samples,
+								int num_channels, int samplerate, double scale,
+								int verbose) {
+	WavEncoder *e = encoder_create(filename, num_channels, samplerate,
+								   output_format, output_dither);
+	if (e == NULL)
+		return -1;
+	encoder_write(e, sample_data, num_samples / num_channels, scale);
+	sf_count_t written = encoder_close(e);
+	if (written >= 0)
+		written *= num_channels;
+	if (verbose == TRUE)
+		printf("Created new .wav file with %lld samples.\n", (long long)written);
+	return written;
+}
+
+/**
+ * Return an upper bound on the absolute value of any output sample when the
+ * input lies in [-1.0, 1.0]: the largest, over output channels, sum of the
+ * absolute impulse response samples routed to that channel.
+ */
+double peak_bound(double **h, int h_len, ChannelRouting *r) {
+	double sums[MAX_CHANNELS] = {0.0}, bound = 0.0;
+	int o, t, j;
+	for (t = 0; t < r->num_routes; t++)
+		for (j = 0; j < h_len; j++)
+			sums[r->route_out[t]] += fabs(h[r->route_ir[t]][j]);
+	for (o = 0; o < r->out_channels; o++)
+		if (sums[o] > bound)
+			bound = sums[o];
+	return bound;
+}
@@ -0,0 +1,329 @@
+/**
+ * Multichannel overlap-add (OLA) convolution engine with a block interface.
+ *
+ * An OLAConvolver holds the frequency responses of every impulse response
+ * channel, and convolves one segment of segment_len frames per call to
+ * ola_process(), carrying the overlap between calls. Each segment of each
+ * input channel is transformed once, however many impulse response
+ * channels it feeds, and the products destined for each output channel are
+ * summed in the frequency domain so that each output channel needs a
+ * single inverse transform. A true-stereo render therefore costs two
+ * forward & two inverse transforms per segment, like two mono renders,
+ * plus two extra spectrum multiplies.
+ *
+ * Its memory use depends only on the impulse response, so it can convolve
+ * a whole file in memory or stream one block at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+// Most channels supported in an input or impulse response file:
+#define MAX_CHANNELS 16
+
+/**
+ * How the channels of the input feed the channels of the impulse response
+ * & output: route r convolves input channel route_in[r] with impulse
+ * response channel route_ir[r], and adds the result to output channel
+ * route_out[r].
+ */
+typedef struct ChannelRouting {
+	int in_channels, ir_channels, out_channels;
+	int num_routes;
+	int route_in[MAX_CHANNELS], route_ir[MAX_CHANNELS], route_out[MAX_CHANNELS];
+} ChannelRouting;
+
+/**
+ * Add a route to a ChannelRouting.
+ */
+void add_route(ChannelRouting *r, int in, int ir, int out) {
+	r->route_in[r->num_routes] = in;
+	r->route_ir[r->num_routes] = ir;
+	r->route_out[r->num_routes++] = out;
+}
+
+/**
+ * Work out the routing for an input with in_channels channels and an
+ * impulse response with ir_channels channels:
+ *     - a mono impulse response is applied to every input channel;
+ *     - a mono input feeds every impulse response channel, giving one
+ *       output channel each (e.g. mono-to-stereo);
+ *     - an input & impulse response with the same number of channels are
+ *       paired up channel by channel (e.g. stereo-to-stereo);
+ *     - a stereo input & 4-channel impulse response are convolved in true
+ *       stereo, the impulse response channels holding the L->L, L->R, R->L
+ *       & R->R responses.
+ * Returns FALSE for any other combination.
+ */
+int channel_routing(int in_channels, int ir_channels, ChannelRouting *r) {
+	r->in_channels = in_channels;
+	r->ir_channels = ir_channels;
+	r->num_routes = 0;
+	if (in_channels < 1 || ir_channels < 1 ||
+		in_channels > MAX_CHANNELS || ir_channels > MAX_CHANNELS)
+		return FALSE;
+	
+	if (in_channels == 2 && ir_channels == 4) {
+		r->out_channels = 2;
+		for (int in = 0; in < 2; in++)
+			for (int out = 0; out < 2; out++)
+				add_route(r, in, in * 2 + out, out);
+	}
+	else if (ir_channels == 1) {
+		r->out_channels = in_channels;
+		for (int c = 0; c < in_channels; c++)
+			add_route(r, c, 0, c);
+	}
+	else if (in_channels == 1 || in_channels == ir_channels) {
+		r->out_channels = ir_channels;
+		for (int c = 0; c < ir_channels; c++)
+			add_route(r, (in_channels == 1) ? 0 : c, c, c);
+	}
+	else
+		return FALSE;
+	return TRUE;
+}
+
+typedef struct OLAConvolver {
+	ChannelRouting routing;
+	int fft_len;
+	int segment_len;		// Input frames consumed per segment
+	int spectra_len;		// fft_len / 2 + 1 non-negative frequency bins
+	int olap_len;			// Filter kernel length - 1
+	double *REX, *IMX;		// in_channels * spectra_len segment spectra
+	double *REFR, *IMFR;	// ir_channels * spectra_len frequency responses
+	CachedSpectra *cached;	// Mapping REFR & IMFR point into, if cached
+	int shared;				// TRUE if REFR & IMFR belong to another convolver
+	double *ACCR, *ACCI;	// spectra_len accumulated output spectrum
+	double *XX;				// fft_len inverse transform output
+	double *OLAP;			// out_channels * olap_len pending overlap
+	FFTPlan *plan;
+} OLAConvolver;
+
+/**
+ * Pick the FFT length for overlap-add convolution with an impulse response
+ * of h_len samples: of the lengths fft_plan_create() supports, the one
+ * that minimizes the estimated cost (see fft_cost()) of convolving x_len
+ * samples of input, or the cost per output sample if x_len is 0. Each
+ * segment of n + 1 - h_len samples costs a forward & an inverse transform
+ * plus about a stage's worth of spectrum multiply & overlap-add, so a
+ * power of 2 just above h_len, which leaves only a few samples per
+ * segment, is avoided in favour of a nearby 2^a * 3^b * 5^c * 7^d.
+ */
+int ola_fft_len(int h_len, int x_len) {
+	long limit = 16L * h_len + 64, best = 0;
+	double best_cost = 0.0;
+	if (limit > INT_MAX / 2)
+		limit = INT_MAX / 2;
+
+	for (long p7 = 2; p7 <= limit; p7 *= 7)
+		for (long p5 = p7; p5 <= limit; p5 *= 5)
+			for (long p3 = p5; p3 <= limit; p3 *= 3)
+				for (long n = p3; n <= limit; n *= 2) {
+					if (n < h_len)
+						continue;
+					double segment = (double)(n + 1 - h_len);
+					double cost = 2.0 * fft_cost(n) + n;
+					if (x_len > 0)
+						cost = fft_cost(n) + ceil(x_len / segment) * cost;
+					else
+						cost /= segment;
+					if (best == 0 || cost < best_cost || (cost == best_cost && n < best)) {
+						best = n;
+						best_cost = cost;
+					}
+				}
+	return (int)best;
+}
+
+/**
+ * Release all memory owned by an OLAConvolver.
+ */
+void ola_destroy(OLAConvolver *oc) {
+	if (oc == NULL)
+		return;
+	free(oc->REX);
+	free(oc->IMX);
+	if (oc->cached != NULL)
+		spectra_release(oc->cached);
+	else if (oc->shared == FALSE) {
+		free(oc->REFR);
+		free(oc->IMFR);
+	}
+	free(oc->ACCR);
+	free(oc->ACCI);
+	free(oc->XX);
+	free(oc->OLAP);
+	fft_plan_destroy(oc->plan);
+	free(oc);
+}
+
+/**
+ * Allocate a convolver for an impulse response of h_len samples routed as
+ * described by r, leaving its frequency responses to the caller. Returns
+ * NULL if any allocation fails.
+ */
+OLAConvolver * ola_alloc(int h_len, ChannelRouting *r) {
+	OLAConvolver *oc = calloc(1, sizeof(OLAConvolver));
+	if (oc == NULL) {
+		printf("malloc failed while creating overlap-add convolver!\n");
+		return NULL;
+	}
+	
+	oc->routing = *r;
+	oc->fft_len = ola_fft_len(h_len, 0);
+	oc->segment_len = (oc->fft_len + 1) - h_len;
+	oc->spectra_len = oc->fft_len / 2 + 1;
+	oc->olap_len = h_len - 1;
+	
+	int SL = oc->spectra_len;
+	oc->REX = (double *)aligned_malloc(sizeof(double) * SL * r->in_channels);
+	oc->IMX = (double *)aligned_malloc(sizeof(double) * SL * r->in_channels);
+	oc->ACCR = (double *)aligned_malloc(sizeof(double) * SL);
+	oc->ACCI = (double *)aligned_malloc(sizeof(double) * SL);
+	oc->XX = (double *)aligned_malloc(sizeof(double) * oc->fft_len);
+	oc->OLAP = (double *)aligned_calloc(oc->olap_len * r->out_channels + 1, sizeof(double));
+	oc->plan = fft_plan_create(oc->fft_len);
+	
+	if (oc->REX == NULL || oc->IMX == NULL || oc->ACCR == NULL ||
+		oc->ACCI == NULL || oc->XX == NULL || oc->OLAP == NULL ||
+		oc->plan == NULL) {
+		printf("malloc failed while creating overlap-add convolver!\n");
+		ola_destroy(oc);
+		return NULL;
+	}
+	return oc;
+}
+
+/**
+ * Create a convolver for the impulse response channels h[] (h_len samples
+ * each) routed as described by r. The FFT length is picked by
+ * ola_fft_len() for a stream of unknown length. The frequency
+ * responses are mapped from the spectrum cache when possible. h[] is not
+ * referenced after this returns. Returns NULL if any allocation fails.
+ */
+OLAConvolver * ola_create(double **h, int h_len, ChannelRouting *r) {
+	OLAConvolver *oc = ola_alloc(h_len, r);
+	if (oc == NULL)
+		return NULL;
+	
+	int SL = oc->spectra_len;
+	uint64_t hash = 0;
+	if (spectrum_cache_dir != NULL)
+		for (int c = 0; c < r->ir_channels; c++)
+			hash = spectra_hash(hash, h[c], h_len);
+	oc->cached = spectra_load(hash, oc->fft_len, 0, r->ir_channels, SL);
+	if (oc->cached != NULL) {
+		oc->REFR = oc->cached->REFR;
+		oc->IMFR = oc->cached->IMFR;
+		return oc;
+	}
+	oc->REFR = (double *)aligned_malloc(sizeof(double) * SL * r->ir_channels);
+	oc->IMFR = (double *)aligned_malloc(sizeof(double) * SL * r->ir_channels);
+	if (oc->REFR == NULL || oc->IMFR == NULL) {
+		printf("malloc failed while creating overlap-add convolver!\n");
+		ola_destroy(oc);
+		return NULL;
+	}
+	
+	// Transform every impulse response channel, folding in the 2/fft_len
+	// normalization of the inverse transform:
+	for (int c = 0; c < r->ir_channels; c++) {
+		rfft_forward(oc->plan, h[c], h_len, oc->REFR + c * SL, oc->IMFR + c * SL);
+		for (int j = 0; j < SL; j++) {
+			oc->REFR[c * SL + j] *= 2.0 / oc->fft_len;
+			oc->IMFR[c * SL + j] *= 2.0 / oc->fft_len;
+		}
+	}
+	spectra_store(hash, oc->fft_len, 0, r->ir_channels, SL, oc->REFR, oc->IMFR);
+	
+	return oc;
+}
+
+/**
+ * Create a convolver that shares proto's frequency responses, routed as
+ * described by r, which must use the same impulse response channels. It
+ * has its own buffers & FFT plan, so clones of one convolver can run on
+ * different threads at once. proto must outlive its clones. Returns NULL
+ * if any allocation fails.
+ */
+OLAConvolver * ola_clone(OLAConvolver *proto, ChannelRouting *r) {
+	OLAConvolver *oc = ola_alloc(proto->olap_len + 1, r);
+	if (oc == NULL)
+		return NULL;
+	oc->REFR = proto->REFR;
+	oc->IMFR = proto->IMFR;
+	oc->shared = TRUE;
+	return oc;
+}
+
+/**
+ * Convolve the next segment: in_len (at most segment_len) frames from each
+ * input channel in[] (zero-padded if short, e.g. at the end of the input).
+ * The segment's first out_len (at most segment_len) output frames, with the
+ * previous segments' overlap added, are written to each output channel
+ * out[]; any others are dropped.
+ */
+void ola_process(OLAConvolver *oc, double **in, int in_len, double **out, int out_len) {
+	ChannelRouting *r = &oc->routing;
+	FFTPlan *plan = oc->plan;
+	int SL = oc->spectra_len, S = oc->segment_len, j;
+	
+	// Transform this segment of every input channel:
+	for (int c = 0; c < r->in_channels; c++)
+		rfft_forward(plan, in[c], in_len, oc->REX + c * SL, oc->IMX + c * SL);
+	
+	for (int o = 0; o < r->out_channels; o++) {
+		// Sum the products of every route into this output channel:
+		PROFILE_BEGIN(pt);
+		int first = TRUE;
+		for (int t = 0; t < r->num_routes; t++) {
+			if (r->route_out[t] != o)
+				continue;
+			int in_ch = r->route_in[t], ir = r->route_ir[t];
+			if (first)
+				plan->spectrum_mul(oc->ACCR, oc->ACCI, oc->REX + in_ch * SL,
+								   oc->IMX + in_ch * SL, oc->REFR + ir * SL,
+								   oc->IMFR + ir * SL, SL);
+			else
+				plan->spectrum_mac(oc->ACCR, oc->ACCI, oc->REX + in_ch * SL,
+								   oc->IMX + in_ch * SL, oc->REFR + ir * SL,
+								   oc->IMFR + ir * SL, SL);
+			first = FALSE;
+			PROFILE_LAP(PROFILE_SPECTRUM, pt, sizeof(double) * 8 * SL);
+		}
+		rfft_inverse(plan, oc->ACCR, oc->ACCI, oc->XX);
+		
+		// Add the last segment's overlap, then save this segment's:
+		PROFILE_BEGIN(po);
+		double *olap = oc->OLAP + o * oc->olap_len;
+		for (j = 0; j < oc->olap_len; j++)
+			oc->XX[j] += olap[j];
+		for (j = S; j < oc->fft_len; j++)
+			olap[j-S] = oc->XX[j];
+		memcpy(out[o], oc->XX, sizeof(double) * out_len);
+		PROFILE_END(PROFILE_OVERLAP_ADD, po,
+					sizeof(double) * (5 * oc->olap_len + 2 * out_len));
+	}
+}
+
+/**
+ * Forget the pending overlap, as if the convolver had just been created.
+ */
+void ola_reset(OLAConvolver *oc) {
+	memset(oc->OLAP, 0, sizeof(double) * oc->olap_len * oc->routing.out_channels);
+}
+
+/**
+ * Write the first out_len (at most olap_len) frames of the overlap still
+ * pending after the last segment to each output channel out[], and reset
+ * the convolver for a new input.
+ */
+void ola_flush(OLAConvolver *oc, double **out, int out_len) {
+	for (int o = 0; o < oc->routing.out_channels; o++)
+		memcpy(out[o], oc->OLAP + o * oc->olap_len, sizeof(double) * out_len);
+	ola_reset(oc);
+}
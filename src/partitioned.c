@@ -0,0 +1,467 @@
+/**
+ * Uniformly-partitioned overlap-save (UPOLS) convolution engine.
+ *
+ * The filter kernel is split into num_parts blocks of block_len samples,
+ * and the spectrum of each block (zero-padded to fft_len = 2 * block_len)
+ * is computed once. Every block of input is transformed exactly once and
+ * pushed onto a frequency-domain delay line (FDL) holding the spectra of
+ * the last num_parts input blocks. The output spectrum for a block is the
+ * sum of the complex products of each FDL entry with its matching filter
+ * partition; a single inverse FFT then yields 2 * block_len samples, the
+ * second half of which are the valid (overlap-save) output samples.
+ *
+ * Unlike the single-partition overlap-add engine, the FFT size depends only
+ * on block_len, never on the length of the impulse response, so multi-second
+ * impulse responses run with small, cache-resident transforms.
+ *
+ * A NonUniformConvolver chains several of these engines together for
+ * low-latency, real-time use: small partitions cover the head of the
+ * impulse response and progressively larger ones cover the tail.
+ *
+ * Sources:
+ *   - Wefers, "Partitioned convolution algorithms for real-time auralization",
+ *     ch. 5 (uniformly-partitioned convolution) & ch. 6 (non-uniform).
+ *   - Gardner, "Efficient convolution without input-output delay",
+ *     JAES 43(3), 1995.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_PARTITION_LEN 2048
+
+// Non-uniform partitioning: each stage uses NUPOLS_STAGE_PARTS partitions
+// NUPOLS_GROWTH times longer than the previous stage's, up to a block length
+// of NUPOLS_MAX_BLOCK_LEN, which then covers the rest of the IR uniformly.
+#define DEFAULT_NUPOLS_BLOCK_LEN 64
+#define NUPOLS_MAX_BLOCK_LEN 16384
+#define NUPOLS_GROWTH 4
+#define NUPOLS_STAGE_PARTS 4
+#define NUPOLS_MAX_STAGES 16
+
+typedef struct PartitionedConvolver {
+	int block_len;			// Samples consumed & produced per call
+	int fft_len;			// 2 * block_len
+	int spectra_len;		// fft_len / 2 + 1 non-negative frequency bins
+	int num_parts;			// Number of filter kernel partitions
+	int fdl_idx;			// FDL slot holding the newest input spectrum
+	double *REFR, *IMFR;	// num_parts * spectra_len partition spectra
+	CachedSpectra *cached;	// Mapping REFR & IMFR point into, if cached
+	double *FDLR, *FDLI;	// num_parts * spectra_len input spectra (FDL)
+	double *ACCR, *ACCI;	// spectra_len accumulated output spectrum
+	double *XX;				// fft_len inverse transform output
+	double *IN;				// fft_len sliding input window
+	FFTPlan *plan;			// Plan for fft_len point transforms
+} PartitionedConvolver;
+
+/**
+ * Release all memory owned by a PartitionedConvolver.
+ */
+void partitioned_destroy(PartitionedConvolver *pc) {
+	if (pc == NULL)
+		return;
+	if (pc->cached != NULL)
+		spectra_release(pc->cached);
+	else {
+		free(pc->REFR);
+		free(pc->IMFR);
+	}
+	free(pc->FDLR);
+	free(pc->FDLI);
+	free(pc->ACCR);
+	free(pc->ACCI);
+	free(pc->XX);
+	free(pc->IN);
+	fft_plan_destroy(pc->plan);
+	free(pc);
+}
+
+/**
+ * Split the filter kernel h[0]-h[h_len-1] into partitions of block_len
+ * samples (block_len must be a power of 2) and precompute their spectra,
+ * or map them from the spectrum cache. Returns NULL if any allocation fails.
+ */
+PartitionedConvolver * partitioned_create(double *h, int h_len, int block_len) {
+	PartitionedConvolver *pc = calloc(1, sizeof(PartitionedConvolver));
+	if (pc == NULL) {
+		printf("malloc failed while creating partitioned convolver!\n");
+		return NULL;
+	}
+
+	pc->block_len = block_len;
+	pc->fft_len = block_len * 2;
+	pc->spectra_len = block_len + 1;
+	pc->num_parts = (h_len + block_len - 1) / block_len;
+	if (pc->num_parts < 1)
+		pc->num_parts = 1;
+	pc->fdl_idx = 0;
+
+	int spectra_size = pc->num_parts * pc->spectra_len;
+	uint64_t hash = (spectrum_cache_dir == NULL) ? 0 : spectra_hash(0, h, h_len);
+	pc->cached = spectra_load(hash, pc->fft_len, block_len,
+							  pc->num_parts, pc->spectra_len);
+	if (pc->cached != NULL) {
+		pc->REFR = pc->cached->REFR;
+		pc->IMFR = pc->cached->IMFR;
+	}
+	else {
+		pc->REFR = (double *)aligned_malloc(sizeof(double) * spectra_size);
+		pc->IMFR = (double *)aligned_malloc(sizeof(double) * spectra_size);
+	}
+	pc->FDLR = (double *)aligned_calloc(spectra_size, sizeof(double));
+	pc->FDLI = (double *)aligned_calloc(spectra_size, sizeof(double));
+	pc->ACCR = (double *)aligned_malloc(sizeof(double) * pc->spectra_len);
+	pc->ACCI = (double *)aligned_malloc(sizeof(double) * pc->spectra_len);
+	pc->XX = (double *)aligned_malloc(sizeof(double) * pc->fft_len);
+	pc->IN = (double *)aligned_calloc(pc->fft_len, sizeof(double));
+	pc->plan = fft_plan_create(pc->fft_len);
+
+	if (pc->REFR == NULL || pc->IMFR == NULL || pc->FDLR == NULL ||
+		pc->FDLI == NULL || pc->ACCR == NULL || pc->ACCI == NULL ||
+		pc->XX == NULL || pc->IN == NULL || pc->plan == NULL) {
+		printf("malloc failed while creating partitioned convolver!\n");
+		partitioned_destroy(pc);
+		return NULL;
+	}
+	if (pc->cached != NULL)
+		return pc;
+
+	// Transform each partition, zero-padded to fft_len. The 2/fft_len
+	// normalization of the inverse transform is folded in here:
+	double scale = 2.0 / pc->fft_len;
+	for (int p = 0; p < pc->num_parts; p++) {
+		int offset = p * block_len;
+		int len = (h_len - offset < block_len) ? h_len - offset : block_len;
+		double *re = pc->REFR + p * pc->spectra_len;
+		double *im = pc->IMFR + p * pc->spectra_len;
+		rfft_forward(pc->plan, h + offset, (len > 0) ? len : 0, re, im);
+		for (int j = 0; j < pc->spectra_len; j++) {
+			re[j] *= scale;
+			im[j] *= scale;
+		}
+	}
+	spectra_store(hash, pc->fft_len, block_len, pc->num_parts,
+				  pc->spectra_len, pc->REFR, pc->IMFR);
+
+	return pc;
+}
+
+/**
+ * Slide the input window along by one block, taking block_len samples from
+ * in[]. The block is then convolved by partitioned_run(), one or more of
+ * its partitioned_num_steps() steps at a time.
+ */
+void partitioned_load(PartitionedConvolver *pc, double *in) {
+	int B = pc->block_len;
+	memmove(pc->IN, pc->IN + B, sizeof(double) * B);
+	memcpy(pc->IN + B, in, sizeof(double) * B);
+
+	// The FDL is a ring buffer; step back one slot so that the newest
+	// spectrum overwrites the oldest:
+	pc->fdl_idx = (pc->fdl_idx == 0) ? pc->num_parts - 1 : pc->fdl_idx - 1;
+}
+
+/**
+ * Return the number of steps convolving a block takes. Each is O(fft_len):
+ * the forward transform's gather, butterfly passes & untangling, one
+ * spectrum product per partition, then the inverse transform's fold,
+ * butterfly passes & scatter.
+ */
+int partitioned_num_steps(PartitionedConvolver *pc) {
+	return 2 * fft_num_passes(pc->plan) + 4 + pc->num_parts;
+}
+
+/**
+ * Run steps [first, last) of the convolution of the block last loaded.
+ * After the final step, its block_len output samples are at XX + block_len.
+ */
+void partitioned_run(PartitionedConvolver *pc, int first, int last) {
+	FFTPlan *plan = pc->plan;
+	int S = pc->spectra_len, passes = fft_num_passes(plan), a, b;
+	
+	// The first step of the spectrum products & of the inverse transform:
+	int mac = passes + 2, inv = mac + pc->num_parts;
+	if (first >= last)
+		return;
+	
+	// Transform the window straight into the FDL:
+	if (first <= 0 && 0 < last)
+		rfft_gather(plan, pc->IN, pc->fft_len);
+	a = (first > 1) ? first - 1 : 0;
+	b = (last - 1 < passes) ? last - 1 : passes;
+	if (a < b) {
+		PROFILE_BEGIN(t);
+		fft_passes(plan, plan->RE, plan->IM, a, b);
+		PROFILE_END(PROFILE_FFT, t, sizeof(double) * 4 * plan->nn * (b - a) / passes);
+	}
+	if (first <= mac - 1 && mac - 1 < last)
+		rfft_untangle(plan, pc->FDLR + pc->fdl_idx * S, pc->FDLI + pc->fdl_idx * S);
+	
+	// Accumulate the product of each input spectrum with its partition.
+	// Partition p pairs with the input spectrum from p blocks ago:
+	a = (first > mac) ? first - mac : 0;
+	b = (last < inv) ? last - mac : pc->num_parts;
+	if (a < b) {
+		PROFILE_BEGIN(t);
+		for (int p = a; p < b; p++) {
+			int slot = pc->fdl_idx + p;
+			if (slot >= pc->num_parts)
+				slot -= pc->num_parts;
+			
+			double *xr = pc->FDLR + slot * S, *xi = pc->FDLI + slot * S;
+			double *hr = pc->REFR + p * S, *hi = pc->IMFR + p * S;
+			if (p == 0)
+				plan->spectrum_mul(pc->ACCR, pc->ACCI, xr, xi, hr, hi, S);
+			else
+				plan->spectrum_mac(pc->ACCR, pc->ACCI, xr, xi, hr, hi, S);
+		}
+		PROFILE_END(PROFILE_SPECTRUM, t, sizeof(double) * 8 * S * (b - a));
+	}
+	
+	// Inverse transform; the first half of XX is circularly aliased and is
+	// discarded, the second half is the valid output:
+	if (first <= inv && inv < last)
+		rfft_fold(plan, pc->ACCR, pc->ACCI);
+	a = (first > inv + 1) ? first - inv - 1 : 0;
+	b = (last - inv - 1 < passes) ? last - inv - 1 : passes;
+	if (a < b) {
+		PROFILE_BEGIN(t);
+		fft_passes(plan, plan->IM, plan->RE, a, b);
+		PROFILE_END(PROFILE_FFT, t, sizeof(double) * 4 * plan->nn * (b - a) / passes);
+	}
+	if (last == inv + passes + 2)
+		rfft_scatter(plan, pc->XX);
+}
+
+/**
+ * Convolve the next block_len input samples in[] with the filter kernel,
+ * writing block_len output samples to out[]. in and out may alias.
+ */
+void partitioned_process(PartitionedConvolver *pc, double *in, double *out) {
+	partitioned_load(pc, in);
+	partitioned_run(pc, 0, partitioned_num_steps(pc));
+	memcpy(out, pc->XX + pc->block_len, sizeof(double) * pc->block_len);
+}
+
+/**
+ * Forget all input, as if the convolver had just been created.
+ */
+void partitioned_reset(PartitionedConvolver *pc) {
+	int spectra_size = pc->num_parts * pc->spectra_len;
+	memset(pc->FDLR, 0, sizeof(double) * spectra_size);
+	memset(pc->FDLI, 0, sizeof(double) * spectra_size);
+	memset(pc->IN, 0, sizeof(double) * pc->fft_len);
+	pc->fdl_idx = 0;
+}
+
+typedef struct NonUniformConvolver {
+	int block_len;			// Smallest partition; also the processing latency
+	int num_stages;
+	PartitionedConvolver *stages[NUPOLS_MAX_STAGES];
+	int offsets[NUPOLS_MAX_STAGES];	// IR offset covered by each stage
+	int windows[NUPOLS_MAX_STAGES];	// Blocks each stage's work is spread over
+	int done[NUPOLS_MAX_STAGES];	// Steps run of each stage's current block
+	long long clock;		// Input samples consumed by completed blocks
+	int fill;				// Samples buffered towards the next block
+	double *IN_BLOCK;		// block_len samples waiting to be processed
+	double *OUT_BLOCK;		// block_len samples waiting to be output
+	double *IN_RING;		// Input history, in_ring_len (power of 2) samples
+	double *OUT_RING;		// Pending output sums, out_ring_len (power of 2)
+	double *STAGE_BUF;		// Scratch for loading the largest stage's block
+	int in_ring_len, out_ring_len;
+} NonUniformConvolver;
+
+/**
+ * Release all memory owned by a NonUniformConvolver.
+ */
+void nonuniform_destroy(NonUniformConvolver *nc) {
+	if (nc == NULL)
+		return;
+	for (int s = 0; s < nc->num_stages; s++)
+		partitioned_destroy(nc->stages[s]);
+	free(nc->IN_BLOCK);
+	free(nc->OUT_BLOCK);
+	free(nc->IN_RING);
+	free(nc->OUT_RING);
+	free(nc->STAGE_BUF);
+	free(nc);
+}
+
+/**
+ * Partition the filter kernel h[0]-h[h_len-1] non-uniformly, starting with
+ * partitions of block_len samples (a power of 2, at most NUPOLS_MAX_BLOCK_LEN).
+ * 
+ * A stage with blocks of L samples finishes a block every L input samples,
+ * and its output is needed block_len samples after the oldest input sample
+ * in that block arrived. Each stage therefore starts at an IR offset of at
+ * least L - block_len, which the growth schedule guarantees since the
+ * preceding stages always cover NUPOLS_STAGE_PARTS of their own blocks.
+ * 
+ * The difference between the two is slack: a stage whose block completes
+ * on one call may add its output as many as (offset + block_len - L) /
+ * block_len calls later. Rather than convolve a block of every due stage
+ * within the one call, which puts all of the largest stage's transforms &
+ * products into a single callback every NUPOLS_MAX_BLOCK_LEN samples, each
+ * stage's steps are spread evenly over the calls of that window (but no
+ * more than its period of L / block_len calls).
+ * Returns NULL if any allocation fails.
+ */
+NonUniformConvolver * nonuniform_create(double *h, int h_len, int block_len) {
+	NonUniformConvolver *nc = calloc(1, sizeof(NonUniformConvolver));
+	if (nc == NULL) {
+		printf("malloc failed while creating non-uniform convolver!\n");
+		return NULL;
+	}
+	nc->block_len = block_len;
+	
+	// Lay out the stages over the IR:
+	int offset = 0, stage_len = block_len, max_stage_len = block_len;
+	while (offset < h_len || nc->num_stages == 0) {
+		int last = (stage_len >= NUPOLS_MAX_BLOCK_LEN ||
+					nc->num_stages == NUPOLS_MAX_STAGES - 1);
+		int seg_len = h_len - offset;
+		if (!last && seg_len > stage_len * NUPOLS_STAGE_PARTS)
+			seg_len = stage_len * NUPOLS_STAGE_PARTS;
+		if (seg_len < 1)
+			seg_len = 1;
+		
+		nc->offsets[nc->num_stages] = offset;
+		nc->stages[nc->num_stages] = partitioned_create(h + offset, seg_len, stage_len);
+		if (nc->stages[nc->num_stages++] == NULL) {
+			nonuniform_destroy(nc);
+			return NULL;
+		}
+		max_stage_len = stage_len;
+		
+		offset += seg_len;
+		if (!last)
+			stage_len = (stage_len * NUPOLS_GROWTH > NUPOLS_MAX_BLOCK_LEN) ?
+						NUPOLS_MAX_BLOCK_LEN : stage_len * NUPOLS_GROWTH;
+	}
+	
+	// The input ring must hold the largest stage's block, and the output
+	// ring must span from the block being output to the furthest sample
+	// the last stage can add to:
+	nc->in_ring_len = max_stage_len;
+	for (int s = 0; s < nc->num_stages; s++) {
+		int L = nc->stages[s]->block_len;
+		nc->windows[s] = (nc->offsets[s] + block_len - L) / block_len + 1;
+		if (nc->windows[s] > L / block_len)
+			nc->windows[s] = L / block_len;
+		nc->done[s] = partitioned_num_steps(nc->stages[s]);
+	}
+	nc->out_ring_len = block_len;
+	while (nc->out_ring_len < nc->offsets[nc->num_stages-1] + block_len)
+		nc->out_ring_len *= 2;
+	
+	nc->IN_BLOCK = (double *)aligned_calloc(block_len, sizeof(double));
+	nc->OUT_BLOCK = (double *)aligned_calloc(block_len, sizeof(double));
+	nc->IN_RING = (double *)aligned_calloc(nc->in_ring_len, sizeof(double));
+	nc->OUT_RING = (double *)aligned_calloc(nc->out_ring_len, sizeof(double));
+	nc->STAGE_BUF = (double *)aligned_malloc(sizeof(double) * max_stage_len);
+	if (nc->IN_BLOCK == NULL || nc->OUT_BLOCK == NULL || nc->IN_RING == NULL ||
+		nc->OUT_RING == NULL || nc->STAGE_BUF == NULL) {
+		printf("malloc failed while creating non-uniform convolver!\n");
+		nonuniform_destroy(nc);
+		return NULL;
+	}
+	
+	return nc;
+}
+
+/**
+ * Process one full block of block_len samples from IN_BLOCK, leaving
+ * the matching block_len output samples in OUT_BLOCK.
+ */
+void nonuniform_process_block(NonUniformConvolver *nc) {
+	int B = nc->block_len, j;
+	int in_mask = nc->in_ring_len - 1, out_mask = nc->out_ring_len - 1;
+	
+	// Append the block to the input history:
+	for (j = 0; j < B; j++)
+		nc->IN_RING[(nc->clock + j) & in_mask] = nc->IN_BLOCK[j];
+	nc->clock += B;
+	
+	// Advance every stage within the window of its latest block (input
+	// times clock-L ... clock-1 on the call that completes it), adding its
+	// output at its IR offset once the last step has run:
+	for (int s = 0; s < nc->num_stages; s++) {
+		PartitionedConvolver *pc = nc->stages[s];
+		int L = pc->block_len, steps = partitioned_num_steps(pc);
+		int call = (int)((nc->clock % L) / B);
+		if (call >= nc->windows[s])
+			continue;
+		
+		long long start = nc->clock - call * B - L;
+		if (call == 0) {
+			for (j = 0; j < L; j++)
+				nc->STAGE_BUF[j] = nc->IN_RING[(start + j) & in_mask];
+			partitioned_load(pc, nc->STAGE_BUF);
+			nc->done[s] = 0;
+		}
+		
+		// Run the steps due by this call, finishing on the window's last:
+		int due = (int)((long long)steps * (call + 1) / nc->windows[s]);
+		if (due <= nc->done[s])
+			continue;
+		partitioned_run(pc, nc->done[s], due);
+		nc->done[s] = due;
+		
+		if (due == steps) {
+			start += nc->offsets[s];
+			for (j = 0; j < L; j++)
+				nc->OUT_RING[(start + j) & out_mask] += pc->XX[L + j];
+		}
+	}
+	
+	// Every stage has now contributed to the oldest block_len samples:
+	long long start = nc->clock - B;
+	for (j = 0; j < B; j++) {
+		nc->OUT_BLOCK[j] = nc->OUT_RING[(start + j) & out_mask];
+		nc->OUT_RING[(start + j) & out_mask] = 0.0;
+	}
+}
+
+/**
+ * Convolve nframes samples from in[] with the filter kernel, writing
+ * nframes samples to out[]. Intended to be called from an audio callback:
+ * it never allocates, and accepts any nframes. Output lags input by
+ * block_len samples. in and out may alias.
+ */
+void nonuniform_process(NonUniformConvolver *nc, double *in, double *out, int nframes) {
+	for (int j = 0; j < nframes; j++) {
+		double sample = in[j];
+		out[j] = nc->OUT_BLOCK[nc->fill];
+		nc->IN_BLOCK[nc->fill++] = sample;
+		
+		if (nc->fill == nc->block_len) {
+			nonuniform_process_block(nc);
+			nc->fill = 0;
+		}
+	}
+}
+
+/**
+ * Forget all input, as if the convolver had just been created.
+ */
+void nonuniform_reset(NonUniformConvolver *nc) {
+	for (int s = 0; s < nc->num_stages; s++) {
+		partitioned_reset(nc->stages[s]);
+		nc->done[s] = partitioned_num_steps(nc->stages[s]);
+	}
+	memset(nc->IN_BLOCK, 0, sizeof(double) * nc->block_len);
+	memset(nc->OUT_BLOCK, 0, sizeof(double) * nc->block_len);
+	memset(nc->IN_RING, 0, sizeof(double) * nc->in_ring_len);
+	memset(nc->OUT_RING, 0, sizeof(double) * nc->out_ring_len);
+	nc->clock = 0;
+	nc->fill = 0;
+}
+
+/**
+ * Return the number of samples by which nonuniform_process() delays
+ * its output.
+ */
+int nonuniform_latency(NonUniformConvolver *nc) {
+	return nc->block_len;
+}
@@ -0,0 +1,167 @@
+/**
+ * Engine planning & wisdom.
+ *
+ * Which engine convolves a file fastest depends on the input & impulse
+ * response lengths, the channel layout, the thread budget and the machine:
+ * the direct form wins for very short impulse responses, single-partition
+ * overlap-add for most others, and uniformly-partitioned convolution once
+ * the impulse response's transform outgrows the cache. Rather than
+ * modelling all of that, the planner (plan_engine() in convolve.h) times
+ * each candidate on the start of the actual input, and remembers the
+ * winner for the workload in a wisdom file, so later runs with similar
+ * workloads dispatch straight to it.
+ *
+ * A wisdom file is plain text, one decision per line:
+ *     n_class m_class in_channels ir_channels threads precision simd engine block_len seconds
+ * where n_class & m_class are floor(log2()) of the input & impulse
+ * response lengths, so files of about the same size share a decision, and
+ * seconds is the estimated time of the winning engine. Lines starting with
+ * '#' are ignored. Like the spectrum cache, the file is rewritten under a
+ * temporary name and renamed into place, so concurrent runs never see a
+ * partial file (though one of two simultaneous updates may be lost).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WISDOM_HEADER "# convolve wisdom v1: n_class m_class in_channels " \
+					  "ir_channels threads precision simd engine block_len seconds\n"
+
+// Shortest time a trial runs for before its rate is trusted, in seconds:
+#define PLANNER_MIN_TRIAL 0.02
+
+// A candidate is dropped once it is estimated to take this many times as
+// long as the best one so far:
+#define PLANNER_PRUNE 2.0
+
+// File holding the planner's decisions, or NULL to plan every run afresh:
+char * wisdom_file = NULL;
+
+/**
+ * The workload a decision applies to.
+ */
+typedef struct PlanKey {
+	int n_class, m_class;	// floor(log2()) of the input & IR lengths
+	int in_channels, ir_channels;
+	int threads;
+	int precision;			// PRECISION_* of the overlap-add engine
+	int simd;				// SIMD_* level of the FFT kernels
+} PlanKey;
+
+/**
+ * A decision: the engine & block length to convolve a workload with.
+ */
+typedef struct Wisdom {
+	PlanKey key;
+	int engine;
+	int block_len;			// partition_len or nupols_block_len, or 0
+	double seconds;			// Estimated convolution time
+} Wisdom;
+
+/**
+ * Return floor(log2(len)), or 0 for len < 1.
+ */
+int planner_class(int len) {
+	int c = 0;
+	while (len > 1) {
+		len >>= 1;
+		c++;
+	}
+	return c;
+}
+
+/**
+ * Return a monotonic timestamp in seconds.
+ */
+double planner_wall() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Parse one line of a wisdom file into w. Returns FALSE for comments and
+ * for malformed lines, including decisions no run could have made (an
+ * engine other than a concrete one, or a block length that isn't 0 or a
+ * power of 2 within the partitioned engines' range), so that a damaged or
+ * hand-edited file causes a replan rather than a bad dispatch.
+ */
+int wisdom_parse(char *line, Wisdom *w) {
+	PlanKey *k = &w->key;
+	if (line[0] == '#')
+		return FALSE;
+	if (sscanf(line, "%d %d %d %d %d %d %d %d %d %lf", &k->n_class,
+			   &k->m_class, &k->in_channels, &k->ir_channels, &k->threads,
+			   &k->precision, &k->simd, &w->engine, &w->block_len,
+			   &w->seconds) != 10)
+		return FALSE;
+	return w->engine >= 0 && w->engine < ENGINE_AUTO && w->block_len >= 0 &&
+		   w->block_len <= NUPOLS_MAX_BLOCK_LEN &&
+		   (w->block_len & (w->block_len - 1)) == 0;
+}
+
+/**
+ * Look up the decision for key in the wisdom file. Returns TRUE and fills
+ * in w if there is one.
+ */
+int wisdom_load(PlanKey *key, Wisdom *w) {
+	char line[256];
+	Wisdom entry;
+	if (wisdom_file == NULL)
+		return FALSE;
+	FILE *fp = fopen(wisdom_file, "r");
+	if (fp == NULL)
+		return FALSE;
+	int found = FALSE;
+	while (!found && fgets(line, sizeof(line), fp) != NULL)
+		found = wisdom_parse(line, &entry) &&
+				memcmp(&entry.key, key, sizeof(PlanKey)) == 0;
+	fclose(fp);
+	if (found)
+		*w = entry;
+	return found;
+}
+
+/**
+ * Record a decision in the wisdom file, replacing any earlier one for the
+ * same workload. Failure only costs a replan next time, so it is reported
+ * but otherwise ignored.
+ */
+void wisdom_store(Wisdom *w) {
+	char line[256], tmp_path[1100];
+	Wisdom old;
+	if (wisdom_file == NULL)
+		return;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", wisdom_file, (long)getpid());
+
+	FILE *out = fopen(tmp_path, "w");
+	if (out == NULL) {
+		printf("Failed to write wisdom to %s.\n", wisdom_file);
+		return;
+	}
+	int ok = fputs(WISDOM_HEADER, out) >= 0;
+
+	// Keep every other decision already in the file:
+	FILE *in = fopen(wisdom_file, "r");
+	while (ok && in != NULL && fgets(line, sizeof(line), in) != NULL)
+		if (wisdom_parse(line, &old) &&
+			memcmp(&old.key, &w->key, sizeof(PlanKey)) != 0)
+			ok = fputs(line, out) >= 0;
+	if (in != NULL)
+		fclose(in);
+
+	PlanKey *k = &w->key;
+	ok = ok && fprintf(out, "%d %d %d %d %d %d %d %d %d %.6g\n", k->n_class,
+					   k->m_class, k->in_channels, k->ir_channels, k->threads,
+					   k->precision, k->simd, w->engine, w->block_len,
+					   w->seconds) > 0;
+	if (fclose(out) != 0)
+		ok = FALSE;
+	if (!ok || rename(tmp_path, wisdom_file) != 0) {
+		printf("Failed to write wisdom to %s.\n", wisdom_file);
+		remove(tmp_path);
+	}
+}
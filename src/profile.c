@@ -0,0 +1,185 @@
+/**
+ * Built-in profiling of the convolution hot path.
+ *
+ * Each stage of the pipeline accumulates the ticks spent in it, the number
+ * of times it ran and the bytes of operands it read & wrote, so a normal
+ * run can report where its time went without attaching a profiler. Ticks
+ * come from the CPU's cycle counter (the TSC on x86, CNTVCT on ARM64) and
+ * are converted to seconds against the wall clock when the report is made.
+ * Stages are timed a block at a time, never a sample at a time, and the
+ * counters are updated with relaxed atomic adds, so worker threads can
+ * share them.
+ *
+ * Profiling is compiled in with -DCONVOLVE_PROFILE. Without it, the
+ * PROFILE_* macros expand to nothing and none of this file's functions
+ * exist. A program brackets its run with PROFILE_START() & PROFILE_FINISH(),
+ * which prints the report and, if the CONVOLVE_PROFILE_JSON environment
+ * variable names a file, writes it there as JSON too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROFILE_READ 0			// Decoding input & impulse response files
+#define PROFILE_PERMUTE 1		// Bit-reversed gather/scatter around each FFT
+#define PROFILE_FFT 2			// Complex FFT butterflies
+#define PROFILE_RFFT_POST 3		// Real FFT untangling after a forward FFT
+#define PROFILE_RFFT_PRE 4		// Real FFT folding before an inverse FFT
+#define PROFILE_SPECTRUM 5		// Spectrum multiply & multiply-accumulate
+#define PROFILE_OVERLAP_ADD 6	// Adding & saving segment overlaps
+#define PROFILE_PEAK 7			// update_max() & storing the output
+#define PROFILE_NORMALIZE 8		// Scaling the output by its peak
+#define PROFILE_WRITE 9			// Encoding & writing the output file
+#define NUM_PROFILE_STAGES 10
+
+#ifdef CONVOLVE_PROFILE
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+typedef struct ProfileStage {
+	unsigned long long ticks, calls, bytes;
+} ProfileStage;
+
+const char *profile_names[NUM_PROFILE_STAGES] = {
+	"read", "permute", "fft", "rfft_post", "rfft_pre", "spectrum",
+	"overlap_add", "peak", "normalize", "write"
+};
+
+ProfileStage profile_stages[NUM_PROFILE_STAGES];
+unsigned long long profile_start_ticks;
+double profile_start_wall;
+
+/**
+ * Return the cycle counter, or nanoseconds where there isn't one.
+ */
+unsigned long long profile_ticks() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	unsigned long long t;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Return a monotonic timestamp in seconds.
+ */
+double profile_wall() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Charge ticks & bytes to stage.
+ */
+void profile_add(int stage, unsigned long long ticks, unsigned long long bytes) {
+	ProfileStage *s = &profile_stages[stage];
+	__atomic_fetch_add(&s->ticks, ticks, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Zero every counter and start the wall clock the report is measured by.
+ */
+void profile_reset() {
+	memset(profile_stages, 0, sizeof(profile_stages));
+	profile_start_wall = profile_wall();
+	profile_start_ticks = profile_ticks();
+}
+
+/**
+ * Return the ticks per second since profile_reset(), and the wall time
+ * since then in *wall.
+ */
+double profile_tick_rate(double *wall) {
+	*wall = profile_wall() - profile_start_wall;
+	unsigned long long ticks = profile_ticks() - profile_start_ticks;
+	return (*wall > 0.0) ? ticks / *wall : 1e9;
+}
+
+/**
+ * Print a table of the time, calls & throughput of every stage that ran
+ * since profile_reset(). With several threads, stages can add up to more
+ * than the wall time.
+ */
+void profile_report(FILE *fp) {
+	double wall, rate = profile_tick_rate(&wall);
+	fprintf(fp, "\n%-12s %10s %10s %7s %10s %8s\n", "stage", "calls", "seconds",
+			"% wall", "MB", "GB/s");
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++) {
+		ProfileStage *st = &profile_stages[s];
+		if (st->calls == 0)
+			continue;
+		double secs = st->ticks / rate;
+		fprintf(fp, "%-12s %10llu %10.4f %6.1f%% %10.1f %8.2f\n", profile_names[s],
+				st->calls, secs, 100.0 * secs / wall, st->bytes / 1e6,
+				(secs > 0.0) ? st->bytes / secs / 1e9 : 0.0);
+	}
+	fprintf(fp, "%-12s %10s %10.4f\n", "wall", "", wall);
+}
+
+/**
+ * Write the same figures as profile_report() to path as a JSON object.
+ * Returns FALSE if the file couldn't be written.
+ */
+int profile_write_json(char *path) {
+	double wall, rate = profile_tick_rate(&wall);
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("Failed to create %s.\n", path);
+		return FALSE;
+	}
+	fprintf(fp, "{\"wall_s\": %.6f, \"stages\": {", wall);
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++) {
+		ProfileStage *st = &profile_stages[s];
+		fprintf(fp, "%s\n  \"%s\": {\"calls\": %llu, \"seconds\": %.6f, \"bytes\": %llu}",
+				(s == 0) ? "" : ",", profile_names[s], st->calls, st->ticks / rate,
+				st->bytes);
+	}
+	fprintf(fp, "\n}}\n");
+	fclose(fp);
+	return TRUE;
+}
+
+/**
+ * Print the report, and write it as JSON to $CONVOLVE_PROFILE_JSON if set.
+ */
+void profile_finish() {
+	profile_report(stdout);
+	if (getenv("CONVOLVE_PROFILE_JSON") != NULL)
+		profile_write_json(getenv("CONVOLVE_PROFILE_JSON"));
+}
+
+#define PROFILE_START() profile_reset()
+#define PROFILE_FINISH() profile_finish()
+
+// Start timing into the local t, charge the ticks since t to stage (with
+// bytes of operands) & restart t, or charge them without restarting:
+#define PROFILE_BEGIN(t) unsigned long long t = profile_ticks()
+#define PROFILE_LAP(stage, t, bytes) do {\
+	unsigned long long now_ = profile_ticks();\
+	profile_add(stage, now_ - (t), bytes);\
+	t = now_;\
+} while (0)
+#define PROFILE_END(stage, t, bytes) profile_add(stage, profile_ticks() - (t), bytes)
+
+#else
+
+#define PROFILE_START()
+#define PROFILE_FINISH()
+#define PROFILE_BEGIN(t)
+#define PROFILE_LAP(stage, t, bytes)
+#define PROFILE_END(stage, t, bytes)
+
+#endif
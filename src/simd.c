@@ -0,0 +1,754 @@
+/**
+ * Runtime CPU feature detection for the vectorized kernels.
+ *
+ * Each kernel is compiled for every supported instruction set (via
+ * per-function target attributes, so the binary itself still only
+ * requires the baseline ISA) and simd_level() picks the widest one
+ * the CPU reports through CPUID. Setting the CONVOLVE_SIMD environment
+ * variable to scalar, sse2, avx2 or avx512 caps the level, which is
+ * handy for benchmarking & testing the narrower variants.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIMD_X86 1
+#else
+#define SIMD_X86 0
+#endif
+
+#define SIMD_SCALAR 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2		// AVX2 + FMA
+#define SIMD_AVX512 3	// AVX-512F
+
+int simd_detected = -1, simd_cap = -1;
+
+/**
+ * Return the widest instruction set supported by both the CPU and the
+ * CONVOLVE_SIMD cap (if any).
+ */
+int simd_level() {
+	if (simd_detected == -1) {
+		simd_detected = SIMD_SCALAR;
+#if SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			simd_detected = SIMD_SSE2;
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			simd_detected = SIMD_AVX2;
+		if (__builtin_cpu_supports("avx512f"))
+			simd_detected = SIMD_AVX512;
+#endif
+		char *env = getenv("CONVOLVE_SIMD");
+		if (simd_cap == -1 && env != NULL) {
+			if (strcmp(env, "scalar") == 0)
+				simd_cap = SIMD_SCALAR;
+			else if (strcmp(env, "sse2") == 0)
+				simd_cap = SIMD_SSE2;
+			else if (strcmp(env, "avx2") == 0)
+				simd_cap = SIMD_AVX2;
+			else if (strcmp(env, "avx512") == 0)
+				simd_cap = SIMD_AVX512;
+		}
+	}
+	if (simd_cap != -1 && simd_cap < simd_detected)
+		return simd_cap;
+	return simd_detected;
+}
+
+/**
+ * Cap the instruction set used by kernels selected from now on; -1 removes
+ * the cap. Kernels are chosen when plans are created, so existing plans
+ * keep the level they were created with.
+ */
+void simd_set_level(int level) {
+	simd_cap = level;
+}
+
+/**
+ * Return a printable name for a SIMD_* level.
+ */
+const char * simd_name(int level) {
+	switch (level) {
+		case SIMD_SSE2:
+			return "sse2";
+		case SIMD_AVX2:
+			return "avx2";
+		case SIMD_AVX512:
+			return "avx512";
+		default:
+			return "scalar";
+	}
+}
+
+/**
+ * Complex spectrum kernels over split-format spectra of len bins:
+ *     spectrum_mul: Y = X * H
+ *     spectrum_mac: Y += X * H
+ * Y may alias X. The scalar versions handle whatever is left over after
+ * the vector loops.
+ */
+void spectrum_mul_scalar(double *yr, double *yi, double *xr, double *xi,
+						 double *hr, double *hi, int len) {
+	double temp;
+	for (int j = 0; j < len; j++) {
+		temp  = (xr[j] * hr[j]) - (xi[j] * hi[j]);
+		yi[j] = (xr[j] * hi[j]) + (xi[j] * hr[j]);
+		yr[j] = temp;
+	}
+}
+
+void spectrum_mac_scalar(double *yr, double *yi, double *xr, double *xi,
+						 double *hr, double *hi, int len) {
+	for (int j = 0; j < len; j++) {
+		yr[j] += (xr[j] * hr[j]) - (xi[j] * hi[j]);
+		yi[j] += (xr[j] * hi[j]) + (xi[j] * hr[j]);
+	}
+}
+
+/**
+ * Single-precision versions, for the float32 engine.
+ */
+void spectrum_mul_scalar_f(float *yr, float *yi, float *xr, float *xi,
+						   float *hr, float *hi, int len) {
+	float temp;
+	for (int j = 0; j < len; j++) {
+		temp  = (xr[j] * hr[j]) - (xi[j] * hi[j]);
+		yi[j] = (xr[j] * hi[j]) + (xi[j] * hr[j]);
+		yr[j] = temp;
+	}
+}
+
+void spectrum_mac_scalar_f(float *yr, float *yi, float *xr, float *xi,
+						   float *hr, float *hi, int len) {
+	for (int j = 0; j < len; j++) {
+		yr[j] += (xr[j] * hr[j]) - (xi[j] * hi[j]);
+		yi[j] += (xr[j] * hi[j]) + (xi[j] * hr[j]);
+	}
+}
+
+#if SIMD_X86
+
+/**
+ * Define spectrum_mul_<isa><SFX>() & spectrum_mac_<isa><SFX>() over
+ * spectra of type T, processing W bins per iteration. SFX is empty for
+ * double & _f for float.
+ */
+#define DEFINE_SPECTRUM_KERNELS(isa,SFX,T,features,VEC,W,LOAD,STORE,ADD,SUB,MUL)\
+__attribute__((target(features)))\
+void spectrum_mul_##isa##SFX(T *yr, T *yi, T *xr, T *xi,\
+							 T *hr, T *hi, int len) {\
+	VEC ar, ai, br, bi;\
+	int j;\
+	for (j = 0; j + W <= len; j += W) {\
+		ar = LOAD(xr + j); ai = LOAD(xi + j);\
+		br = LOAD(hr + j); bi = LOAD(hi + j);\
+		STORE(yr + j, SUB(MUL(ar, br), MUL(ai, bi)));\
+		STORE(yi + j, ADD(MUL(ar, bi), MUL(ai, br)));\
+	}\
+	spectrum_mul_scalar##SFX(yr + j, yi + j, xr + j, xi + j, hr + j, hi + j, len - j);\
+}\
+__attribute__((target(features)))\
+void spectrum_mac_##isa##SFX(T *yr, T *yi, T *xr, T *xi,\
+							 T *hr, T *hi, int len) {\
+	VEC ar, ai, br, bi;\
+	int j;\
+	for (j = 0; j + W <= len; j += W) {\
+		ar = LOAD(xr + j); ai = LOAD(xi + j);\
+		br = LOAD(hr + j); bi = LOAD(hi + j);\
+		STORE(yr + j, ADD(LOAD(yr + j), SUB(MUL(ar, br), MUL(ai, bi))));\
+		STORE(yi + j, ADD(LOAD(yi + j), ADD(MUL(ar, bi), MUL(ai, br))));\
+	}\
+	spectrum_mac_scalar##SFX(yr + j, yi + j, xr + j, xi + j, hr + j, hi + j, len - j);\
+}
+
+DEFINE_SPECTRUM_KERNELS(sse2, , double, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+						_mm_add_pd, _mm_sub_pd, _mm_mul_pd)
+DEFINE_SPECTRUM_KERNELS(avx2, , double, "avx2,fma", __m256d, 4, _mm256_loadu_pd,
+						_mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+DEFINE_SPECTRUM_KERNELS(avx512, , double, "avx512f", __m512d, 8, _mm512_loadu_pd,
+						_mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+
+DEFINE_SPECTRUM_KERNELS(sse2, _f, float, "sse2", __m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+						_mm_add_ps, _mm_sub_ps, _mm_mul_ps)
+DEFINE_SPECTRUM_KERNELS(avx2, _f, float, "avx2,fma", __m256, 8, _mm256_loadu_ps,
+						_mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+DEFINE_SPECTRUM_KERNELS(avx512, _f, float, "avx512f", __m512, 16, _mm512_loadu_ps,
+						_mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+
+#endif
+
+typedef void (*SpectrumKernel)(double *, double *, double *, double *,
+							   double *, double *, int);
+
+/**
+ * Return the spectrum_mul (accumulate == FALSE) or spectrum_mac
+ * (accumulate == TRUE) kernel for a SIMD_* level.
+ */
+SpectrumKernel spectrum_kernel(int level, int accumulate) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return accumulate ? spectrum_mac_avx512 : spectrum_mul_avx512;
+	if (level == SIMD_AVX2)
+		return accumulate ? spectrum_mac_avx2 : spectrum_mul_avx2;
+	if (level == SIMD_SSE2)
+		return accumulate ? spectrum_mac_sse2 : spectrum_mul_sse2;
+#endif
+	return accumulate ? spectrum_mac_scalar : spectrum_mul_scalar;
+}
+
+typedef void (*SpectrumKernelF)(float *, float *, float *, float *,
+								float *, float *, int);
+
+/**
+ * Single-precision equivalent of spectrum_kernel().
+ */
+SpectrumKernelF spectrum_kernel_f(int level, int accumulate) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return accumulate ? spectrum_mac_avx512_f : spectrum_mul_avx512_f;
+	if (level == SIMD_AVX2)
+		return accumulate ? spectrum_mac_avx2_f : spectrum_mul_avx2_f;
+	if (level == SIMD_SSE2)
+		return accumulate ? spectrum_mac_sse2_f : spectrum_mul_sse2_f;
+#endif
+	return accumulate ? spectrum_mac_scalar_f : spectrum_mul_scalar_f;
+}
+
+/**
+ * Sample kernels for the output path. Each returns the larger of peak and
+ * the largest absolute value of x[0]-x[len-1]:
+ *     peak_abs:    only scans x
+ *     peak_copy:   also copies x to y
+ *     peak_copy_f: also converts the float x to double into y
+ * Since max is exact, every SIMD level returns the same peak.
+ */
+double peak_abs_scalar(double *x, int len, double peak) {
+	for (int j = 0; j < len; j++)
+		if (fabs(x[j]) > peak)
+			peak = fabs(x[j]);
+	return peak;
+}
+
+double peak_copy_scalar(double *y, double *x, int len, double peak) {
+	for (int j = 0; j < len; j++) {
+		y[j] = x[j];
+		if (fabs(x[j]) > peak)
+			peak = fabs(x[j]);
+	}
+	return peak;
+}
+
+double peak_copy_f_scalar(double *y, float *x, int len, double peak) {
+	for (int j = 0; j < len; j++) {
+		y[j] = x[j];
+		if (fabs(y[j]) > peak)
+			peak = fabs(y[j]);
+	}
+	return peak;
+}
+
+/**
+ * TPDF dither for the PCM encoders: DITHER_LANES xorshift64 generators,
+ * sample j of each call drawing from lane j % DITHER_LANES. Each vector
+ * holds whole lanes, so every SIMD level adds exactly the same noise. A
+ * sample's dither is the difference of two uniform draws in [0, 1), i.e.
+ * triangular noise of up to 1 LSB either way.
+ */
+#define DITHER_LANES 8
+
+typedef struct Dither {
+	uint64_t s[DITHER_LANES];
+} Dither;
+
+/**
+ * Seed the lanes of d from seed with splitmix64, so they start far apart
+ * and never at xorshift's fixed point, 0.
+ */
+void dither_init(Dither *d, uint64_t seed) {
+	for (int k = 0; k < DITHER_LANES; k++) {
+		uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		d->s[k] = (z ^ (z >> 31)) | 1;
+	}
+}
+
+/**
+ * Step lane s, and return a uniform draw in [0, 1) made of its top 52 bits.
+ */
+double dither_uniform(uint64_t *s) {
+	uint64_t x = *s;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*s = x;
+	x = (x >> 12) | 0x3FF0000000000000ULL;
+	double u;
+	memcpy(&u, &x, sizeof(u));
+	return u - 1.0;
+}
+
+double dither_tpdf(uint64_t *s) {
+	double u = dither_uniform(s);
+	return u - dither_uniform(s);
+}
+
+/**
+ * Output encoders. Each multiplies y[0]-y[len-1] by scale in place and
+ * encodes the scaled samples into out[]:
+ *     scale_pcm16: 16-bit PCM
+ *     scale_pcm32: bits-bit PCM (24 or 32), left-justified in 32-bit ints
+ *                  as sf_write_int() expects
+ *     scale_float: 32-bit float
+ * The PCM encoders round to nearest & saturate, as sf_write_double() does
+ * for normalized doubles, after adding TPDF dither from d unless it is
+ * NULL.
+ */
+void scale_pcm16_scalar(double *y, short *pcm, int len, double scale, Dither *d) {
+	for (int j = 0; j < len; j++) {
+		y[j] *= scale;
+		double s = y[j] * 32767.0;
+		if (d != NULL)
+			s += dither_tpdf(&d->s[j % DITHER_LANES]);
+		if (s > 32767.0)
+			s = 32767.0;
+		if (s < -32768.0)
+			s = -32768.0;
+		pcm[j] = (short)lrint(s);
+	}
+}
+
+void scale_pcm32_scalar(double *y, int *pcm, int len, double scale, int bits,
+						Dither *d) {
+	double full = (double)((1u << (bits - 1)) - 1);
+	for (int j = 0; j < len; j++) {
+		y[j] *= scale;
+		double s = y[j] * full;
+		if (d != NULL)
+			s += dither_tpdf(&d->s[j % DITHER_LANES]);
+		if (s > full)
+			s = full;
+		if (s < -full - 1.0)
+			s = -full - 1.0;
+		pcm[j] = (int)((uint32_t)lrint(s) << (32 - bits));
+	}
+}
+
+void scale_float_scalar(double *y, float *out, int len, double scale) {
+	for (int j = 0; j < len; j++) {
+		y[j] *= scale;
+		out[j] = (float)y[j];
+	}
+}
+
+#if SIMD_X86
+
+/**
+ * Define peak_abs_<isa>(), peak_copy_<isa>() & peak_copy_f_<isa>(),
+ * processing W doubles per iteration. LOADF loads W floats as doubles.
+ */
+#define ABS_SSE2(v) _mm_andnot_pd(_mm_set1_pd(-0.0), v)
+#define ABS_AVX2(v) _mm256_andnot_pd(_mm256_set1_pd(-0.0), v)
+
+#define DEFINE_PEAK_KERNELS(isa,features,VEC,W,LOAD,STORE,SET1,MAX,ABS,LOADF)\
+__attribute__((target(features)))\
+double peak_reduce_##isa(VEC v, double peak) {\
+	double lanes[W];\
+	STORE(lanes, v);\
+	for (int k = 0; k < W; k++)\
+		if (lanes[k] > peak)\
+			peak = lanes[k];\
+	return peak;\
+}\
+__attribute__((target(features)))\
+double peak_abs_##isa(double *x, int len, double peak) {\
+	VEC m = SET1(0.0);\
+	int j;\
+	for (j = 0; j + W <= len; j += W)\
+		m = MAX(m, ABS(LOAD(x + j)));\
+	return peak_abs_scalar(x + j, len - j, peak_reduce_##isa(m, peak));\
+}\
+__attribute__((target(features)))\
+double peak_copy_##isa(double *y, double *x, int len, double peak) {\
+	VEC m = SET1(0.0), v;\
+	int j;\
+	for (j = 0; j + W <= len; j += W) {\
+		v = LOAD(x + j);\
+		STORE(y + j, v);\
+		m = MAX(m, ABS(v));\
+	}\
+	return peak_copy_scalar(y + j, x + j, len - j, peak_reduce_##isa(m, peak));\
+}\
+__attribute__((target(features)))\
+double peak_copy_f_##isa(double *y, float *x, int len, double peak) {\
+	VEC m = SET1(0.0), v;\
+	int j;\
+	for (j = 0; j + W <= len; j += W) {\
+		v = LOADF(x + j);\
+		STORE(y + j, v);\
+		m = MAX(m, ABS(v));\
+	}\
+	return peak_copy_f_scalar(y + j, x + j, len - j, peak_reduce_##isa(m, peak));\
+}
+
+#define LOADF_SSE2(p) _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((__m128i *)(p))))
+#define LOADF_AVX2(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define LOADF_AVX512(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+
+DEFINE_PEAK_KERNELS(sse2, "sse2", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+					_mm_set1_pd, _mm_max_pd, ABS_SSE2, LOADF_SSE2)
+DEFINE_PEAK_KERNELS(avx2, "avx2,fma", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+					_mm256_set1_pd, _mm256_max_pd, ABS_AVX2, LOADF_AVX2)
+DEFINE_PEAK_KERNELS(avx512, "avx512f", __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd,
+					_mm512_set1_pd, _mm512_max_pd, _mm512_abs_pd, LOADF_AVX512)
+
+/**
+ * Define dither_tpdf_<isa>(), drawing the dither of one vector of samples
+ * from the lanes in s, as dither_tpdf() does for each lane.
+ */
+#define DEFINE_DITHER(isa,features,VEC,IVEC,SET1,SET1I,XOR,SLL,SRL,OR,CAST,SUB)\
+__attribute__((target(features)))\
+VEC dither_uniform_##isa(IVEC *s) {\
+	IVEC x = *s;\
+	x = XOR(x, SLL(x, 13));\
+	x = XOR(x, SRL(x, 7));\
+	x = XOR(x, SLL(x, 17));\
+	*s = x;\
+	return SUB(CAST(OR(SRL(x, 12), SET1I(0x3FF0000000000000LL))), SET1(1.0));\
+}\
+__attribute__((target(features)))\
+VEC dither_tpdf_##isa(IVEC *s) {\
+	VEC u = dither_uniform_##isa(s);\
+	return SUB(u, dither_uniform_##isa(s));\
+}
+
+DEFINE_DITHER(sse2, "sse2", __m128d, __m128i, _mm_set1_pd, _mm_set1_epi64x,
+			  _mm_xor_si128, _mm_slli_epi64, _mm_srli_epi64, _mm_or_si128,
+			  _mm_castsi128_pd, _mm_sub_pd)
+DEFINE_DITHER(avx2, "avx2,fma", __m256d, __m256i, _mm256_set1_pd, _mm256_set1_epi64x,
+			  _mm256_xor_si256, _mm256_slli_epi64, _mm256_srli_epi64, _mm256_or_si256,
+			  _mm256_castsi256_pd, _mm256_sub_pd)
+DEFINE_DITHER(avx512, "avx512f", __m512d, __m512i, _mm512_set1_pd, _mm512_set1_epi64,
+			  _mm512_xor_si512, _mm512_slli_epi64, _mm512_srli_epi64, _mm512_or_si512,
+			  _mm512_castsi512_pd, _mm512_sub_pd)
+
+/**
+ * The encoders, 8 samples (i.e. DITHER_LANES) per iteration. The
+ * conversions round to nearest even under the default MXCSR, like lrint(),
+ * and the clamps keep them in range of _mm_packs_epi32()'s saturation &
+ * of int. The dither lanes are held in registers across the loop.
+ */
+__attribute__((target("sse2")))
+void scale_pcm16_sse2(double *y, short *pcm, int len, double scale, Dither *d) {
+	__m128d sc = _mm_set1_pd(scale), full = _mm_set1_pd(32767.0);
+	__m128d hi = _mm_set1_pd(32767.0), lo = _mm_set1_pd(-32768.0);
+	__m128i c[4], st[4];
+	int j, k;
+	for (k = 0; k < 4; k++)
+		st[k] = (d != NULL) ? _mm_loadu_si128((__m128i *)(d->s + k * 2)) : _mm_setzero_si128();
+	for (j = 0; j + 8 <= len; j += 8) {
+		for (k = 0; k < 4; k++) {
+			__m128d v = _mm_mul_pd(_mm_loadu_pd(y + j + k * 2), sc);
+			_mm_storeu_pd(y + j + k * 2, v);
+			v = _mm_mul_pd(v, full);
+			if (d != NULL)
+				v = _mm_add_pd(v, dither_tpdf_sse2(&st[k]));
+			v = _mm_max_pd(_mm_min_pd(v, hi), lo);
+			c[k] = _mm_cvtpd_epi32(v);
+		}
+		_mm_storeu_si128((__m128i *)(pcm + j),
+			_mm_packs_epi32(_mm_unpacklo_epi64(c[0], c[1]), _mm_unpacklo_epi64(c[2], c[3])));
+	}
+	for (k = 0; d != NULL && k < 4; k++)
+		_mm_storeu_si128((__m128i *)(d->s + k * 2), st[k]);
+	scale_pcm16_scalar(y + j, pcm + j, len - j, scale, d);
+}
+
+__attribute__((target("sse2")))
+void scale_pcm32_sse2(double *y, int *pcm, int len, double scale, int bits,
+					  Dither *d) {
+	double f = (double)((1u << (bits - 1)) - 1);
+	__m128d sc = _mm_set1_pd(scale), full = _mm_set1_pd(f);
+	__m128d hi = _mm_set1_pd(f), lo = _mm_set1_pd(-f - 1.0);
+	__m128i shift = _mm_cvtsi32_si128(32 - bits), c[4], st[4];
+	int j, k;
+	for (k = 0; k < 4; k++)
+		st[k] = (d != NULL) ? _mm_loadu_si128((__m128i *)(d->s + k * 2)) : _mm_setzero_si128();
+	for (j = 0; j + 8 <= len; j += 8) {
+		for (k = 0; k < 4; k++) {
+			__m128d v = _mm_mul_pd(_mm_loadu_pd(y + j + k * 2), sc);
+			_mm_storeu_pd(y + j + k * 2, v);
+			v = _mm_mul_pd(v, full);
+			if (d != NULL)
+				v = _mm_add_pd(v, dither_tpdf_sse2(&st[k]));
+			v = _mm_max_pd(_mm_min_pd(v, hi), lo);
+			c[k] = _mm_cvtpd_epi32(v);
+		}
+		_mm_storeu_si128((__m128i *)(pcm + j),
+			_mm_sll_epi32(_mm_unpacklo_epi64(c[0], c[1]), shift));
+		_mm_storeu_si128((__m128i *)(pcm + j + 4),
+			_mm_sll_epi32(_mm_unpacklo_epi64(c[2], c[3]), shift));
+	}
+	for (k = 0; d != NULL && k < 4; k++)
+		_mm_storeu_si128((__m128i *)(d->s + k * 2), st[k]);
+	scale_pcm32_scalar(y + j, pcm + j, len - j, scale, bits, d);
+}
+
+__attribute__((target("sse2")))
+void scale_float_sse2(double *y, float *out, int len, double scale) {
+	__m128d sc = _mm_set1_pd(scale), v, w;
+	int j;
+	for (j = 0; j + 4 <= len; j += 4) {
+		v = _mm_mul_pd(_mm_loadu_pd(y + j), sc);
+		w = _mm_mul_pd(_mm_loadu_pd(y + j + 2), sc);
+		_mm_storeu_pd(y + j, v);
+		_mm_storeu_pd(y + j + 2, w);
+		_mm_storeu_ps(out + j, _mm_movelh_ps(_mm_cvtpd_ps(v), _mm_cvtpd_ps(w)));
+	}
+	scale_float_scalar(y + j, out + j, len - j, scale);
+}
+
+__attribute__((target("avx2,fma")))
+void scale_pcm16_avx2(double *y, short *pcm, int len, double scale, Dither *d) {
+	__m256d sc = _mm256_set1_pd(scale), full = _mm256_set1_pd(32767.0);
+	__m256d hi = _mm256_set1_pd(32767.0), lo = _mm256_set1_pd(-32768.0);
+	__m128i c[2];
+	__m256i st[2];
+	int j, k;
+	for (k = 0; k < 2; k++)
+		st[k] = (d != NULL) ? _mm256_loadu_si256((__m256i *)(d->s + k * 4)) :
+							  _mm256_setzero_si256();
+	for (j = 0; j + 8 <= len; j += 8) {
+		for (k = 0; k < 2; k++) {
+			__m256d v = _mm256_mul_pd(_mm256_loadu_pd(y + j + k * 4), sc);
+			_mm256_storeu_pd(y + j + k * 4, v);
+			v = _mm256_mul_pd(v, full);
+			if (d != NULL)
+				v = _mm256_add_pd(v, dither_tpdf_avx2(&st[k]));
+			v = _mm256_max_pd(_mm256_min_pd(v, hi), lo);
+			c[k] = _mm256_cvtpd_epi32(v);
+		}
+		_mm_storeu_si128((__m128i *)(pcm + j), _mm_packs_epi32(c[0], c[1]));
+	}
+	for (k = 0; d != NULL && k < 2; k++)
+		_mm256_storeu_si256((__m256i *)(d->s + k * 4), st[k]);
+	scale_pcm16_scalar(y + j, pcm + j, len - j, scale, d);
+}
+
+__attribute__((target("avx2,fma")))
+void scale_pcm32_avx2(double *y, int *pcm, int len, double scale, int bits,
+					  Dither *d) {
+	double f = (double)((1u << (bits - 1)) - 1);
+	__m256d sc = _mm256_set1_pd(scale), full = _mm256_set1_pd(f);
+	__m256d hi = _mm256_set1_pd(f), lo = _mm256_set1_pd(-f - 1.0);
+	__m128i shift = _mm_cvtsi32_si128(32 - bits);
+	__m256i st[2];
+	int j, k;
+	for (k = 0; k < 2; k++)
+		st[k] = (d != NULL) ? _mm256_loadu_si256((__m256i *)(d->s + k * 4)) :
+							  _mm256_setzero_si256();
+	for (j = 0; j + 8 <= len; j += 8) {
+		for (k = 0; k < 2; k++) {
+			__m256d v = _mm256_mul_pd(_mm256_loadu_pd(y + j + k * 4), sc);
+			_mm256_storeu_pd(y + j + k * 4, v);
+			v = _mm256_mul_pd(v, full);
+			if (d != NULL)
+				v = _mm256_add_pd(v, dither_tpdf_avx2(&st[k]));
+			v = _mm256_max_pd(_mm256_min_pd(v, hi), lo);
+			_mm_storeu_si128((__m128i *)(pcm + j + k * 4),
+				_mm_sll_epi32(_mm256_cvtpd_epi32(v), shift));
+		}
+	}
+	for (k = 0; d != NULL && k < 2; k++)
+		_mm256_storeu_si256((__m256i *)(d->s + k * 4), st[k]);
+	scale_pcm32_scalar(y + j, pcm + j, len - j, scale, bits, d);
+}
+
+__attribute__((target("avx2,fma")))
+void scale_float_avx2(double *y, float *out, int len, double scale) {
+	__m256d sc = _mm256_set1_pd(scale), v;
+	int j;
+	for (j = 0; j + 4 <= len; j += 4) {
+		v = _mm256_mul_pd(_mm256_loadu_pd(y + j), sc);
+		_mm256_storeu_pd(y + j, v);
+		_mm_storeu_ps(out + j, _mm256_cvtpd_ps(v));
+	}
+	scale_float_scalar(y + j, out + j, len - j, scale);
+}
+
+__attribute__((target("avx512f")))
+void scale_pcm16_avx512(double *y, short *pcm, int len, double scale, Dither *d) {
+	__m512d sc = _mm512_set1_pd(scale), full = _mm512_set1_pd(32767.0);
+	__m512d hi = _mm512_set1_pd(32767.0), lo = _mm512_set1_pd(-32768.0);
+	__m512i st = (d != NULL) ? _mm512_loadu_si512(d->s) : _mm512_setzero_si512();
+	int j;
+	for (j = 0; j + 8 <= len; j += 8) {
+		__m512d v = _mm512_mul_pd(_mm512_loadu_pd(y + j), sc);
+		_mm512_storeu_pd(y + j, v);
+		v = _mm512_mul_pd(v, full);
+		if (d != NULL)
+			v = _mm512_add_pd(v, dither_tpdf_avx512(&st));
+		v = _mm512_max_pd(_mm512_min_pd(v, hi), lo);
+		__m256i c = _mm512_cvtpd_epi32(v);
+		_mm_storeu_si128((__m128i *)(pcm + j), _mm_packs_epi32(
+			_mm256_castsi256_si128(c), _mm256_extractf128_si256(c, 1)));
+	}
+	if (d != NULL)
+		_mm512_storeu_si512(d->s, st);
+	scale_pcm16_scalar(y + j, pcm + j, len - j, scale, d);
+}
+
+__attribute__((target("avx512f")))
+void scale_pcm32_avx512(double *y, int *pcm, int len, double scale, int bits,
+						Dither *d) {
+	double f = (double)((1u << (bits - 1)) - 1);
+	__m512d sc = _mm512_set1_pd(scale), full = _mm512_set1_pd(f);
+	__m512d hi = _mm512_set1_pd(f), lo = _mm512_set1_pd(-f - 1.0);
+	__m128i shift = _mm_cvtsi32_si128(32 - bits);
+	__m512i st = (d != NULL) ? _mm512_loadu_si512(d->s) : _mm512_setzero_si512();
+	int j;
+	for (j = 0; j + 8 <= len; j += 8) {
+		__m512d v = _mm512_mul_pd(_mm512_loadu_pd(y + j), sc);
+		_mm512_storeu_pd(y + j, v);
+		v = _mm512_mul_pd(v, full);
+		if (d != NULL)
+			v = _mm512_add_pd(v, dither_tpdf_avx512(&st));
+		v = _mm512_max_pd(_mm512_min_pd(v, hi), lo);
+		_mm256_storeu_si256((__m256i *)(pcm + j),
+			_mm256_sll_epi32(_mm512_cvtpd_epi32(v), shift));
+	}
+	if (d != NULL)
+		_mm512_storeu_si512(d->s, st);
+	scale_pcm32_scalar(y + j, pcm + j, len - j, scale, bits, d);
+}
+
+__attribute__((target("avx512f")))
+void scale_float_avx512(double *y, float *out, int len, double scale) {
+	__m512d sc = _mm512_set1_pd(scale), v;
+	int j;
+	for (j = 0; j + 8 <= len; j += 8) {
+		v = _mm512_mul_pd(_mm512_loadu_pd(y + j), sc);
+		_mm512_storeu_pd(y + j, v);
+		_mm256_storeu_ps(out + j, _mm512_cvtpd_ps(v));
+	}
+	scale_float_scalar(y + j, out + j, len - j, scale);
+}
+
+#endif
+
+typedef double (*PeakKernel)(double *, int, double);
+typedef double (*PeakCopyKernel)(double *, double *, int, double);
+typedef double (*PeakCopyKernelF)(double *, float *, int, double);
+typedef void (*PCM16Kernel)(double *, short *, int, double, Dither *);
+typedef void (*PCM32Kernel)(double *, int *, int, double, int, Dither *);
+typedef void (*FloatKernel)(double *, float *, int, double);
+
+/**
+ * Return the peak_abs, peak_copy, peak_copy_f, scale_pcm16, scale_pcm32 &
+ * scale_float kernels for a SIMD_* level.
+ */
+PeakKernel peak_abs_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return peak_abs_avx512;
+	if (level == SIMD_AVX2)
+		return peak_abs_avx2;
+	if (level == SIMD_SSE2)
+		return peak_abs_sse2;
+#endif
+	return peak_abs_scalar;
+}
+
+PeakCopyKernel peak_copy_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return peak_copy_avx512;
+	if (level == SIMD_AVX2)
+		return peak_copy_avx2;
+	if (level == SIMD_SSE2)
+		return peak_copy_sse2;
+#endif
+	return peak_copy_scalar;
+}
+
+PeakCopyKernelF peak_copy_f_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return peak_copy_f_avx512;
+	if (level == SIMD_AVX2)
+		return peak_copy_f_avx2;
+	if (level == SIMD_SSE2)
+		return peak_copy_f_sse2;
+#endif
+	return peak_copy_f_scalar;
+}
+
+PCM16Kernel scale_pcm16_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return scale_pcm16_avx512;
+	if (level == SIMD_AVX2)
+		return scale_pcm16_avx2;
+	if (level == SIMD_SSE2)
+		return scale_pcm16_sse2;
+#endif
+	return scale_pcm16_scalar;
+}
+
+PCM32Kernel scale_pcm32_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return scale_pcm32_avx512;
+	if (level == SIMD_AVX2)
+		return scale_pcm32_avx2;
+	if (level == SIMD_SSE2)
+		return scale_pcm32_sse2;
+#endif
+	return scale_pcm32_scalar;
+}
+
+FloatKernel scale_float_kernel(int level) {
+#if SIMD_X86
+	if (level == SIMD_AVX512)
+		return scale_float_avx512;
+	if (level == SIMD_AVX2)
+		return scale_float_avx2;
+	if (level == SIMD_SSE2)
+		return scale_float_sse2;
+#endif
+	return scale_float_scalar;
+}
+
+/**
+ * The same kernels at the current simd_level(), for callers without a plan
+ * to hold them.
+ */
+double peak_abs(double *x, int len, double peak) {
+	return peak_abs_kernel(simd_level())(x, len, peak);
+}
+
+double peak_copy(double *y, double *x, int len, double peak) {
+	return peak_copy_kernel(simd_level())(y, x, len, peak);
+}
+
+double peak_copy_f(double *y, float *x, int len, double peak) {
+	return peak_copy_f_kernel(simd_level())(y, x, len, peak);
+}
+
+void scale_pcm16(double *y, short *pcm, int len, double scale, Dither *d) {
+	scale_pcm16_kernel(simd_level())(y, pcm, len, scale, d);
+}
+
+void scale_pcm32(double *y, int *pcm, int len, double scale, int bits, Dither *d) {
+	scale_pcm32_kernel(simd_level())(y, pcm, len, scale, bits, d);
+}
+
+void scale_float(double *y, float *out, int len, double scale) {
+	scale_float_kernel(simd_level())(y, out, len, scale);
+}
@@ -0,0 +1,201 @@
+/**
+ * On-disk cache of impulse response spectra.
+ *
+ * Every engine starts by transforming the impulse response (or each of its
+ * partitions), and a render farm convolving thousands of stems with the same
+ * few impulse responses would repeat that work for every one. When
+ * spectrum_cache_dir is set, the scaled spectra are written there once and
+ * memory-mapped read-only by later runs, so a cache hit costs no transform
+ * and no copy.
+ *
+ * A cache file holds a SpectraHeader followed by the REFR & IMFR arrays of
+ * num_spectra * spectra_len doubles each. Its key, used both in the file
+ * name & in the header, is a hash of the impulse response samples plus the
+ * FFT length, the partition length (0 for overlap-add, whose spectra each
+ * cover a whole impulse response channel) and the number of spectra.
+ * Files are written under a temporary name and renamed into place, so
+ * concurrent runs sharing a cache directory never see a partial file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SPECTRA_MAGIC "CONVSPEC"
+#define SPECTRA_VERSION 1
+
+// Directory holding cached spectra, or NULL to disable the cache:
+char * spectrum_cache_dir = NULL;
+
+/**
+ * Layout of the 64-byte header at the start of a cache file. The arrays
+ * that follow start on 64-byte boundaries.
+ */
+typedef struct SpectraHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_len;
+	uint64_t hash;			// spectra_hash() of the impulse response
+	int32_t fft_len;
+	int32_t block_len;		// Partition length, or 0 for overlap-add
+	int32_t num_spectra;	// Partitions or impulse response channels
+	int32_t spectra_len;
+	int64_t stride;			// Doubles from REFR to IMFR
+	char reserved[8];
+} SpectraHeader;
+
+/**
+ * A mapped cache file. REFR & IMFR point into the mapping.
+ */
+typedef struct CachedSpectra {
+	void *map;
+	size_t map_len;
+	double *REFR, *IMFR;
+} CachedSpectra;
+
+/**
+ * Continue a 64-bit FNV-1a hash over len samples of h.
+ */
+uint64_t spectra_hash(uint64_t hash, double *h, int len) {
+	unsigned char *bytes = (unsigned char *)h;
+	size_t num_bytes = sizeof(double) * len;
+	if (hash == 0)
+		hash = 14695981039346656037ULL;
+	for (size_t j = 0; j < num_bytes; j++) {
+		hash ^= bytes[j];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Write the cache file path for a key into path (of size bytes).
+ */
+void spectra_path(char *path, size_t size, uint64_t hash,
+				  int fft_len, int block_len, int num_spectra) {
+	snprintf(path, size, "%s/%016llx-%d-%d-%d.spec", spectrum_cache_dir,
+			 (unsigned long long)hash, fft_len, block_len, num_spectra);
+}
+
+/**
+ * Return the number of doubles from REFR to IMFR in a cache file, rounded
+ * up so that IMFR also starts on a 64-byte boundary.
+ */
+int64_t spectra_stride(int num_spectra, int spectra_len) {
+	int64_t len = (int64_t)num_spectra * spectra_len;
+	return (len + 7) & ~(int64_t)7;
+}
+
+/**
+ * Unmap a CachedSpectra.
+ */
+void spectra_release(CachedSpectra *cs) {
+	if (cs == NULL)
+		return;
+	munmap(cs->map, cs->map_len);
+	free(cs);
+}
+
+/**
+ * Map the cached spectra for a key, or return NULL if the cache is disabled
+ * or holds no matching file.
+ */
+CachedSpectra * spectra_load(uint64_t hash, int fft_len, int block_len,
+							 int num_spectra, int spectra_len) {
+	char path[1024];
+	struct stat st;
+	if (spectrum_cache_dir == NULL)
+		return NULL;
+	spectra_path(path, sizeof(path), hash, fft_len, block_len, num_spectra);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	int64_t stride = spectra_stride(num_spectra, spectra_len);
+	size_t map_len = sizeof(SpectraHeader) + sizeof(double) * 2 * stride;
+	if (fstat(fd, &st) != 0 || st.st_size != (off_t)map_len) {
+		close(fd);
+		return NULL;
+	}
+	void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	SpectraHeader *hdr = (SpectraHeader *)map;
+	CachedSpectra *cs = (CachedSpectra *)malloc(sizeof(CachedSpectra));
+	if (cs == NULL || memcmp(hdr->magic, SPECTRA_MAGIC, 8) != 0 ||
+		hdr->version != SPECTRA_VERSION ||
+		hdr->header_len != sizeof(SpectraHeader) || hdr->hash != hash ||
+		hdr->fft_len != fft_len || hdr->block_len != block_len ||
+		hdr->num_spectra != num_spectra || hdr->spectra_len != spectra_len ||
+		hdr->stride != stride) {
+		free(cs);
+		munmap(map, map_len);
+		return NULL;
+	}
+	cs->map = map;
+	cs->map_len = map_len;
+	cs->REFR = (double *)((char *)map + sizeof(SpectraHeader));
+	cs->IMFR = cs->REFR + stride;
+	return cs;
+}
+
+/**
+ * Write spectra to the cache for a key. Failure only costs a recomputation
+ * next time, so it is reported but otherwise ignored.
+ */
+void spectra_store(uint64_t hash, int fft_len, int block_len,
+				   int num_spectra, int spectra_len,
+				   double *REFR, double *IMFR) {
+	char path[1024], tmp_path[1100];
+	if (spectrum_cache_dir == NULL)
+		return;
+	spectra_path(path, sizeof(path), hash, fft_len, block_len, num_spectra);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	SpectraHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SPECTRA_MAGIC, 8);
+	hdr.version = SPECTRA_VERSION;
+	hdr.header_len = sizeof(SpectraHeader);
+	hdr.hash = hash;
+	hdr.fft_len = fft_len;
+	hdr.block_len = block_len;
+	hdr.num_spectra = num_spectra;
+	hdr.spectra_len = spectra_len;
+	hdr.stride = spectra_stride(num_spectra, spectra_len);
+
+	size_t len = (size_t)num_spectra * spectra_len;
+	size_t pad = hdr.stride - len;
+	double zeros[8] = {0.0};
+	// A unique temporary file, as other threads & processes may be storing
+	// the same key at the same time; readable by all, like the cache dir:
+	int fd = mkstemp(tmp_path);
+	FILE *fp = (fd == -1) ? NULL : fdopen(fd, "wb");
+	if (fp == NULL) {
+		printf("Failed to write to the spectrum cache at %s.\n", spectrum_cache_dir);
+		if (fd != -1) {
+			close(fd);
+			remove(tmp_path);
+		}
+		return;
+	}
+	fchmod(fd, 0644);
+	int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+			 fwrite(REFR, sizeof(double), len, fp) == len &&
+			 fwrite(zeros, sizeof(double), pad, fp) == pad &&
+			 fwrite(IMFR, sizeof(double), len, fp) == len &&
+			 fwrite(zeros, sizeof(double), pad, fp) == pad;
+	if (fclose(fp) != 0)
+		ok = FALSE;
+	if (!ok || rename(tmp_path, path) != 0) {
+		printf("Failed to write to the spectrum cache at %s.\n", spectrum_cache_dir);
+		remove(tmp_path);
+	}
+}
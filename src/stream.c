@@ -0,0 +1,128 @@
+/**
+ * Block-by-block file convolution through an OLAConvolver.
+ *
+ * The input is read one segment at a time and each block of output is
+ * written as soon as it is complete, so only the impulse response and
+ * O(fft_len) frames per channel are ever held in memory. Nothing here
+ * touches the globals of convolve.h, so several files can be streamed at
+ * once on different threads, each through its own convolver.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+/**
+ * Write len frames of per-channel output from a streamed convolution:
+ * track the peak in *peak, interleave into block and either spool the
+ * frames (when spool isn't NULL) or scale & encode them with e. Returns
+ * the number of frames written.
+ */
+sf_count_t stream_block(double **out, int num_channels, sf_count_t len,
+						double *block, SampleSpool *spool, WavEncoder *e,
+						double scale, double *peak) {
+	int c;
+	sf_count_t written;
+	PROFILE_BEGIN(t);
+	for (c = 0; c < num_channels; c++)
+		*peak = peak_abs(out[c], len, *peak);
+	interleave(out, num_channels, len, block);
+	PROFILE_LAP(PROFILE_PEAK, t, sizeof(double) * 2 * len * num_channels);
+	if (spool != NULL) {
+		written = spool_write(spool, block, len);
+		PROFILE_END(PROFILE_WRITE, t, sizeof(float) * len * num_channels);
+		return written;
+	}
+	return encoder_write(e, block, len, scale);
+}
+
+/**
+ * Convolve the open input file in (whose channels must match oc's routing)
+ * through oc, and write the result to outputFile.
+ * normalize selects how the output is normalized (see normalize.c); bound
+ * is the peak bound used by NORMALIZE_BOUND. NORMALIZE_TWO_PASS &
+ * NORMALIZE_BOUND write output_format, NORMALIZE_NONE 32-bit float samples.
+ * The output's peak is stored in *peak. The block buffers are carved out of
+ * arena & released before it returns. Returns the number of frames
+ * written, or -1 on failure.
+ */
+sf_count_t stream_file(OLAConvolver *oc, Arena *arena, double bound, WaveReader *in_wr,
+					   char *outputFile, int normalize, double *peak) {
+	SF_INFO *in_info = &in_wr->info;
+	ChannelRouting *r = &oc->routing;
+	sf_count_t frames_written = -1;
+
+	// Single-pass normalization scales every block by the bound up front:
+	double scale = 1.0;
+	if (normalize == NORMALIZE_BOUND && bound > 0.0)
+		scale = 1.0 / bound;
+
+	// Block buffers, interleaved & per channel. The final flush can be
+	// longer than a segment:
+	int S = oc->segment_len, olap_len = oc->olap_len;
+	int block_len = (S > olap_len) ? S : olap_len;
+	size_t mark = arena_mark(arena);
+	double *IN_BLOCK = (double *)arena_alloc(arena, sizeof(double) * S * r->in_channels);
+	double *OUT_BLOCK = (double *)arena_alloc(arena, sizeof(double) * block_len * r->out_channels);
+	double **in = arena_channels(arena, r->in_channels, S);
+	double **out = arena_channels(arena, r->out_channels, block_len);
+	SampleSpool *spool = NULL;
+	if (normalize == NORMALIZE_TWO_PASS)
+		spool = spool_create(in_info->frames + olap_len, r->out_channels);
+	WavEncoder *enc = encoder_create(outputFile, r->out_channels, in_info->samplerate,
+		(normalize == NORMALIZE_NONE) ? SF_FORMAT_FLOAT : output_format, output_dither);
+
+	if (IN_BLOCK != NULL && OUT_BLOCK != NULL && in != NULL && out != NULL &&
+		enc != NULL && (spool != NULL || normalize != NORMALIZE_TWO_PASS)) {
+
+		// Output frame n depends on input frames n-M+1 ... n, so once
+		// frames_read input frames have been seen, the output is complete
+		// up to frames_read + M - 1 frames:
+		sf_count_t frames_read = 0, len, n;
+		int c, j;
+		frames_written = 0;
+		*peak = DBL_MIN;
+		for (;;) {
+			PROFILE_BEGIN(t);
+			if ((n = read_wav_frames(in_wr, IN_BLOCK, S)) <= 0)
+				break;
+			PROFILE_END(PROFILE_READ, t, sizeof(double) * n * r->in_channels);
+			frames_read += n;
+			for (c = 0; c < r->in_channels; c++)
+				for (j = 0; j < n; j++)
+					in[c][j] = IN_BLOCK[j * r->in_channels + c];
+
+			len = frames_read + olap_len - frames_written;
+			if (len > S)
+				len = S;
+			ola_process(oc, in, n, out, len);
+			frames_written += stream_block(out, r->out_channels, len, OUT_BLOCK,
+										   spool, enc, scale, peak);
+		}
+
+		// Write out the remaining overlap, which also resets oc for the
+		// next file:
+		len = frames_read + olap_len - frames_written;
+		if (len > olap_len)
+			len = olap_len;
+		if (len < 0)
+			len = 0;
+		ola_flush(oc, out, len);
+		frames_written += stream_block(out, r->out_channels, len, OUT_BLOCK,
+									   spool, enc, scale, peak);
+
+		// Second pass, now that the peak is known:
+		if (spool != NULL)
+			frames_written = spool_drain(spool, arena, enc, 1.0 / *peak);
+	}
+	else
+		printf("malloc failed while initializing arrays!\n");
+
+	// Clean up, flushing the encoder's last block:
+	if (enc != NULL && encoder_close(enc) == -1)
+		frames_written = -1;
+	spool_destroy(spool);
+	arena_release(arena, mark);
+	return frames_written;
+}
@@ -0,0 +1,221 @@
+/**
+ * Memory-mapped .wav reading.
+ *
+ * wave_map_open() maps a RIFF/WAVE file (or an RF64 one, for data beyond
+ * 4 GB) read-only and parses its header in place; the sample frames are
+ * then decoded straight out of the mapping, a block at a time, by
+ * wave_map_decode(). Nothing is read up front, so opening even a huge
+ * input is nearly instant, and there is no stdio buffer or intermediate
+ * copy between the page cache and the doubles the engines convolve.
+ *
+ * Little-endian 16, 24 & 32-bit PCM and 32-bit float data are supported,
+ * in plain & WAVE_FORMAT_EXTENSIBLE files; for anything else (and on
+ * big-endian hosts) wave_map_open() returns NULL and callers fall back to
+ * libsndfile. Samples are scaled as sf_read_double() scales them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+typedef struct WaveMap {
+	unsigned char *base;	// The mapping
+	size_t size;
+	unsigned char *data;	// First sample frame
+	long long frames;
+	int channels, samplerate;
+	int bytes;				// Per sample
+	int is_float;
+	long long pos;			// Next frame read by wave_map_readf()
+} WaveMap;
+
+uint32_t wave_u32(unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t wave_u16(unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+uint64_t wave_u64(unsigned char *p) {
+	return wave_u32(p) | ((uint64_t)wave_u32(p + 4) << 32);
+}
+
+/**
+ * Parse the header of the mapped file in wm, filling in its format & data
+ * fields. Returns FALSE if it isn't a .wav file this reader supports.
+ */
+int wave_map_parse(WaveMap *wm) {
+	unsigned char *p = wm->base, *end = wm->base + wm->size;
+	uint64_t rf64_data = 0;
+	int tag = 0, bits = 0, block_align = 0;
+
+	if (wm->size < 12 || memcmp(p + 8, "WAVE", 4) != 0 ||
+		(memcmp(p, "RIFF", 4) != 0 && memcmp(p, "RF64", 4) != 0))
+		return FALSE;
+
+	for (p += 12; end - p >= 8; ) {
+		uint64_t len = wave_u32(p + 4);
+		unsigned char *body = p + 8;
+
+		if (memcmp(p, "ds64", 4) == 0 && len >= 16 && end - body >= 16) {
+			// RF64: the real data chunk size, as its own is 0xFFFFFFFF:
+			rf64_data = wave_u64(body + 8);
+		}
+		else if (memcmp(p, "fmt ", 4) == 0 && len >= 16 && end - body >= 16) {
+			tag = wave_u16(body);
+			wm->channels = wave_u16(body + 2);
+			wm->samplerate = wave_u32(body + 4);
+			block_align = wave_u16(body + 12);
+			bits = wave_u16(body + 14);
+			if (tag == WAVE_FORMAT_EXTENSIBLE && len >= 26 && end - body >= 26)
+				tag = wave_u16(body + 24);
+		}
+		else if (memcmp(p, "data", 4) == 0) {
+			if (len == 0xFFFFFFFF && rf64_data != 0)
+				len = rf64_data;
+
+			// A truncated file holds only the frames that made it to disk:
+			if (len > (uint64_t)(end - body))
+				len = end - body;
+
+			wm->bytes = bits / 8;
+			wm->is_float = (tag == WAVE_FORMAT_IEEE_FLOAT);
+			if (wm->channels < 1 || block_align != wm->bytes * wm->channels ||
+				!((tag == WAVE_FORMAT_PCM && wm->bytes >= 2 && wm->bytes <= 4) ||
+				  (wm->is_float && wm->bytes == 4)))
+				return FALSE;
+			wm->data = body;
+			wm->frames = len / block_align;
+			return TRUE;
+		}
+
+		// Chunks are padded to an even length:
+		if (len + (len & 1) > (uint64_t)(end - body))
+			break;
+		p = body + len + (len & 1);
+	}
+	return FALSE;
+}
+
+/**
+ * Map the .wav file at filepath and parse its header. Returns NULL if it
+ * can't be mapped or isn't in a supported format.
+ */
+WaveMap * wave_map_open(char * filepath) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+	return NULL;
+#endif
+	struct stat st;
+	int fd = open(filepath, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < 12) {
+		close(fd);
+		return NULL;
+	}
+
+	WaveMap *wm = (WaveMap *)calloc(1, sizeof(WaveMap));
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (wm == NULL || base == MAP_FAILED) {
+		if (base != MAP_FAILED)
+			munmap(base, st.st_size);
+		free(wm);
+		return NULL;
+	}
+	wm->base = (unsigned char *)base;
+	wm->size = st.st_size;
+	if (wave_map_parse(wm) == FALSE) {
+		munmap(wm->base, wm->size);
+		free(wm);
+		return NULL;
+	}
+
+	// Frames are read front to back, so have the kernel read ahead:
+	madvise(wm->base, wm->size, MADV_SEQUENTIAL);
+	return wm;
+}
+
+/**
+ * Unmap & free a WaveMap.
+ */
+void wave_map_close(WaveMap *wm) {
+	if (wm == NULL)
+		return;
+	munmap(wm->base, wm->size);
+	free(wm);
+}
+
+/**
+ * Decode count samples at p into y. The loops load through memcpy, so the
+ * data needn't be aligned, and are simple enough to be auto-vectorized.
+ */
+void decode_pcm16(double *y, unsigned char *p, long long count) {
+	int16_t v;
+	for (long long j = 0; j < count; j++) {
+		memcpy(&v, p + j * 2, 2);
+		y[j] = v * (1.0 / 32768.0);
+	}
+}
+
+void decode_pcm24(double *y, unsigned char *p, long long count) {
+	for (long long j = 0; j < count; j++) {
+		int32_t v = (int32_t)((uint32_t)p[j*3] << 8 | (uint32_t)p[j*3+1] << 16 |
+							  (uint32_t)p[j*3+2] << 24);
+		y[j] = v * (1.0 / 2147483648.0);
+	}
+}
+
+void decode_pcm32(double *y, unsigned char *p, long long count) {
+	int32_t v;
+	for (long long j = 0; j < count; j++) {
+		memcpy(&v, p + j * 4, 4);
+		y[j] = v * (1.0 / 2147483648.0);
+	}
+}
+
+void decode_float32(double *y, unsigned char *p, long long count) {
+	float v;
+	for (long long j = 0; j < count; j++) {
+		memcpy(&v, p + j * 4, 4);
+		y[j] = v;
+	}
+}
+
+/**
+ * Decode frames [first, first + frames) of wm, interleaved, into y.
+ */
+void wave_map_decode(WaveMap *wm, double *y, long long first, long long frames) {
+	unsigned char *p = wm->data + first * wm->bytes * wm->channels;
+	long long count = frames * wm->channels;
+	if (wm->is_float)
+		decode_float32(y, p, count);
+	else if (wm->bytes == 2)
+		decode_pcm16(y, p, count);
+	else if (wm->bytes == 3)
+		decode_pcm24(y, p, count);
+	else
+		decode_pcm32(y, p, count);
+}
+
+/**
+ * Decode up to frames frames from the current position of wm into y, like
+ * sf_readf_double(). Returns the number of frames decoded.
+ */
+long long wave_map_readf(WaveMap *wm, double *y, long long frames) {
+	if (frames > wm->frames - wm->pos)
+		frames = wm->frames - wm->pos;
+	wave_map_decode(wm, y, wm->pos, frames);
+	wm->pos += frames;
+	return frames;
+}
@@ -10,21 +10,28 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 #include <sndfile.h>
 
 #define TRUE 1
 #define FALSE 0
 
+#include "wave_map.c"
+
 typedef struct WaveData {
-	int length;
-	double *sampleData;
+	int length;			// Frames, i.e. samples per channel
+	int channels;
+	int samplerate;
+	double *sampleData;	// length * channels interleaved samples
 } WaveData;
 
 /**
- * Read the contents of a .wav file and return a WaveData struct.
+ * Read the contents of a .wav file and return a WaveData struct. Files
+ * wave_map_open() supports are decoded straight out of a mapping; others
+ * are read through libsndfile.
  */
 WaveData read_wav(char * filepath, int verbose) {
-	SNDFILE *sf;
+	SNDFILE *sf = NULL;
     SF_INFO info;
     int num, num_samples;
     double *buff;
@@ -33,12 +40,31 @@ WaveData read_wav(char * filepath, int verbose) {
     // Initialize WaveData struct:
 	WaveData wave_data;
 	wave_data.length = -1;
+	wave_data.channels = 0;
+	wave_data.samplerate = 0;
     
     // Open the WAVE file:
-    info.format = 0;
-    sf = sf_open(filepath, SFM_READ, &info);
-    if (sf == NULL) {
-		printf("Failed to open the file.\n");
+    WaveMap *wm = wave_map_open(filepath);
+    if (wm != NULL) {
+		info.frames = wm->frames;
+		info.samplerate = wm->samplerate;
+		info.channels = wm->channels;
+	}
+	else {
+		info.format = 0;
+		sf = sf_open(filepath, SFM_READ, &info);
+		if (sf == NULL) {
+			printf("Failed to open the file.\n");
+			return wave_data;
+		}
+	}
+	
+	// WaveData holds int lengths; longer files can only be streamed:
+	if ((long long)info.frames * info.channels > INT_MAX) {
+		printf("The file is too long to read into memory; stream it with -s.\n");
+		wave_map_close(wm);
+		if (sf != NULL)
+			sf_close(sf);
 		return wave_data;
 	}
 	
@@ -57,17 +83,174 @@ WaveData read_wav(char * filepath, int verbose) {
 	
 	// Allocate space for the sample data, then load it:
     buff = (double *) malloc(num_samples * sizeof(double));
-    num = sf_read_double(sf, buff, num_samples);
-    sf_close(sf);
+    if (buff == NULL) {
+		printf("malloc failed while reading %s!\n", filepath);
+		wave_map_close(wm);
+		if (sf != NULL)
+			sf_close(sf);
+		return wave_data;
+	}
+    if (wm != NULL) {
+		num = num_samples;
+		wave_map_decode(wm, buff, 0, f);
+		wave_map_close(wm);
+	}
+	else {
+		num = sf_read_double(sf, buff, num_samples);
+		sf_close(sf);
+	}
     
     if (verbose == TRUE) printf("samples read: %d\n\n", num);
 	
 	// Update WaveData struct and return:
-	wave_data.length = num_samples;
+	wave_data.length = f;
+	wave_data.channels = c;
+	wave_data.samplerate = sr;
 	wave_data.sampleData = buff;
 	return wave_data;
 }
 
+/**
+ * Release the arrays returned by deinterleave().
+ */
+void free_channels(double **channels, int num_channels) {
+	if (channels == NULL)
+		return;
+	for (int ch = 0; ch < num_channels; ch++)
+		free(channels[ch]);
+	free(channels);
+}
+
+/**
+ * Allocate num_channels arrays of length samples each.
+ * Returns NULL if any allocation fails.
+ */
+double ** alloc_channels(int num_channels, int length) {
+	double **channels = (double **)calloc(num_channels, sizeof(double *));
+	if (channels == NULL)
+		return NULL;
+	for (int ch = 0; ch < num_channels; ch++) {
+		channels[ch] = (double *)malloc(sizeof(double) * length);
+		if (channels[ch] == NULL) {
+			free_channels(channels, num_channels);
+			return NULL;
+		}
+	}
+	return channels;
+}
+
+/**
+ * Split the interleaved sample data of a WaveData struct into the arrays
+ * channels[], of wave_data.length samples each.
+ */
+void deinterleave_into(WaveData wave_data, double **channels) {
+	int c = wave_data.channels;
+	for (int ch = 0; ch < c; ch++)
+		for (int f = 0; f < wave_data.length; f++)
+			channels[ch][f] = wave_data.sampleData[f * c + ch];
+}
+
+/**
+ * Split the interleaved sample data of a WaveData struct into one newly
+ * allocated array of wave_data.length samples per channel.
+ * Returns NULL if any allocation fails.
+ */
+double ** deinterleave(WaveData wave_data) {
+	double **channels = alloc_channels(wave_data.channels, wave_data.length);
+	if (channels != NULL)
+		deinterleave_into(wave_data, channels);
+	return channels;
+}
+
+/**
+ * Interleave num_channels arrays of length samples each into sample_data.
+ */
+void interleave(double **channels, int num_channels, int length,
+				double *sample_data) {
+	for (int ch = 0; ch < num_channels; ch++)
+		for (int f = 0; f < length; f++)
+			sample_data[f * num_channels + ch] = channels[ch][f];
+}
+
+/**
+ * A .wav file being read a block at a time: from a mapping (see
+ * wave_map.c) if wave_map_open() supports it, or else through libsndfile.
+ */
+typedef struct WaveReader {
+	WaveMap *map;
+	SNDFILE *sf;
+	SF_INFO info;		// Header; only frames, samplerate & channels if mapped
+} WaveReader;
+
+/**
+ * Release a WaveReader & close its file.
+ */
+void close_wav(WaveReader *wr) {
+	if (wr == NULL)
+		return;
+	wave_map_close(wr->map);
+	if (wr->sf != NULL)
+		sf_close(wr->sf);
+	free(wr);
+}
+
+/**
+ * Open a .wav file to be read a block at a time with read_wav_frames().
+ * Returns NULL on failure.
+ */
+WaveReader * open_wav(char * filepath, int verbose) {
+	WaveReader *wr = (WaveReader *)calloc(1, sizeof(WaveReader));
+	if (wr == NULL) {
+		printf("malloc failed while opening the file!\n");
+		return NULL;
+	}
+	if ((wr->map = wave_map_open(filepath)) != NULL) {
+		wr->info.frames = wr->map->frames;
+		wr->info.samplerate = wr->map->samplerate;
+		wr->info.channels = wr->map->channels;
+	}
+	else if ((wr->sf = sf_open(filepath, SFM_READ, &wr->info)) == NULL) {
+		printf("Failed to open the file.\n");
+		free(wr);
+		return NULL;
+	}
+	if (verbose == TRUE) {
+		printf("frames=%lld\n", (long long)wr->info.frames);
+		printf("samplerate=%d\n", wr->info.samplerate);
+		printf("channels=%d\n\n", wr->info.channels);
+	}
+	return wr;
+}
+
+/**
+ * Read up to frames interleaved frames from wr into y, like
+ * sf_readf_double(). Returns the number of frames read.
+ */
+sf_count_t read_wav_frames(WaveReader *wr, double *y, sf_count_t frames) {
+	if (wr->map != NULL)
+		return wave_map_readf(wr->map, y, frames);
+	return sf_readf_double(wr->sf, y, frames);
+}
+
+/**
+ * Create a .wav file with the given sample format (e.g. SF_FORMAT_PCM_16),
+ * to be written a block at a time with sf_writef_double(). SF_FORMAT_FLOAT
+ * samples may exceed [-1.0, 1.0], so that data needn't be normalized first.
+ * Returns NULL on failure.
+ */
+SNDFILE * create_wav(char * filepath, int num_channels, int samplerate,
+					 int sample_format) {
+	SF_INFO info;
+	info.samplerate = samplerate;
+	info.channels = num_channels;
+	info.format = SF_FORMAT_WAV | sample_format | SF_ENDIAN_LITTLE;
+	
+	SNDFILE *sf = sf_open(filepath, SFM_WRITE, &info);
+	if (sf == NULL)
+		printf("Failed to create the file.\n");
+	return sf;
+}
+
 /**
  * Write the contents of an array containing convolved audio 
  * samples to disk.
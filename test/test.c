@@ -4,7 +4,9 @@
  *     - https://www.systutorials.com/docs/linux/man/1-checkmk/
  * 
  * Compile with:
- *     gcc test.c -lcheck -lsndfile -o test
+ *     gcc test.c -lcheck -lsndfile -lpthread -o test
+ * 
+ * (add -DCONVOLVE_PROFILE to test the profiling counters too).
  * 
  * Run with:
  *     ./test
@@ -16,6 +18,8 @@
 #include <float.h>
 #include <check.h>
 #include <string.h>
+#include <math.h>
+#include <dirent.h>
 #include "../src/convolve.h"
 
 #define TRUE 1
@@ -26,6 +30,144 @@ char * input_suffix = "A4.Audio/DrySounds/Guitar/GuitarDry.wav";
 char * ir_suffix = "A4.Audio/ImpulseResponses/Mono/big_hall.wav";
 char * out_suffix = "A4/src/out.wav";
 char input_path[200], ir_path[200], out_path[200];
+
+/**
+ * Fill a WaveData struct with length pseudo-random samples in [-0.5, 0.5].
+ */
+WaveData synthetic_wave(int length, unsigned int seed) {
+	WaveData wave_data;
+	wave_data.length = length;
+	wave_data.channels = 1;
+	wave_data.samplerate = 44100;
+	wave_data.sampleData = (double *)malloc(sizeof(double) * length);
+	srand(seed);
+	for (int i = 0; i < length; i++)
+		wave_data.sampleData[i] = ((double)rand() / RAND_MAX) - 0.5;
+	return wave_data;
+}
+
+/**
+ * Convolve X & H directly into a newly allocated array of length N+M-1.
+ */
+double * direct_convolution() {
+	double *ref = (double *)calloc(N + M - 1, sizeof(double));
+	for (int i = 0; i < N; i++)
+		for (int j = 0; j < M; j++)
+			ref[i+j] += X.sampleData[i] * H.sampleData[j];
+	return ref;
+}
+
+/**
+ * Run a convolution engine over synthetic input & IR data of the given
+ * lengths and return its maximum absolute error against the direct form.
+ */
+double engine_error(void (*engine_fn)(void), int input_len, int ir_len) {
+	X = synthetic_wave(input_len, 1);
+	H = synthetic_wave(ir_len, 2);
+	N = X.length;
+	M = H.length;
+	P = N + M - 1;
+	
+	double *ref = direct_convolution();
+	int ref_len = P;
+	double *x = X.sampleData;
+	Y = (double *)malloc(sizeof(double) * P);
+	engine_fn();
+	
+	// Every engine outputs exactly N+M-1 samples, leaving X where it was:
+	ck_assert_int_eq(P, ref_len);
+	ck_assert(X.sampleData == x);
+	
+	double err = 0.0;
+	for (int i = 0; i < ref_len; i++)
+		if (fabs(Y[i] - ref[i]) > err)
+			err = fabs(Y[i] - ref[i]);
+	
+	free(ref);
+	free(Y);
+	free(X.sampleData);
+	free(H.sampleData);
+	return err;
+}
+	 
+/**
+ * Run convolve_multichannel() over synthetic interleaved input & IR data
+ * with the given channel counts and return its maximum absolute error
+ * against the direct form of every route, summed per output channel.
+ */
+double multichannel_error(int in_channels, int ir_channels,
+						  int input_len, int ir_len) {
+	X = synthetic_wave(input_len * in_channels, 1);
+	X.length = input_len;
+	X.channels = in_channels;
+	H = synthetic_wave(ir_len * ir_channels, 2);
+	H.length = ir_len;
+	H.channels = ir_channels;
+	N = X.length;
+	M = H.length;
+	P = N + M - 1;
+	
+	ChannelRouting r;
+	channel_routing(in_channels, ir_channels, &r);
+	int out_channels = convolve_multichannel();
+	if (out_channels != r.out_channels)
+		return DBL_MAX;
+	
+	double **x = deinterleave(X), **h = deinterleave(H);
+	double err = 0.0;
+	for (int o = 0; o < out_channels; o++) {
+		double *ref = (double *)calloc(P, sizeof(double));
+		for (int t = 0; t < r.num_routes; t++) {
+			if (r.route_out[t] != o)
+				continue;
+			for (int i = 0; i < N; i++)
+				for (int j = 0; j < M; j++)
+					ref[i+j] += x[r.route_in[t]][i] * h[r.route_ir[t]][j];
+		}
+		for (int i = 0; i < P; i++)
+			if (fabs(Y[i * out_channels + o] - ref[i]) > err)
+				err = fabs(Y[i * out_channels + o] - ref[i]);
+		free(ref);
+	}
+	
+	free_channels(x, in_channels);
+	free_channels(h, ir_channels);
+	free(Y);
+	free(X.sampleData);
+	free(H.sampleData);
+	return err;
+}
+	 
+/**
+ * Write a WaveData struct to path as a 32-bit float WAV file, so that it can
+ * be read back without quantization.
+ */
+void write_float_wav(char * path, WaveData wave_data) {
+	SNDFILE *sf = create_wav(path, wave_data.channels, 44100, SF_FORMAT_FLOAT);
+	sf_writef_double(sf, wave_data.sampleData, wave_data.length);
+	sf_close(sf);
+}
+	 
+/**
+ * Return the number of files in dir, deleting them if clear is TRUE.
+ */
+int cache_files(char * dir, int clear) {
+	char path[1024];
+	struct dirent *entry;
+	int count = 0;
+	DIR *d = opendir(dir);
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		count++;
+		if (clear == TRUE) {
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			remove(path);
+		}
+	}
+	closedir(d);
+	return count;
+}
 	 
 START_TEST(test_initialize) {
 	
@@ -68,6 +210,1263 @@ START_TEST(test_convolve) {
 		"Output data max should be <= 1.0. Max: %.3f", max);
 }
 END_TEST
+
+START_TEST(test_fft_plan_matches_realft) {
+	
+	for (int n = 2; n <= 4096; n *= 2) {
+		WaveData a = synthetic_wave(n, 3), b = synthetic_wave(n, 3);
+		FFTPlan *plan = fft_plan_create(n);
+		ck_assert(plan != NULL);
+		
+		// realft() is 1-based, so give it a leading pad slot:
+		double *buf = (double *)malloc(sizeof(double) * (n + 1));
+		memcpy(buf + 1, a.sampleData, sizeof(double) * n);
+		
+		double err = 0.0;
+		for (int isign = 1; isign >= -1; isign -= 2) {
+			realft(buf, n, isign);
+			rfft_execute(plan, b.sampleData, isign);
+			for (int i = 0; i < n; i++)
+				if (fabs(buf[i+1] - b.sampleData[i]) > err)
+					err = fabs(buf[i+1] - b.sampleData[i]);
+		}
+		ck_assert_msg(err < 1e-9,
+			"Planned FFT of length %d should match realft. Max error: %g", n, err);
+		
+		fft_plan_destroy(plan);
+		free(buf);
+		free(a.sampleData);
+		free(b.sampleData);
+	}
+}
+END_TEST
+
+START_TEST(test_split_rfft_matches_packed) {
+
+	for (int n = 2; n <= 4096; n *= 2) {
+		int x_len = n / 2 + 1;
+		WaveData x = synthetic_wave(x_len, 11), packed = synthetic_wave(n, 0);
+		double *re = (double *)malloc(sizeof(double) * (n / 2 + 1));
+		double *im = (double *)malloc(sizeof(double) * (n / 2 + 1));
+		double *y = (double *)malloc(sizeof(double) * n);
+		FFTPlan *plan = fft_plan_create(n);
+
+		// Forward: compare with the packed layout of rfft_execute():
+		for (int i = 0; i < n; i++)
+			packed.sampleData[i] = (i < x_len) ? x.sampleData[i] : 0.0;
+		rfft_execute(plan, packed.sampleData, 1);
+		rfft_forward(plan, x.sampleData, x_len, re, im);
+
+		double err = fabs(re[0] - packed.sampleData[0]) +
+					 fabs(re[n/2] - packed.sampleData[1]) + fabs(im[0]) + fabs(im[n/2]);
+		for (int k = 1; k < n / 2; k++) {
+			err = fmax(err, fabs(re[k] - packed.sampleData[k*2]));
+			err = fmax(err, fabs(im[k] - packed.sampleData[k*2+1]));
+		}
+		ck_assert_msg(err < 1e-9,
+			"Split FFT of length %d should match packed FFT. Max error: %g", n, err);
+
+		// Inverse: the round trip should recover the zero-padded input:
+		rfft_inverse(plan, re, im, y);
+		err = 0.0;
+		for (int i = 0; i < n; i++)
+			err = fmax(err, fabs(y[i] * 2.0 / n - ((i < x_len) ? x.sampleData[i] : 0.0)));
+		ck_assert_msg(err < 1e-9,
+			"Split FFT of length %d should invert. Max error: %g", n, err);
+
+		fft_plan_destroy(plan);
+		free(x.sampleData);
+		free(packed.sampleData);
+		free(re);
+		free(im);
+		free(y);
+	}
+}
+END_TEST
+
+START_TEST(test_fft_simd_levels_match_scalar) {
+
+	// Lengths with odd & even numbers of radix-2 stages, and stages both
+	// narrower & wider than every vector width:
+	for (int n = 2; n <= 8192; n *= 2) {
+		WaveData ref = synthetic_wave(n, 4);
+		simd_set_level(SIMD_SCALAR);
+		FFTPlan *plan = fft_plan_create(n);
+		rfft_execute(plan, ref.sampleData, 1);
+		fft_plan_destroy(plan);
+
+		for (int level = SIMD_SSE2; level <= simd_detected; level++) {
+			WaveData a = synthetic_wave(n, 4);
+			simd_set_level(level);
+			plan = fft_plan_create(n);
+			rfft_execute(plan, a.sampleData, 1);
+
+			double err = 0.0;
+			for (int i = 0; i < n; i++)
+				if (fabs(a.sampleData[i] - ref.sampleData[i]) > err)
+					err = fabs(a.sampleData[i] - ref.sampleData[i]);
+			ck_assert_msg(err < 1e-9,
+				"%s FFT of length %d should match scalar. Max error: %g",
+				simd_name(level), n, err);
+
+			fft_plan_destroy(plan);
+			free(a.sampleData);
+		}
+		free(ref.sampleData);
+	}
+	simd_set_level(-1);
+}
+END_TEST
+
+START_TEST(test_mixed_radix_fft_matches_dft) {
+
+	// Every odd radix, alone & mixed, after radix-2 stages narrower &
+	// wider than every vector width, and with no radix-2 stage at all:
+	int lengths[] = {6, 10, 14, 12, 30, 2*3*64, 2*5*128, 2*7*32, 2*9*25*8,
+					 2*3*5*7*16, 2*3*3*5*7*8, 2*343, 2*125*4};
+	int num_lengths = sizeof(lengths) / sizeof(int);
+
+	for (int t = 0; t < num_lengths; t++) {
+		int n = lengths[t], nn = n / 2;
+		WaveData x = synthetic_wave(n, 9);
+		double *RE = (double *)malloc(sizeof(double) * (nn + 1));
+		double *IM = (double *)malloc(sizeof(double) * (nn + 1));
+		double *re = (double *)malloc(sizeof(double) * (nn + 1));
+		double *im = (double *)malloc(sizeof(double) * (nn + 1));
+		double *y = (double *)malloc(sizeof(double) * n);
+		float *xf = (float *)malloc(sizeof(float) * n);
+		float *yf = (float *)malloc(sizeof(float) * n);
+		float *ref = (float *)malloc(sizeof(float) * (nn + 1));
+		float *imf = (float *)malloc(sizeof(float) * (nn + 1));
+		for (int j = 0; j < n; j++)
+			xf[j] = (float)x.sampleData[j];
+
+		// The naive DFT, with the same sign convention:
+		double peak = 0.0;
+		for (int k = 0; k <= nn; k++) {
+			RE[k] = IM[k] = 0.0;
+			for (int j = 0; j < n; j++) {
+				RE[k] += x.sampleData[j] * cos(TWO_PI * ((long)j * k % n) / n);
+				IM[k] += x.sampleData[j] * sin(TWO_PI * ((long)j * k % n) / n);
+			}
+			peak = fmax(peak, hypot(RE[k], IM[k]));
+		}
+
+		for (int level = SIMD_SCALAR; level <= simd_detected; level++) {
+			simd_set_level(level);
+			FFTPlan *plan = fft_plan_create(n);
+			FFTPlanF *plan_f = fft_plan_create_f(n);
+			ck_assert(plan != NULL && plan_f != NULL);
+
+			rfft_forward(plan, x.sampleData, n, re, im);
+			rfft_forward_f(plan_f, xf, n, ref, imf);
+			double err = 0.0, err_f = 0.0;
+			for (int k = 0; k <= nn; k++) {
+				err = fmax(err, hypot(re[k] - RE[k], im[k] - IM[k]));
+				err_f = fmax(err_f, hypot(ref[k] - RE[k], imf[k] - IM[k]));
+			}
+			ck_assert_msg(err < 1e-9,
+				"%s FFT of length %d should match the DFT. Max error: %g",
+				simd_name(level), n, err);
+			ck_assert_msg(err_f < 1e-5 * peak,
+				"%s float FFT of length %d should match the DFT. Relative error: %g",
+				simd_name(level), n, err_f / peak);
+
+			// And the inverses should round-trip:
+			rfft_inverse(plan, re, im, y);
+			rfft_inverse_f(plan_f, ref, imf, yf);
+			err = err_f = 0.0;
+			for (int j = 0; j < n; j++) {
+				err = fmax(err, fabs(y[j] * 2.0 / n - x.sampleData[j]));
+				err_f = fmax(err_f, fabs(yf[j] * 2.0 / n - xf[j]));
+			}
+			ck_assert_msg(err < 1e-9 && err_f < 1e-5,
+				"%s FFTs of length %d should invert. Max errors: %g, %g",
+				simd_name(level), n, err, err_f);
+
+			fft_plan_destroy(plan);
+			fft_plan_destroy_f(plan_f);
+		}
+		simd_set_level(-1);
+		free(x.sampleData);
+		free(RE);
+		free(IM);
+		free(re);
+		free(im);
+		free(y);
+		free(xf);
+		free(yf);
+		free(ref);
+		free(imf);
+	}
+}
+END_TEST
+
+START_TEST(test_spectrum_kernels_match_scalar) {
+
+	// An odd length leaves a remainder after every vector loop:
+	int len = 1025;
+	WaveData xr = synthetic_wave(len, 5), xi = synthetic_wave(len, 6);
+	WaveData hr = synthetic_wave(len, 7), hi = synthetic_wave(len, 8);
+	WaveData ref_r = synthetic_wave(len, 9), ref_i = synthetic_wave(len, 10);
+	WaveData yr = synthetic_wave(len, 9), yi = synthetic_wave(len, 10);
+
+	for (int accumulate = FALSE; accumulate <= TRUE; accumulate++) {
+		for (int level = SIMD_SSE2; level <= simd_level(); level++) {
+			memcpy(yr.sampleData, ref_r.sampleData, sizeof(double) * len);
+			memcpy(yi.sampleData, ref_i.sampleData, sizeof(double) * len);
+			spectrum_kernel(SIMD_SCALAR, accumulate)(ref_r.sampleData, ref_i.sampleData,
+				xr.sampleData, xi.sampleData, hr.sampleData, hi.sampleData, len);
+			spectrum_kernel(level, accumulate)(yr.sampleData, yi.sampleData,
+				xr.sampleData, xi.sampleData, hr.sampleData, hi.sampleData, len);
+
+			double err = 0.0;
+			for (int j = 0; j < len; j++) {
+				if (fabs(yr.sampleData[j] - ref_r.sampleData[j]) > err)
+					err = fabs(yr.sampleData[j] - ref_r.sampleData[j]);
+				if (fabs(yi.sampleData[j] - ref_i.sampleData[j]) > err)
+					err = fabs(yi.sampleData[j] - ref_i.sampleData[j]);
+			}
+			ck_assert_msg(err < 1e-12,
+				"%s spectrum %s should match scalar. Max error: %g",
+				simd_name(level), accumulate ? "mac" : "mul", err);
+		}
+	}
+
+	free(xr.sampleData);
+	free(xi.sampleData);
+	free(hr.sampleData);
+	free(hi.sampleData);
+	free(ref_r.sampleData);
+	free(ref_i.sampleData);
+	free(yr.sampleData);
+	free(yi.sampleData);
+}
+END_TEST
+
+START_TEST(test_float_fft_matches_double) {
+
+	// Single-precision transforms at every SIMD level should agree with the
+	// double transform to within float rounding of the spectrum's peak:
+	for (int n = 2; n <= 8192; n *= 2) {
+		WaveData x = synthetic_wave(n, 4);
+		float *xf = (float *)malloc(sizeof(float) * n);
+		float *y = (float *)malloc(sizeof(float) * n);
+		float *re = (float *)malloc(sizeof(float) * (n / 2 + 1));
+		float *im = (float *)malloc(sizeof(float) * (n / 2 + 1));
+		double *RE = (double *)malloc(sizeof(double) * (n / 2 + 1));
+		double *IM = (double *)malloc(sizeof(double) * (n / 2 + 1));
+		for (int j = 0; j < n; j++)
+			xf[j] = (float)x.sampleData[j];
+		simd_set_level(SIMD_SCALAR);
+		FFTPlan *plan = fft_plan_create(n);
+		rfft_forward(plan, x.sampleData, n, RE, IM);
+		fft_plan_destroy(plan);
+		double peak = 0.0;
+		for (int k = 0; k <= n / 2; k++)
+			if (hypot(RE[k], IM[k]) > peak)
+				peak = hypot(RE[k], IM[k]);
+
+		for (int level = SIMD_SCALAR; level <= simd_detected; level++) {
+			simd_set_level(level);
+			FFTPlanF *plan_f = fft_plan_create_f(n);
+			rfft_forward_f(plan_f, xf, n, re, im);
+			double err = 0.0;
+			for (int k = 0; k <= n / 2; k++)
+				if (hypot(re[k] - RE[k], im[k] - IM[k]) > err)
+					err = hypot(re[k] - RE[k], im[k] - IM[k]);
+			ck_assert_msg(err < 1e-5 * peak,
+				"%s float FFT of length %d should match double. Relative error: %g",
+				simd_name(level), n, err / peak);
+
+			// And the inverse should round-trip:
+			rfft_inverse_f(plan_f, re, im, y);
+			err = 0.0;
+			for (int j = 0; j < n; j++)
+				if (fabs(y[j] * 2.0 / n - xf[j]) > err)
+					err = fabs(y[j] * 2.0 / n - xf[j]);
+			ck_assert_msg(err < 1e-5,
+				"%s float FFT of length %d should invert. Max error: %g",
+				simd_name(level), n, err);
+			fft_plan_destroy_f(plan_f);
+		}
+		free(x.sampleData);
+		free(xf);
+		free(y);
+		free(re);
+		free(im);
+		free(RE);
+		free(IM);
+	}
+	simd_set_level(-1);
+}
+END_TEST
+
+START_TEST(test_float_spectrum_kernels_match_scalar) {
+
+	// An odd length leaves a remainder after every vector loop:
+	int len = 1025, j;
+	float *buf[8];
+	for (int b = 0; b < 8; b++) {
+		WaveData w = synthetic_wave(len, 5 + b);
+		buf[b] = (float *)malloc(sizeof(float) * len);
+		for (j = 0; j < len; j++)
+			buf[b][j] = (float)w.sampleData[j];
+		free(w.sampleData);
+	}
+	float *xr = buf[0], *xi = buf[1], *hr = buf[2], *hi = buf[3];
+	float *ref_r = buf[4], *ref_i = buf[5], *yr = buf[6], *yi = buf[7];
+	float *acc_r = (float *)malloc(sizeof(float) * len);
+	float *acc_i = (float *)malloc(sizeof(float) * len);
+	memcpy(acc_r, ref_r, sizeof(float) * len);
+	memcpy(acc_i, ref_i, sizeof(float) * len);
+
+	for (int accumulate = FALSE; accumulate <= TRUE; accumulate++) {
+		for (int level = SIMD_SSE2; level <= simd_level(); level++) {
+			memcpy(ref_r, acc_r, sizeof(float) * len);
+			memcpy(ref_i, acc_i, sizeof(float) * len);
+			memcpy(yr, acc_r, sizeof(float) * len);
+			memcpy(yi, acc_i, sizeof(float) * len);
+			spectrum_kernel_f(SIMD_SCALAR, accumulate)(ref_r, ref_i, xr, xi, hr, hi, len);
+			spectrum_kernel_f(level, accumulate)(yr, yi, xr, xi, hr, hi, len);
+
+			// FMA contraction may differ from the scalar rounding:
+			double err = 0.0;
+			for (j = 0; j < len; j++) {
+				if (fabs(yr[j] - ref_r[j]) > err)
+					err = fabs(yr[j] - ref_r[j]);
+				if (fabs(yi[j] - ref_i[j]) > err)
+					err = fabs(yi[j] - ref_i[j]);
+			}
+			ck_assert_msg(err < 1e-6,
+				"%s float spectrum %s should match scalar. Max error: %g",
+				simd_name(level), accumulate ? "mac" : "mul", err);
+		}
+	}
+
+	for (int b = 0; b < 8; b++)
+		free(buf[b]);
+	free(acc_r);
+	free(acc_i);
+}
+END_TEST
+
+START_TEST(test_float_overlap_add_accuracy) {
+	
+	// Run both precisions over the same input, then compare their outputs
+	// once each is normalized by its peak, as they would be written:
+	X = synthetic_wave(48000, 1);
+	H = synthetic_wave(4000, 2);
+	N = X.length;
+	M = H.length;
+	P = N + M - 1;
+	double *y[2];
+	for (int p = PRECISION_DOUBLE; p <= PRECISION_FLOAT; p++) {
+		precision = p;
+		max = DBL_MIN;
+		Y = (double *)malloc(sizeof(double) * P);
+		run_engine();
+		for (i = 0; i < P; i++)
+			Y[i] /= max;
+		y[p] = Y;
+	}
+	precision = PRECISION_DOUBLE;
+	
+	// The error should sit well below 16-bit quantization, whose noise is
+	// LSB / sqrt(12) RMS:
+	double lsb = 1.0 / 32768, err = 0.0, sum = 0.0;
+	for (i = 0; i < P; i++) {
+		double d = fabs(y[PRECISION_FLOAT][i] - y[PRECISION_DOUBLE][i]);
+		if (d > err)
+			err = d;
+		sum += d * d;
+	}
+	double rms = sqrt(sum / P), noise = lsb / sqrt(12.0);
+	ck_assert_msg(err < lsb / 2,
+		"Float overlap-add should stay within half an LSB of double. Max error: %g",
+		err);
+	ck_assert_msg(rms < noise / 10,
+		"Float overlap-add error should be 20 dB below 16-bit noise. Margin: %.1f dB",
+		20 * log10(noise / rms));
+	
+	free(y[PRECISION_DOUBLE]);
+	free(y[PRECISION_FLOAT]);
+	free(X.sampleData);
+	free(H.sampleData);
+}
+END_TEST
+
+START_TEST(test_peak_kernels_match_scalar) {
+	
+	// An odd length leaves a remainder after every vector loop; the peak
+	// is planted in the vector body, the remainder & at a negative sample:
+	int len = 1029;
+	WaveData x = synthetic_wave(len, 11);
+	double *y = (double *)malloc(sizeof(double) * len);
+	float *xf = (float *)malloc(sizeof(float) * len);
+	for (int where = 0; where < 3; where++) {
+		int at = (where == 0) ? 517 : (where == 1) ? len - 2 : 8;
+		x.sampleData[at] = (where == 2) ? -0.75 : 0.75;
+		for (int j = 0; j < len; j++)
+			xf[j] = (float)x.sampleData[j];
+		double ref = peak_abs_scalar(x.sampleData, len, 0.0);
+		ck_assert(ref == 0.75);
+		
+		for (int level = SIMD_SCALAR; level <= simd_level(); level++) {
+			ck_assert_msg(peak_abs_kernel(level)(x.sampleData, len, 0.0) == ref,
+				"%s peak_abs should match scalar", simd_name(level));
+			ck_assert_msg(peak_abs_kernel(level)(x.sampleData, len, 2.0) == 2.0,
+				"%s peak_abs should keep a larger running peak", simd_name(level));
+			
+			memset(y, 0, sizeof(double) * len);
+			ck_assert(peak_copy_kernel(level)(y, x.sampleData, len, 0.0) == ref);
+			ck_assert_msg(memcmp(y, x.sampleData, sizeof(double) * len) == 0,
+				"%s peak_copy should copy every sample", simd_name(level));
+			
+			memset(y, 0, sizeof(double) * len);
+			ck_assert(peak_copy_f_kernel(level)(y, xf, len, 0.0) == 0.75);
+			for (int j = 0; j < len; j++)
+				ck_assert_msg(y[j] == (double)xf[j],
+					"%s peak_copy_f should convert sample %d", simd_name(level), j);
+		}
+		x.sampleData[at] = 0.0;
+	}
+	
+	free(x.sampleData);
+	free(y);
+	free(xf);
+}
+END_TEST
+
+START_TEST(test_scale_pcm16_matches_scalar) {
+	
+	// Include samples that clip both ways once scaled, and exact ties:
+	int len = 1029;
+	WaveData x = synthetic_wave(len, 12);
+	x.sampleData[3] = 2.0;
+	x.sampleData[4] = -2.0;
+	x.sampleData[5] = 0.5 / 32767.0;
+	x.sampleData[6] = 1.5 / 32767.0;
+	double *ref = (double *)malloc(sizeof(double) * len);
+	double *y = (double *)malloc(sizeof(double) * len);
+	short *ref_pcm = (short *)malloc(sizeof(short) * len);
+	short *pcm = (short *)malloc(sizeof(short) * len);
+	memcpy(ref, x.sampleData, sizeof(double) * len);
+	scale_pcm16_scalar(ref, ref_pcm, len, 1.0 / 0.5, NULL);
+	ck_assert(ref_pcm[3] == 32767 && ref_pcm[4] == -32768);
+	ck_assert(ref_pcm[5] == 1 && ref_pcm[6] == 3);
+	
+	for (int level = SIMD_SSE2; level <= simd_level(); level++) {
+		memcpy(y, x.sampleData, sizeof(double) * len);
+		scale_pcm16_kernel(level)(y, pcm, len, 1.0 / 0.5, NULL);
+		ck_assert_msg(memcmp(y, ref, sizeof(double) * len) == 0,
+			"%s scale_pcm16 should scale like scalar", simd_name(level));
+		ck_assert_msg(memcmp(pcm, ref_pcm, sizeof(short) * len) == 0,
+			"%s scale_pcm16 should encode like scalar", simd_name(level));
+	}
+	
+	free(x.sampleData);
+	free(ref);
+	free(y);
+	free(ref_pcm);
+	free(pcm);
+}
+END_TEST
+
+START_TEST(test_encoders_match_scalar) {
+	
+	// Every format, dithered & not, with samples that clip both ways and
+	// a length that leaves a scalar tail:
+	int len = 1029;
+	WaveData x = synthetic_wave(len, 13);
+	x.sampleData[3] = 2.0;
+	x.sampleData[4] = -2.0;
+	double *ref = (double *)malloc(sizeof(double) * len);
+	double *y = (double *)malloc(sizeof(double) * len);
+	int *ref_out = (int *)malloc(sizeof(int) * len);
+	int *out = (int *)malloc(sizeof(int) * len);
+	
+	simd_level();
+	for (int f = 0; f < 5; f++) {
+		for (int dither = FALSE; dither <= TRUE; dither++) {
+			for (int level = SIMD_SCALAR; level <= simd_detected; level++) {
+				double *dst = (level == SIMD_SCALAR) ? ref : y;
+				int *pcm = (level == SIMD_SCALAR) ? ref_out : out;
+				Dither d;
+				dither_init(&d, 7);
+				memcpy(dst, x.sampleData, sizeof(double) * len);
+				memset(pcm, 0, sizeof(int) * len);
+				if (f == 0)
+					scale_pcm16_kernel(level)(dst, (short *)pcm, len, 1.0 / 0.5,
+											  dither ? &d : NULL);
+				else if (f < 4)
+					scale_pcm32_kernel(level)(dst, pcm, len, 1.0 / 0.5, 8 * (f + 1),
+											  dither ? &d : NULL);
+				else
+					scale_float_kernel(level)(dst, (float *)pcm, len, 1.0 / 0.5);
+				if (level == SIMD_SCALAR)
+					continue;
+				ck_assert_msg(memcmp(y, ref, sizeof(double) * len) == 0 &&
+							  memcmp(out, ref_out, sizeof(int) * len) == 0,
+					"%s encoder %d (dither %d) should match scalar",
+					simd_name(level), f, dither);
+			}
+		}
+	}
+	
+	// 24-bit samples are left-justified & saturate; TPDF dither stays
+	// within 1 LSB of the undithered sample and averages out:
+	Dither d;
+	dither_init(&d, 7);
+	memcpy(ref, x.sampleData, sizeof(double) * len);
+	scale_pcm32_scalar(ref, ref_out, len, 1.0, 24, NULL);
+	ck_assert(ref_out[3] == 0x7FFFFF00 && ref_out[4] == (int)0x80000000);
+	memcpy(y, x.sampleData, sizeof(double) * len);
+	scale_pcm32_scalar(y, out, len, 1.0, 24, &d);
+	double mean = 0.0;
+	for (int j = 5; j < len; j++) {
+		double diff = (double)(out[j] >> 8) - x.sampleData[j] * 8388607.0;
+		ck_assert_msg(fabs(diff) < 1.5, "Dither should be under 1 LSB: %g", diff);
+		mean += diff / (len - 5);
+	}
+	ck_assert_msg(fabs(mean) < 0.1, "Dither should average out: %g", mean);
+	
+	free(x.sampleData);
+	free(ref);
+	free(y);
+	free(ref_out);
+	free(out);
+}
+END_TEST
+
+START_TEST(test_write_wav_keeps_format_and_rate) {
+	char *path = "/tmp/convolve_encode.wav";
+	WaveData x = synthetic_wave(200003, 14);
+	double *y = (double *)malloc(sizeof(double) * x.length);
+	
+	// Longer than the encoder's buffer, so it is written out in pieces.
+	// Encoding scales by 2^23 - 1 & decoding by 2^23, hence 2 LSB of slack:
+	output_format = SF_FORMAT_PCM_24;
+	memcpy(y, x.sampleData, sizeof(double) * x.length);
+	ck_assert(write_wav_normalized(path, y, x.length, 1, 48000, 2.0, FALSE) == x.length);
+	output_format = SF_FORMAT_PCM_16;
+	
+	WaveMap *wm = wave_map_open(path);
+	ck_assert(wm != NULL && wm->samplerate == 48000 && wm->bytes == 3);
+	wave_map_close(wm);
+	WaveData z = read_wav(path, FALSE);
+	ck_assert(z.length == x.length && z.samplerate == 48000);
+	for (int j = 0; j < x.length; j++)
+		ck_assert(fabs(z.sampleData[j] - x.sampleData[j] * 2.0) <= 2.0 / 8388607.0);
+	
+	free(x.sampleData);
+	free(y);
+	free(z.sampleData);
+	remove(path);
+}
+END_TEST
+
+#ifdef CONVOLVE_PROFILE
+START_TEST(test_profile_counts_stages) {
+	
+	// 10000 input samples take one transform pair per segment of the FFT
+	// length picked for a 1000 sample IR, plus the IR's own transform:
+	int fft_len = ola_fft_len(1000, 10000);
+	int segs = (10000 + fft_len - 1000) / (fft_len + 1 - 1000);
+	char *saved_dir = spectrum_cache_dir;
+	spectrum_cache_dir = NULL;
+	profile_reset();
+	engine_error(convolve_overlap_add_fft, 10000, 1000);
+	spectrum_cache_dir = saved_dir;
+	
+	ck_assert_int_eq(profile_stages[PROFILE_RFFT_POST].calls, segs + 1);
+	ck_assert_int_eq(profile_stages[PROFILE_RFFT_PRE].calls, segs);
+	ck_assert_int_eq(profile_stages[PROFILE_FFT].calls, 2 * segs + 1);
+	ck_assert_int_eq(profile_stages[PROFILE_PERMUTE].calls, 2 * segs + 1);
+	ck_assert_int_eq(profile_stages[PROFILE_SPECTRUM].calls, segs);
+	ck_assert_int_eq(profile_stages[PROFILE_SPECTRUM].bytes,
+					 segs * 6 * (fft_len / 2 + 1) * sizeof(double));
+	ck_assert_int_eq(profile_stages[PROFILE_OVERLAP_ADD].calls, segs);
+	ck_assert_int_eq(profile_stages[PROFILE_PEAK].calls, segs + 1);
+	ck_assert_int_eq(profile_stages[PROFILE_READ].calls, 0);
+	
+	// Stages run one after another, so they can't add up to more ticks
+	// than have passed:
+	double wall, rate = profile_tick_rate(&wall), secs = 0.0;
+	for (int s = 0; s < NUM_PROFILE_STAGES; s++)
+		secs += profile_stages[s].ticks / rate;
+	ck_assert_msg(secs > 0.0 && secs <= wall,
+		"Stage times should add up to at most the wall time. Stages: %g s, wall: %g s",
+		secs, wall);
+}
+END_TEST
+#endif
+
+START_TEST(test_overlap_add_matches_direct) {
+	
+	// Odd IR lengths exercise the partial unrolled loops & Nyquist bin:
+	int lengths[][2] = {{1000, 37}, {4097, 65}, {300, 1}, {20000, 1500}};
+	
+	for (int t = 0; t < 4; t++) {
+		double err = engine_error(convolve_overlap_add_fft,
+								  lengths[t][0], lengths[t][1]);
+		ck_assert_msg(err < 1e-9,
+			"FFT convolution should match direct form. Max error: %g", err);
+	}
+}
+END_TEST
+
+START_TEST(test_parallel_overlap_add_matches_serial) {
+	
+	// Overlaps shorter & longer than a segment, a single segment, and
+	// more segments than fit in one batch:
+	int lengths[][2] = {{20000, 100}, {50000, 1500}, {300, 1}, {200000, 37}};
+	
+	for (int t = 0; t < 4; t++) {
+		double *serial = NULL, serial_max = 0.0;
+		int serial_len = 0;
+		
+		for (num_threads = 1; num_threads <= 3; num_threads += 2) {
+			X = synthetic_wave(lengths[t][0], 1);
+			H = synthetic_wave(lengths[t][1], 2);
+			N = X.length;
+			M = H.length;
+			P = N + M - 1;
+			Y = (double *)malloc(sizeof(double) * P);
+			max = DBL_MIN;
+			convolve_overlap_add_fft();
+			
+			if (num_threads == 1) {
+				serial = Y;
+				serial_len = P;
+				serial_max = max;
+			}
+			else {
+				ck_assert_int_eq(P, serial_len);
+				ck_assert_msg(memcmp(Y, serial, sizeof(double) * P) == 0 &&
+							  max == serial_max,
+					"Parallel overlap-add should be bit-identical to serial "
+					"(N=%d, M=%d)", N, M);
+				free(Y);
+			}
+			free(X.sampleData);
+			free(H.sampleData);
+		}
+		free(serial);
+	}
+	num_threads = 1;
+}
+END_TEST
+
+START_TEST(test_multichannel_matches_direct) {
+	
+	// Stereo with a mono IR, mono-to-stereo, stereo-to-stereo & true stereo:
+	int layouts[][2] = {{2, 1}, {1, 2}, {2, 2}, {2, 4}};
+	
+	for (int t = 0; t < 4; t++) {
+		for (engine = ENGINE_OVERLAP_ADD; engine <= ENGINE_UNIFORM_PARTITIONED; engine++) {
+			partition_len = 64;
+			double err = multichannel_error(layouts[t][0], layouts[t][1], 3001, 150);
+			ck_assert_msg(err < 1e-9,
+				"%d-channel input with %d-channel IR should match direct form "
+				"(engine %d). Max error: %g", layouts[t][0], layouts[t][1], engine, err);
+		}
+	}
+	engine = ENGINE_OVERLAP_ADD;
+	partition_len = DEFAULT_PARTITION_LEN;
+	
+	// Layouts with no sensible routing are refused:
+	ChannelRouting r;
+	ck_assert(channel_routing(3, 2, &r) == FALSE);
+}
+END_TEST
+
+START_TEST(test_uniform_partitioned_matches_direct) {
+	
+	// IRs shorter than, equal to, and spanning many partitions:
+	int lengths[][3] = {{1000, 37, 64}, {4097, 64, 64}, {3000, 5000, 64},
+						{20000, 1500, 128}};
+	
+	for (int t = 0; t < 4; t++) {
+		partition_len = lengths[t][2];
+		double err = engine_error(convolve_uniform_partitioned,
+								  lengths[t][0], lengths[t][1]);
+		ck_assert_msg(err < 1e-9,
+			"Partitioned convolution should match direct form. Max error: %g", err);
+	}
+	partition_len = DEFAULT_PARTITION_LEN;
+}
+END_TEST
+
+START_TEST(test_nonuniform_partitioned_matches_direct) {
+	
+	// IRs covered by one, several, and the final (uniform) stage:
+	int lengths[][3] = {{1000, 37, 64}, {3000, 5000, 64},
+						{50000, 30000, 16}, {20000, 1500, 1}};
+	
+	for (int t = 0; t < 4; t++) {
+		nupols_block_len = lengths[t][2];
+		double err = engine_error(convolve_nonuniform_partitioned,
+								  lengths[t][0], lengths[t][1]);
+		ck_assert_msg(err < 1e-9,
+			"Non-uniform convolution should match direct form. Max error: %g", err);
+	}
+	nupols_block_len = DEFAULT_NUPOLS_BLOCK_LEN;
+}
+END_TEST
+	
+START_TEST(test_nonuniform_callback_cost_is_bounded) {
+	
+	// A 5 s IR at 48 kHz in 64-sample callbacks. Were every stage run in
+	// the callback completing its block, the one where all of them fall due
+	// (every NUPOLS_MAX_BLOCK_LEN samples) would cost as much as all of
+	// their blocks together:
+	int B = 64, h_len = 240000, period = NUPOLS_MAX_BLOCK_LEN / B, periods = 6;
+	WaveData h = synthetic_wave(h_len, 2);
+	WaveData x = synthetic_wave(B * period * periods, 1);
+	NonUniformConvolver *nc = nonuniform_create(h.sampleData, h_len, B);
+	double *fastest = (double *)malloc(sizeof(double) * period);
+	double block[64], t, worst = 0.0, all_due = 0.0;
+	ck_assert(nc != NULL && fastest != NULL);
+	
+	// Time each callback of a period, keeping the fastest of each after the
+	// first period, so that preemption isn't counted:
+	for (int c = 0; c < period * periods; c++) {
+		memcpy(block, x.sampleData + c * B, sizeof(double) * B);
+		t = planner_wall();
+		nonuniform_process(nc, block, block, B);
+		t = planner_wall() - t;
+		if (c >= period && (c < 2 * period || t < fastest[c % period]))
+			fastest[c % period] = t;
+	}
+	for (int c = 0; c < period; c++)
+		if (fastest[c] > worst)
+			worst = fastest[c];
+	
+	for (int s = 0; s < nc->num_stages; s++) {
+		double best = 0.0;
+		for (int r = 0; r < 3; r++) {
+			t = planner_wall();
+			partitioned_process(nc->stages[s], nc->STAGE_BUF, nc->STAGE_BUF);
+			t = planner_wall() - t;
+			if (r == 0 || t < best)
+				best = t;
+		}
+		all_due += best;
+	}
+	ck_assert_msg(worst < 0.5 * all_due,
+		"The slowest callback took %.0f us; all stages' blocks take %.0f us.",
+		worst * 1e6, all_due * 1e6);
+	
+	nonuniform_destroy(nc);
+	free(fastest);
+	free(x.sampleData);
+	free(h.sampleData);
+}
+END_TEST
+	
+START_TEST(test_input_side_matches_direct) {
+	
+	// IRs shorter than a vector, spanning several tap blocks, and longer
+	// than the input, at every SIMD level and split over threads:
+	int lengths[][2] = {{1000, 3}, {4097, 37}, {3000, 1300}, {200, 700}};
+	
+	simd_level();
+	for (int level = SIMD_SCALAR; level <= simd_detected; level++) {
+		simd_set_level(level);
+		for (int t = 0; t < 4; t++) {
+			num_threads = 1 + t % 3;
+			double err = engine_error(convolve_input_side,
+									  lengths[t][0], lengths[t][1]);
+			ck_assert_msg(err < 1e-9,
+				"%s direct form on %d threads should match reference. Max error: %g",
+				simd_name(level), num_threads, err);
+		}
+	}
+	simd_set_level(-1);
+	num_threads = 1;
+}
+END_TEST
+	
+START_TEST(test_stream_matches_direct) {
+	char *in_file = "/tmp/convolve_stream_in.wav";
+	char *ir_file = "/tmp/convolve_stream_ir.wav";
+	char *out_file = "/tmp/convolve_stream_out.wav";
+	
+	// Stereo input with a mono IR, long enough to span many blocks and
+	// ending part-way through one:
+	WaveData x = synthetic_wave(10007 * 2, 1), h = synthetic_wave(300, 2);
+	x.length = 10007;
+	x.channels = 2;
+	write_float_wav(in_file, x);
+	write_float_wav(ir_file, h);
+	
+	convolve_stream(in_file, ir_file, out_file, NORMALIZE_NONE, FALSE);
+	free(H.sampleData);
+	WaveData y = read_wav(out_file, FALSE);
+	ck_assert_int_eq(y.length, x.length + h.length - 1);
+	ck_assert_int_eq(y.channels, 2);
+	
+	double err = 0.0, peak = 0.0;
+	double **xc = deinterleave(x);
+	for (int c = 0; c < 2; c++) {
+		for (int n = 0; n < y.length; n++) {
+			double ref = 0.0;
+			for (int j = 0; j < h.length; j++)
+				if (n - j >= 0 && n - j < x.length)
+					ref += xc[c][n-j] * h.sampleData[j];
+			if (fabs(y.sampleData[n * 2 + c] - ref) > err)
+				err = fabs(y.sampleData[n * 2 + c] - ref);
+			if (fabs(ref) > peak)
+				peak = fabs(ref);
+		}
+	}
+	
+	// The output is stored as 32-bit floats:
+	ck_assert_msg(err < 1e-6 * peak,
+		"Streamed convolution should match direct form. Max error: %g", err);
+	ck_assert_msg(fabs(max - peak) < 1e-6 * peak,
+		"Streamed convolution should report the output peak. Got: %f, expected %f",
+		max, peak);
+	
+	free_channels(xc, 2);
+	free(x.sampleData);
+	free(h.sampleData);
+	free(y.sampleData);
+	remove(in_file);
+	remove(ir_file);
+	remove(out_file);
+}
+END_TEST
+	
+START_TEST(test_stream_normalization) {
+	char *in_file = "/tmp/convolve_norm_in.wav";
+	char *ir_file = "/tmp/convolve_norm_ir.wav";
+	char *out_file = "/tmp/convolve_norm_out.wav";
+	
+	WaveData x = synthetic_wave(20000, 1), h = synthetic_wave(500, 2);
+	write_float_wav(in_file, x);
+	write_float_wav(ir_file, h);
+	X = x;
+	H = h;
+	N = x.length;
+	M = h.length;
+	double *ref = direct_convolution();
+	double peak = 0.0, bound = 0.0;
+	for (int n = 0; n < N + M - 1; n++)
+		if (fabs(ref[n]) > peak)
+			peak = fabs(ref[n]);
+	for (int j = 0; j < M; j++)
+		bound += fabs(h.sampleData[j]);
+	
+	// Two passes scale to the true peak, one pass to the impulse
+	// response's bound on it:
+	int modes[] = {NORMALIZE_TWO_PASS, NORMALIZE_BOUND};
+	double scales[] = {1.0 / peak, 1.0 / bound};
+	for (int t = 0; t < 2; t++) {
+		convolve_stream(in_file, ir_file, out_file, modes[t], FALSE);
+		free(H.sampleData);
+		WaveData y = read_wav(out_file, FALSE);
+		ck_assert_int_eq(y.length, N + M - 1);
+		
+		// The output is 16-bit PCM:
+		double err = 0.0;
+		for (int n = 0; n < y.length; n++)
+			if (fabs(y.sampleData[n] - ref[n] * scales[t]) > err)
+				err = fabs(y.sampleData[n] - ref[n] * scales[t]);
+		ck_assert_msg(err < 2.0 / 32768,
+			"Normalized stream (mode %d) should match direct form. Max error: %g",
+			modes[t], err);
+		free(y.sampleData);
+	}
+	
+	free(ref);
+	free(x.sampleData);
+	free(h.sampleData);
+	remove(in_file);
+	remove(ir_file);
+	remove(out_file);
+}
+END_TEST
+	
+START_TEST(test_spectrum_cache_matches_uncached) {
+	char dir[] = "/tmp/convolve_cache.XXXXXX";
+	ck_assert(mkdtemp(dir) != NULL);
+	spectrum_cache_dir = dir;
+	partition_len = 64;
+	nupols_block_len = 16;
+	
+	// The first run of each engine fills the cache, the second maps it:
+	void (*engines[])(void) = {convolve_overlap_add_fft,
+		convolve_uniform_partitioned, convolve_nonuniform_partitioned};
+	for (int e = 0; e < 3; e++) {
+		double err = engine_error(engines[e], 5000, 1200);
+		int files = cache_files(dir, FALSE);
+		ck_assert_msg(files > 0, "Engine %d should fill the cache.", e);
+		
+		double cached_err = engine_error(engines[e], 5000, 1200);
+		ck_assert_msg(err < 1e-9 && cached_err == err,
+			"Cached spectra should give identical output (engine %d). "
+			"Max errors: %g & %g", e, err, cached_err);
+		ck_assert_int_eq(cache_files(dir, TRUE), files);
+	}
+	
+	spectrum_cache_dir = NULL;
+	partition_len = DEFAULT_PARTITION_LEN;
+	nupols_block_len = DEFAULT_NUPOLS_BLOCK_LEN;
+	rmdir(dir);
+}
+END_TEST
+	
+/**
+ * Thread body for test_spectrum_cache_concurrent_stores(): store the
+ * 4 x 4097 bin spectra in arg under one key.
+ */
+void * store_spectra(void *arg) {
+	double *spectra = (double *)arg;
+	spectra_store(42, 8192, 4096, 4, 4097, spectra, spectra + 4 * 4097);
+	return NULL;
+}
+
+START_TEST(test_spectrum_cache_concurrent_stores) {
+	char dir[] = "/tmp/convolve_cache.XXXXXX";
+	ck_assert(mkdtemp(dir) != NULL);
+	spectrum_cache_dir = dir;
+	
+	// Threads storing the same key each write their own temporary file,
+	// so whichever is renamed last, the entry is whole:
+	WaveData spectra = synthetic_wave(2 * 4 * 4097, 15);
+	pthread_t threads[4];
+	for (int t = 0; t < 4; t++)
+		pthread_create(&threads[t], NULL, store_spectra, spectra.sampleData);
+	for (int t = 0; t < 4; t++)
+		pthread_join(threads[t], NULL);
+	
+	CachedSpectra *cs = spectra_load(42, 8192, 4096, 4, 4097);
+	ck_assert(cs != NULL);
+	for (int k = 0; k < 4; k++)
+		ck_assert(memcmp(cs->REFR + k * 4097, spectra.sampleData + k * 4097,
+						 sizeof(double) * 4097) == 0);
+	spectra_release(cs);
+	ck_assert_int_eq(cache_files(dir, TRUE), 1);
+	
+	free(spectra.sampleData);
+	spectrum_cache_dir = NULL;
+	rmdir(dir);
+}
+END_TEST
+	
+START_TEST(test_batch_matches_stream) {
+	char *ir_file = "/tmp/convolve_batch_ir.wav";
+	char *manifest = "/tmp/convolve_batch.txt";
+	char in_file[64], out_file[64];
+	
+	// Alternate mono & stereo inputs, so that workers re-route their
+	// convolvers between jobs:
+	WaveData h = synthetic_wave(700, 2);
+	write_float_wav(ir_file, h);
+	FILE *fp = fopen(manifest, "w");
+	fprintf(fp, "# input output\n");
+	for (int j = 0; j < 6; j++) {
+		WaveData x = synthetic_wave(3000 * (j % 2 + 1) + j, j + 10);
+		x.channels = j % 2 + 1;
+		x.length /= x.channels;
+		sprintf(in_file, "/tmp/convolve_batch_in%d.wav", j);
+		write_float_wav(in_file, x);
+		fprintf(fp, "%s /tmp/convolve_batch_out%d.wav\n", in_file, j);
+		free(x.sampleData);
+	}
+	fclose(fp);
+	
+	int failed = convolve_batch(manifest, ir_file, NULL, NORMALIZE_TWO_PASS, 3, FALSE);
+	ck_assert_int_eq(failed, 0);
+	
+	// Every output should match a single streamed render exactly:
+	for (int j = 0; j < 6; j++) {
+		sprintf(in_file, "/tmp/convolve_batch_in%d.wav", j);
+		sprintf(out_file, "/tmp/convolve_batch_out%d.wav", j);
+		convolve_stream(in_file, ir_file, "/tmp/convolve_batch_ref.wav",
+						NORMALIZE_TWO_PASS, FALSE);
+		free(H.sampleData);
+		WaveData y = read_wav(out_file, FALSE);
+		WaveData ref = read_wav("/tmp/convolve_batch_ref.wav", FALSE);
+		ck_assert_int_eq(y.length, ref.length);
+		ck_assert_int_eq(y.channels, ref.channels);
+		ck_assert_msg(memcmp(y.sampleData, ref.sampleData,
+							 sizeof(double) * y.length * y.channels) == 0,
+			"Batch job %d should match a streamed render.", j);
+		free(y.sampleData);
+		free(ref.sampleData);
+		remove(in_file);
+		remove(out_file);
+	}
+	
+	// Malformed manifests are refused:
+	fp = fopen(manifest, "w");
+	fprintf(fp, "/tmp/convolve_batch_in0.wav\n");
+	fclose(fp);
+	ck_assert_int_eq(convolve_batch(manifest, ir_file, NULL, NORMALIZE_NONE, 1, FALSE), -1);
+	
+	free(h.sampleData);
+	remove(ir_file);
+	remove(manifest);
+	remove("/tmp/convolve_batch_ref.wav");
+}
+END_TEST
+	
+START_TEST(test_library_matches_direct) {
+	int frames = 5000, h_len = 700;
+	int chunks[] = {1, 37, 500, 64, 1000, 3};
+	
+	// Stereo with a mono IR & true stereo, through every engine:
+	int layouts[][2] = {{2, 1}, {2, 4}};
+	for (int t = 0; t < 2; t++) {
+		int in_channels = layouts[t][0], ir_channels = layouts[t][1];
+		ChannelRouting r;
+		channel_routing(in_channels, ir_channels, &r);
+		WaveData x = synthetic_wave(frames * in_channels, 1);
+		WaveData h = synthetic_wave(h_len * ir_channels, 2);
+		x.length = frames;
+		x.channels = in_channels;
+		h.length = h_len;
+		h.channels = ir_channels;
+		double **xc = deinterleave(x), **hc = deinterleave(h);
+		
+		for (int eng = CONVOLVER_OLA; eng <= CONVOLVER_NUPOLS; eng++) {
+			Convolver *cv = convolver_create(hc, h_len, ir_channels, in_channels,
+											 eng, 64);
+			ck_assert(cv != NULL);
+			ck_assert_int_eq(convolver_out_channels(cv), r.out_channels);
+			int latency = convolver_latency(cv);
+			int total = frames + convolver_tail_len(cv);
+			double **y = alloc_channels(r.out_channels, total);
+			double *in[MAX_CHANNELS], *out[MAX_CHANNELS];
+			
+			// Run twice, to check that flushing resets the convolver:
+			for (int run = 0; run < 2; run++) {
+				int done = 0, n;
+				for (int k = 0; done < frames; k++, done += n) {
+					n = chunks[k % 6];
+					if (n > frames - done)
+						n = frames - done;
+					for (int c = 0; c < in_channels; c++)
+						in[c] = xc[c] + done;
+					for (int o = 0; o < r.out_channels; o++)
+						out[o] = y[o] + done;
+					convolver_process(cv, in, out, n);
+				}
+				for (int o = 0; o < r.out_channels; o++)
+					out[o] = y[o] + frames;
+				convolver_flush(cv, out);
+				
+				double err = 0.0;
+				for (int o = 0; o < r.out_channels; o++) {
+					for (int k = 0; k < total; k++) {
+						double ref = 0.0;
+						int n0 = k - latency;
+						for (int rt = 0; rt < r.num_routes; rt++) {
+							if (r.route_out[rt] != o)
+								continue;
+							for (int j = 0; j < h_len; j++)
+								if (n0 - j >= 0 && n0 - j < frames)
+									ref += xc[r.route_in[rt]][n0-j] * hc[r.route_ir[rt]][j];
+						}
+						if (fabs(y[o][k] - ref) > err)
+							err = fabs(y[o][k] - ref);
+					}
+				}
+				ck_assert_msg(err < 1e-9,
+					"Library convolver (engine %d, %d-in, %d-IR, run %d) should "
+					"match direct form. Max error: %g", eng, in_channels,
+					ir_channels, run, err);
+			}
+			free_channels(y, r.out_channels);
+			convolver_destroy(cv);
+		}
+		free_channels(xc, in_channels);
+		free_channels(hc, ir_channels);
+		free(x.sampleData);
+		free(h.sampleData);
+	}
+	
+	// Unsupported arguments are refused:
+	double *h1[1] = {NULL};
+	ck_assert(convolver_create(h1, 0, 1, 1, CONVOLVER_OLA, 0) == NULL);
+	ck_assert(convolver_create(h1, 10, 2, 3, CONVOLVER_OLA, 0) == NULL);
+	ck_assert(convolver_create(h1, 10, 1, 1, CONVOLVER_UPOLS, 100) == NULL);
+}
+END_TEST
+
+START_TEST(test_arena_reuses_aligned_storage) {
+	Arena a = {0};
+	
+	// An empty arena serves every request separately, aligned:
+	double *p = (double *)arena_alloc(&a, sizeof(double) * 100);
+	double *q = (double *)arena_calloc(&a, 33, sizeof(double));
+	ck_assert(p != NULL && q != NULL && a.num_overflow == 2);
+	ck_assert((uintptr_t)p % ARENA_ALIGN == 0 && (uintptr_t)q % ARENA_ALIGN == 0);
+	for (int j = 0; j < 33; j++)
+		ck_assert(q[j] == 0.0);
+	
+	// Emptying it regrows its block to fit both, which is then reused:
+	arena_release(&a, 0);
+	ck_assert(a.num_overflow == 0 && a.size >= sizeof(double) * 133);
+	char *base = a.base;
+	p = (double *)arena_alloc(&a, sizeof(double) * 100);
+	size_t mark = arena_mark(&a);
+	q = (double *)arena_calloc(&a, 33, sizeof(double));
+	ck_assert((char *)p == base && a.num_overflow == 0);
+	ck_assert((uintptr_t)q % ARENA_ALIGN == 0);
+	arena_release(&a, mark);
+	ck_assert(arena_alloc(&a, 8) == (void *)q);
+	arena_release(&a, 0);
+	arena_destroy(&a);
+	
+	// The engines leave the scratch arena empty, and a repeat of the same
+	// convolution allocates no scratch at all:
+	int engines[] = {ENGINE_OVERLAP_ADD, ENGINE_UNIFORM_PARTITIONED,
+					 ENGINE_NONUNIFORM_PARTITIONED};
+	arena_destroy(&scratch);
+	num_threads = 2;
+	for (int e = 0; e < 3; e++) {
+		engine = engines[e];
+		for (int run = 0; run < 2; run++) {
+			ck_assert(engine_error(run_engine, 20000, 3000) < 1e-9);
+			ck_assert_msg(scratch.used == 0 && scratch.num_overflow == 0,
+				"engine %d should release its scratch", engine);
+			if (run == 0)
+				base = scratch.base;
+			else
+				ck_assert_msg(scratch.base == base,
+					"engine %d should reuse its scratch", engine);
+		}
+	}
+	engine = ENGINE_OVERLAP_ADD;
+	num_threads = 1;
+}
+END_TEST
+
+START_TEST(test_wave_map_matches_sndfile) {
+	char *path = "/tmp/convolve_wave_map.wav";
+	int formats[] = {SF_FORMAT_PCM_16, SF_FORMAT_PCM_24, SF_FORMAT_PCM_32,
+					 SF_FORMAT_FLOAT};
+	WaveData x = synthetic_wave(3001 * 2, 12);
+	x.length = 3001;
+	x.channels = 2;
+	
+	// Every supported format decodes to what libsndfile reads:
+	for (int f = 0; f < 4; f++) {
+		SNDFILE *sf = create_wav(path, 2, 44100, formats[f]);
+		sf_writef_double(sf, x.sampleData, x.length);
+		sf_close(sf);
+		
+		SF_INFO info;
+		info.format = 0;
+		sf = sf_open(path, SFM_READ, &info);
+		double *ref = (double *)malloc(sizeof(double) * x.length * 2);
+		sf_readf_double(sf, ref, x.length);
+		sf_close(sf);
+		
+		WaveMap *wm = wave_map_open(path);
+		ck_assert(wm != NULL && wm->frames == x.length && wm->channels == 2);
+		wave_map_close(wm);
+		WaveData y = read_wav(path, FALSE);
+		ck_assert(y.length == x.length && y.channels == 2);
+		for (int j = 0; j < x.length * 2; j++)
+			ck_assert_msg(y.sampleData[j] == ref[j],
+				"Mapped sample %d of format %x should match libsndfile: %g vs %g",
+				j, formats[f], y.sampleData[j], ref[j]);
+		free(ref);
+		free(y.sampleData);
+	}
+	free(x.sampleData);
+	
+	// An RF64 file, whose data chunk size is only given in its ds64 chunk:
+	unsigned char hdr[80] = "RF64\xff\xff\xff\xffWAVEds64\x1c\0\0\0";
+	short pcm[5] = {0, 16384, -32768, 32767, -1};
+	int len = 20;
+	hdr[len + 8] = sizeof(pcm);	// ds64: riff size, data size, sample count
+	len += 28;
+	memcpy(hdr + len, "fmt \x10\0\0\0\x01\0\x01\0\x44\xac\0\0"
+					  "\x88\x58\x01\0\x02\0\x10\0data\xff\xff\xff\xff", 32);
+	len += 32;
+	FILE *fp = fopen(path, "wb");
+	fwrite(hdr, 1, len, fp);
+	fwrite(pcm, sizeof(short), 5, fp);
+	fclose(fp);
+	
+	WaveData y = read_wav(path, FALSE);
+	ck_assert(y.length == 5 && y.channels == 1);
+	for (int j = 0; j < 5; j++)
+		ck_assert(y.sampleData[j] == pcm[j] / 32768.0);
+	free(y.sampleData);
+	remove(path);
+}
+END_TEST
+	
+START_TEST(test_planner_remembers_choice) {
+	wisdom_file = "/tmp/convolve_wisdom.txt";
+	remove(wisdom_file);
+
+	// Planning measures the candidates, picks a working engine and
+	// records it:
+	X = synthetic_wave(30000, 1);
+	H = synthetic_wave(500, 2);
+	engine = ENGINE_AUTO;
+	plan_engine(FALSE);
+	ck_assert(engine == ENGINE_INPUT_SIDE || engine == ENGINE_OVERLAP_ADD ||
+			  engine == ENGINE_UNIFORM_PARTITIONED);
+	int planned = engine;
+	PlanKey first = plan_key(), key;
+	Wisdom w;
+	ck_assert(wisdom_load(&first, &w) == TRUE && w.engine == planned);
+	free(X.sampleData);
+	free(H.sampleData);
+	ck_assert(engine_error(run_engine, 30000, 500) < 1e-9);
+
+	// A different workload isn't covered by that wisdom:
+	X = synthetic_wave(30000, 1);
+	H = synthetic_wave(5000, 2);
+	key = plan_key();
+	ck_assert(wisdom_load(&key, &w) == FALSE);
+
+	// Nor by entries naming no concrete engine or a bad block length,
+	// which are replanned:
+	FILE *fp = fopen(wisdom_file, "a");
+	ck_assert(fp != NULL);
+	fprintf(fp, "%d %d %d %d %d %d %d %d 0 0.1\n", key.n_class, key.m_class,
+			key.in_channels, key.ir_channels, key.threads, key.precision,
+			key.simd, ENGINE_AUTO);
+	fprintf(fp, "%d %d %d %d %d %d %d %d 1000 0.1\n", key.n_class, key.m_class,
+			key.in_channels, key.ir_channels, key.threads, key.precision,
+			key.simd, ENGINE_UNIFORM_PARTITIONED);
+	fclose(fp);
+	ck_assert(wisdom_load(&key, &w) == FALSE);
+	engine = ENGINE_AUTO;
+	plan_engine(FALSE);
+	ck_assert(engine >= 0 && engine < ENGINE_AUTO);
+	ck_assert(wisdom_load(&key, &w) == TRUE && w.engine == engine);
+
+	// Later runs take whatever the wisdom file says, untimed:
+	memset(&w, 0, sizeof(w));
+	w.key = key;
+	w.engine = ENGINE_UNIFORM_PARTITIONED;
+	w.block_len = 1024;
+	wisdom_store(&w);
+	engine = ENGINE_AUTO;
+	plan_engine(FALSE);
+	ck_assert(engine == ENGINE_UNIFORM_PARTITIONED && partition_len == 1024);
+	ck_assert(wisdom_load(&first, &w) == TRUE && w.engine == planned);
+
+	free(X.sampleData);
+	free(H.sampleData);
+	remove(wisdom_file);
+	wisdom_file = NULL;
+	engine = ENGINE_OVERLAP_ADD;
+	partition_len = DEFAULT_PARTITION_LEN;
+	nupols_block_len = DEFAULT_NUPOLS_BLOCK_LEN;
+}
+END_TEST
 	
 Suite * convolution_suite(void) {
 	Suite *s;
@@ -80,6 +1479,37 @@ Suite * convolution_suite(void) {
 
 	tcase_add_test(tc_core, test_initialize);
 	tcase_add_test(tc_core, test_convolve);
+	tcase_add_test(tc_core, test_fft_plan_matches_realft);
+	tcase_add_test(tc_core, test_split_rfft_matches_packed);
+	tcase_add_test(tc_core, test_fft_simd_levels_match_scalar);
+	tcase_add_test(tc_core, test_mixed_radix_fft_matches_dft);
+	tcase_add_test(tc_core, test_spectrum_kernels_match_scalar);
+	tcase_add_test(tc_core, test_float_fft_matches_double);
+	tcase_add_test(tc_core, test_float_spectrum_kernels_match_scalar);
+	tcase_add_test(tc_core, test_float_overlap_add_accuracy);
+	tcase_add_test(tc_core, test_peak_kernels_match_scalar);
+	tcase_add_test(tc_core, test_scale_pcm16_matches_scalar);
+	tcase_add_test(tc_core, test_encoders_match_scalar);
+	tcase_add_test(tc_core, test_write_wav_keeps_format_and_rate);
+#ifdef CONVOLVE_PROFILE
+	tcase_add_test(tc_core, test_profile_counts_stages);
+#endif
+	tcase_add_test(tc_core, test_overlap_add_matches_direct);
+	tcase_add_test(tc_core, test_parallel_overlap_add_matches_serial);
+	tcase_add_test(tc_core, test_multichannel_matches_direct);
+	tcase_add_test(tc_core, test_uniform_partitioned_matches_direct);
+	tcase_add_test(tc_core, test_nonuniform_partitioned_matches_direct);
+	tcase_add_test(tc_core, test_nonuniform_callback_cost_is_bounded);
+	tcase_add_test(tc_core, test_input_side_matches_direct);
+	tcase_add_test(tc_core, test_stream_matches_direct);
+	tcase_add_test(tc_core, test_stream_normalization);
+	tcase_add_test(tc_core, test_spectrum_cache_matches_uncached);
+	tcase_add_test(tc_core, test_spectrum_cache_concurrent_stores);
+	tcase_add_test(tc_core, test_batch_matches_stream);
+	tcase_add_test(tc_core, test_library_matches_direct);
+	tcase_add_test(tc_core, test_arena_reuses_aligned_storage);
+	tcase_add_test(tc_core, test_wave_map_matches_sndfile);
+	tcase_add_test(tc_core, test_planner_remembers_choice);
 	tcase_set_timeout(tc_core, 0);
 	suite_add_tcase(s, tc_core);
 